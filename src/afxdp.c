@@ -0,0 +1,962 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+#ifndef ECMH_BPF
+
+/* Where things are in the XDP program, patched in at load time */
+#define AFXDP_INSN_PROTOCOL	6
+#define AFXDP_INSN_GROUPS	17
+#define AFXDP_INSN_GROUPMAP	19
+#define AFXDP_INSN_MAP		25
+
+/* Instructions of the group lookup, replaced when there is no group filter */
+#define AFXDP_GROUPS_LEN	7
+
+/* Multi-buffer (Linux 6.6), older headers lack it, older kernels refuse it at bind() */
+#ifndef XDP_USE_SG
+#define XDP_USE_SG		(1 << 4)
+#endif
+#ifndef XDP_PKT_CONTD
+#define XDP_PKT_CONTD		(1 << 0)
+#endif
+
+/* What a frame holds, see afxdp_send() */
+#define AFXDP_FRAME_OTHER	0	/* Not a received packet we have */
+#define AFXDP_FRAME_RECEIVED	1	/* A received packet, with it's own Ethernet header */
+#define AFXDP_FRAME_REWRITTEN	2	/* Same, but the header is that of a replica now */
+
+/* The packet headers as the XDP program sees them */
+#define AFXDP_L3		((int)sizeof(struct ether_header))
+#define AFXDP_NXT		(AFXDP_L3 + (int)offsetof(struct ip6_hdr, ip6_nxt))
+#define AFXDP_DST		(AFXDP_L3 + (int)offsetof(struct ip6_hdr, ip6_dst))
+#define AFXDP_EXT		(AFXDP_L3 + (int)sizeof(struct ip6_hdr))
+
+/* The UMEM and the socket that registered it */
+static uint8_t *afxdp_umem = NULL;
+static int afxdp_umemfd = -1;
+
+/*
+ * The frames nobody uses, and for the others: the socket that has
+ * it on it's fill or receive ring, what it holds and the number of
+ * references, that is the ring plus the transmit descriptors in it.
+ */
+static uint64_t afxdp_free[AFXDP_FRAMES];
+static uint64_t afxdp_freecount = 0;
+static struct afxdp_sock *afxdp_owner[AFXDP_FRAMES];
+static uint8_t afxdp_state[AFXDP_FRAMES];
+static uint16_t afxdp_refs[AFXDP_FRAMES];
+
+/* Descriptors on transmit rings, at most AFXDP_TXFRAMES, and the sockets there are */
+static uint64_t afxdp_txcount = 0;
+static unsigned int afxdp_socks = 0;
+
+/* Whether a packet can be sent in pieces, see afxdp_send() */
+static bool afxdp_sg = false;
+
+/* The sockets by their fd, see afxdp_find() */
+static struct afxdp_sock **afxdp_fds = NULL;
+static unsigned int afxdp_fdcount = 0;
+
+/* Sockets with frames on their transmit ring that were not sent yet */
+static struct afxdp_sock *afxdp_pending = NULL;
+
+/* The socket the last received frames are from, and how many */
+static struct afxdp_sock *afxdp_held = NULL;
+static unsigned int afxdp_heldcount = 0;
+
+/*
+ * Take a frame, for the fill ring of a socket or
+ * with xsk NULL for sending. Returns false when
+ * they are all in use.
+ */
+static bool afxdp_frame_get(struct afxdp_sock *xsk, uint64_t *addr);
+static bool afxdp_frame_get(struct afxdp_sock *xsk, uint64_t *addr)
+{
+	if (afxdp_freecount == 0) return false;
+
+	*addr = afxdp_free[--afxdp_freecount];
+	afxdp_owner[*addr / AFXDP_FRAMESIZE] = xsk;
+	afxdp_refs[*addr / AFXDP_FRAMESIZE] = 1;
+
+	return true;
+}
+
+/* Drop a reference to a frame, addr can point anywhere inside it */
+static void afxdp_frame_put(uint64_t addr);
+static void afxdp_frame_put(uint64_t addr)
+{
+	uint64_t frame = addr / AFXDP_FRAMESIZE;
+
+	if (--afxdp_refs[frame] > 0) return;
+
+	afxdp_owner[frame] = NULL;
+	afxdp_state[frame] = AFXDP_FRAME_OTHER;
+	afxdp_free[afxdp_freecount++] = frame * AFXDP_FRAMESIZE;
+}
+
+/* The sockets of the interfaces are gone already */
+static void afxdp_cleanup(void);
+static void afxdp_cleanup(void)
+{
+	if (afxdp_umemfd != -1) close(afxdp_umemfd);
+	if (afxdp_umem) munmap(afxdp_umem, AFXDP_FRAMES * AFXDP_FRAMESIZE);
+
+	free(afxdp_fds);
+
+	afxdp_umemfd = -1;
+	afxdp_umem = NULL;
+	afxdp_freecount = 0;
+	afxdp_txcount = 0;
+	afxdp_sg = false;
+	afxdp_fds = NULL;
+	afxdp_fdcount = 0;
+}
+
+/*
+ * Register the UMEM with a socket on the loopback, all the
+ * other sockets share it. When this fails the kernel can't
+ * do AF_XDP and we stay with the PACKET socket.
+ */
+static bool afxdp_init(void);
+static bool afxdp_init(void)
+{
+	struct xdp_umem_reg	reg;
+	struct sockaddr_xdp	sxdp;
+	int			size = AFXDP_RING;
+	uint64_t		i;
+
+	afxdp_umem = mmap(NULL, AFXDP_FRAMES * AFXDP_FRAMESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (afxdp_umem == MAP_FAILED)
+	{
+		dolog(LOG_ERR, "Couldn't allocate the AF_XDP frames: %s (%d)\n", strerror(errno), errno);
+		afxdp_umem = NULL;
+		return false;
+	}
+
+	afxdp_umemfd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (afxdp_umemfd == -1)
+	{
+		dolog(LOG_WARNING, "Couldn't create an AF_XDP socket: %s (%d)\n", strerror(errno), errno);
+		afxdp_cleanup();
+		return false;
+	}
+
+	memzero(&reg, sizeof(reg));
+	reg.addr	= (uint64_t)(unsigned long)afxdp_umem;
+	reg.len		= AFXDP_FRAMES * AFXDP_FRAMESIZE;
+	reg.chunk_size	= AFXDP_FRAMESIZE;
+
+	/* The rings are required, but only those of the sharing sockets are used */
+	if (	setsockopt(afxdp_umemfd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 ||
+		setsockopt(afxdp_umemfd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) != 0 ||
+		setsockopt(afxdp_umemfd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) != 0 ||
+		setsockopt(afxdp_umemfd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't register the AF_XDP frames: %s (%d)\n", strerror(errno), errno);
+		afxdp_cleanup();
+		return false;
+	}
+
+	/* Copy mode, which the sharing sockets inherit, generic XDP can't do better */
+	memzero(&sxdp, sizeof(sxdp));
+	sxdp.sxdp_family	= AF_XDP;
+	sxdp.sxdp_flags		= XDP_COPY;
+	sxdp.sxdp_ifindex	= 1;
+	sxdp.sxdp_queue_id	= 0;
+
+	/* And multi-buffer when the kernel has it */
+	sxdp.sxdp_flags		= XDP_COPY | XDP_USE_SG;
+	afxdp_sg = (bind(afxdp_umemfd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0);
+	sxdp.sxdp_flags		= XDP_COPY;
+
+	if (!afxdp_sg && bind(afxdp_umemfd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't bind an AF_XDP socket: %s (%d)\n", strerror(errno), errno);
+		afxdp_cleanup();
+		return false;
+	}
+
+	for (i = 0; i < AFXDP_FRAMES; i++)
+	{
+		afxdp_free[i] = (AFXDP_FRAMES - 1 - i) * AFXDP_FRAMESIZE;
+		afxdp_owner[i] = NULL;
+		afxdp_state[i] = AFXDP_FRAME_OTHER;
+		afxdp_refs[i] = 0;
+	}
+	afxdp_freecount = AFXDP_FRAMES;
+
+	dolog(LOG_INFO, "Receiving and sending through AF_XDP sockets\n");
+	return true;
+}
+
+/* Map a ring of a socket, descsize is the size of one entry */
+static bool afxdp_ring_map(int fd, struct afxdp_ring *ring, const struct xdp_ring_offset *off, off_t pgoff, size_t descsize);
+static bool afxdp_ring_map(int fd, struct afxdp_ring *ring, const struct xdp_ring_offset *off, off_t pgoff, size_t descsize)
+{
+	ring->maplen = off->desc + (AFXDP_RING * descsize);
+	ring->map = mmap(NULL, ring->maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (ring->map == MAP_FAILED)
+	{
+		dolog(LOG_WARNING, "Couldn't map an AF_XDP ring: %s (%d)\n", strerror(errno), errno);
+		ring->map = NULL;
+		return false;
+	}
+
+	ring->producer	= (volatile uint32_t *)((uint8_t *)ring->map + off->producer);
+	ring->consumer	= (volatile uint32_t *)((uint8_t *)ring->map + off->consumer);
+	ring->descs	= (uint8_t *)ring->map + off->desc;
+	ring->head	= 0;
+
+	return true;
+}
+
+static void afxdp_ring_unmap(struct afxdp_ring *ring);
+static void afxdp_ring_unmap(struct afxdp_ring *ring)
+{
+	if (ring->map) munmap(ring->map, ring->maplen);
+	ring->map = NULL;
+}
+
+/*
+ * Hand free frames to the kernel to receive in. There are
+ * at most AFXDP_SOCKS sockets and a transmit descriptor
+ * keeps at most one frame from coming back, thus with at
+ * most AFXDP_TXFRAMES of those there are always enough.
+ */
+static void afxdp_fill(struct afxdp_sock *xsk);
+static void afxdp_fill(struct afxdp_sock *xsk)
+{
+	uint64_t	*descs = (uint64_t *)xsk->fill.descs;
+	uint64_t	addr;
+
+	/* The ring is larger than what we put on it, thus never full */
+	while (xsk->filled < AFXDP_FILL && afxdp_frame_get(xsk, &addr))
+	{
+		descs[xsk->fill.head++ & (AFXDP_RING - 1)] = addr;
+		xsk->filled++;
+	}
+
+	__sync_synchronize();
+	*xsk->fill.producer = xsk->fill.head;
+}
+
+/* Take back the frames the kernel has sent, one for every descriptor */
+static void afxdp_complete(struct afxdp_sock *xsk);
+static void afxdp_complete(struct afxdp_sock *xsk)
+{
+	uint64_t	*descs = (uint64_t *)xsk->comp.descs;
+	uint32_t	producer = *xsk->comp.producer;
+
+	__sync_synchronize();
+
+	while (xsk->comp.head != producer)
+	{
+		afxdp_frame_put(descs[xsk->comp.head++ & (AFXDP_RING - 1)]);
+		xsk->sending--;
+		afxdp_txcount--;
+	}
+
+	__sync_synchronize();
+	*xsk->comp.consumer = xsk->comp.head;
+}
+
+/*
+ * Redirects the multicast we forward to the socket of the queue,
+ * that is the groups in the map of the group filter, or all
+ * routable multicast when there is no group filter.
+ */
+static bool afxdp_prog_load(struct afxdp_sock *xsk);
+static bool afxdp_prog_load(struct afxdp_sock *xsk)
+{
+	struct bpf_insn insns[] =
+	{
+		/* 0: Too short? -> pass */
+		EBPF_LDX_W(BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)),
+		EBPF_LDX_W(BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)),
+		EBPF_MOV_REG(BPF_REG_4, BPF_REG_2),
+		EBPF_ADD_IMM(BPF_REG_4, AFXDP_EXT + 1),
+		EBPF_JGT_REG(BPF_REG_4, BPF_REG_3, 25),
+
+		/* 5: Not IPv6? -> pass */
+		EBPF_LDX_H(BPF_REG_4, BPF_REG_2, offsetof(struct ether_header, ether_type)),
+		EBPF_JNE_IMM(BPF_REG_4, 0, 23),
+
+		/* 7: Not multicast, or node or link local? -> pass */
+		EBPF_LDX_B(BPF_REG_4, BPF_REG_2, AFXDP_DST),
+		EBPF_JNE_IMM(BPF_REG_4, 0xff, 21),
+		EBPF_LDX_B(BPF_REG_4, BPF_REG_2, AFXDP_DST + 1),
+		EBPF_AND_IMM(BPF_REG_4, 0x0f),
+		EBPF_JLE_IMM(BPF_REG_4, 2, 18),
+
+		/* 12: ICMPv6, directly or behind a Hop-by-Hop header? -> pass */
+		EBPF_LDX_B(BPF_REG_4, BPF_REG_2, AFXDP_NXT),
+		EBPF_JEQ_IMM(BPF_REG_4, IPPROTO_ICMPV6, 16),
+		EBPF_JNE_IMM(BPF_REG_4, IPPROTO_HOPOPTS, 2),
+		EBPF_LDX_B(BPF_REG_4, BPF_REG_2, AFXDP_EXT),
+		EBPF_JEQ_IMM(BPF_REG_4, IPPROTO_ICMPV6, 13),
+
+		/* 17: Not a group we forward? -> pass */
+		EBPF_MOV_REG(BPF_REG_6, BPF_REG_1),
+		EBPF_ADD_IMM(BPF_REG_2, AFXDP_DST),
+		EBPF_LD_MAP_FD(BPF_REG_1),
+		EBPF_CALL(BPF_FUNC_map_lookup_elem),
+		EBPF_JEQ_IMM(BPF_REG_0, 0, 7),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+
+		/* 24: Redirect, or pass when the queue has no socket */
+		EBPF_LDX_W(BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index)),
+		EBPF_LD_MAP_FD(BPF_REG_1),
+		EBPF_MOV_IMM(BPF_REG_3, XDP_PASS),
+		EBPF_CALL(BPF_FUNC_redirect_map),
+		EBPF_EXIT(),
+
+		/* 30: Pass */
+		EBPF_MOV_IMM(BPF_REG_0, XDP_PASS),
+		EBPF_EXIT(),
+	};
+	struct bpf_insn	nop = EBPF_MOV_REG(BPF_REG_1, BPF_REG_1);
+	union bpf_attr	attr;
+	uint32_t	key = 0, value = xsk->fd;
+	unsigned int	i;
+
+	insns[AFXDP_INSN_PROTOCOL].imm	= htons(ETH_P_IPV6);
+
+	if (filter_groups_map() >= 0)
+	{
+		insns[AFXDP_INSN_GROUPMAP].imm = filter_groups_map();
+	}
+	else
+	{
+		/* The verifier rejects code that is never reached, thus no-ops instead */
+		for (i = AFXDP_INSN_GROUPS; i < AFXDP_INSN_GROUPS + AFXDP_GROUPS_LEN; i++)
+		{
+			insns[i] = nop;
+		}
+	}
+
+	/* Only the first queue has a socket */
+	memzero(&attr, sizeof(attr));
+	attr.map_type		= BPF_MAP_TYPE_XSKMAP;
+	attr.key_size		= sizeof(key);
+	attr.value_size		= sizeof(value);
+	attr.max_entries	= 1;
+
+	xsk->map = filter_bpf(BPF_MAP_CREATE, &attr);
+	if (xsk->map < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't create the XSKMAP: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	memzero(&attr, sizeof(attr));
+	attr.map_fd		= xsk->map;
+	attr.key		= (uint64_t)(unsigned long)&key;
+	attr.value		= (uint64_t)(unsigned long)&value;
+
+	if (filter_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't put the AF_XDP socket in the XSKMAP: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	insns[AFXDP_INSN_MAP].imm	= xsk->map;
+
+	memzero(&attr, sizeof(attr));
+	attr.prog_type			= BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type	= BPF_XDP;
+	attr.insn_cnt			= sizeof(insns) / sizeof(insns[0]);
+	attr.insns			= (uint64_t)(unsigned long)insns;
+	attr.license			= (uint64_t)(unsigned long)"GPL";
+
+	xsk->prog = filter_bpf(BPF_PROG_LOAD, &attr);
+	if (xsk->prog < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't load the XDP program: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/* Attach the program, in driver mode when possible, otherwise generic */
+static bool afxdp_prog_attach(struct afxdp_sock *xsk);
+static bool afxdp_prog_attach(struct afxdp_sock *xsk)
+{
+	union bpf_attr attr;
+
+	memzero(&attr, sizeof(attr));
+	attr.link_create.prog_fd	= xsk->prog;
+	attr.link_create.target_ifindex	= xsk->intn->ifindex;
+	attr.link_create.attach_type	= BPF_XDP;
+	attr.link_create.flags		= XDP_FLAGS_DRV_MODE;
+
+	xsk->link = filter_bpf(BPF_LINK_CREATE, &attr);
+	if (xsk->link >= 0)
+	{
+		dolog(LOG_DEBUG, "AF_XDP on %s in driver mode\n", xsk->intn->info.name);
+		return true;
+	}
+
+	attr.link_create.flags		= XDP_FLAGS_SKB_MODE;
+
+	xsk->link = filter_bpf(BPF_LINK_CREATE, &attr);
+	if (xsk->link >= 0)
+	{
+		dolog(LOG_DEBUG, "AF_XDP on %s in generic mode\n", xsk->intn->info.name);
+		return true;
+	}
+
+	dolog(LOG_WARNING, "Couldn't attach the XDP program: %s (%d)\n", strerror(errno), errno);
+	return false;
+}
+
+/* Create the socket, map it's rings and bind it to the first queue */
+static bool afxdp_sock_open(struct afxdp_sock *xsk);
+static bool afxdp_sock_open(struct afxdp_sock *xsk)
+{
+	struct xdp_mmap_offsets	off;
+	struct sockaddr_xdp	sxdp;
+	struct epoll_event	ev;
+	socklen_t		optlen = sizeof(off);
+	int			size = AFXDP_RING;
+
+	xsk->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (xsk->fd == -1)
+	{
+		dolog(LOG_WARNING, "Couldn't create an AF_XDP socket: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	if (	setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) != 0 ||
+		setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) != 0 ||
+		setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) != 0 ||
+		setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) != 0 ||
+		getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't setup the AF_XDP rings: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	if (	!afxdp_ring_map(xsk->fd, &xsk->rx, &off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) ||
+		!afxdp_ring_map(xsk->fd, &xsk->tx, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc)) ||
+		!afxdp_ring_map(xsk->fd, &xsk->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+		!afxdp_ring_map(xsk->fd, &xsk->comp, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)))
+	{
+		return false;
+	}
+
+	memzero(&sxdp, sizeof(sxdp));
+	sxdp.sxdp_family		= AF_XDP;
+	sxdp.sxdp_flags			= XDP_SHARED_UMEM;
+	sxdp.sxdp_ifindex		= xsk->intn->ifindex;
+	sxdp.sxdp_queue_id		= 0;
+	sxdp.sxdp_shared_umem_fd	= afxdp_umemfd;
+
+	if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't bind an AF_XDP socket: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	/* Something to receive in before the program redirects to us */
+	afxdp_fill(xsk);
+
+	memzero(&ev, sizeof(ev));
+	ev.events	= EPOLLIN;
+	ev.data.fd	= xsk->fd;
+
+	if (epoll_ctl(g_conf->epoll, EPOLL_CTL_ADD, xsk->fd, &ev) == -1)
+	{
+		dolog(LOG_WARNING, "Couldn't add the AF_XDP socket to epoll: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/* Close everything of a socket and take back it's frames */
+static void afxdp_sock_free(struct afxdp_sock *xsk);
+static void afxdp_sock_free(struct afxdp_sock *xsk)
+{
+	struct xdp_desc		*descs = (struct xdp_desc *)xsk->tx.descs;
+	struct afxdp_sock	**p;
+	uint64_t		i;
+	uint32_t		head;
+
+	/* Closing the link detaches the program */
+	if (xsk->link >= 0) close(xsk->link);
+	if (xsk->prog >= 0) close(xsk->prog);
+	if (xsk->map >= 0) close(xsk->map);
+	if (xsk->fd >= 0) close(xsk->fd);
+
+	/* Nothing is sent anymore, what was not completed is still on the ring */
+	for (head = xsk->tx.head - xsk->sending; head != xsk->tx.head; head++)
+	{
+		afxdp_frame_put(descs[head & (AFXDP_RING - 1)].addr);
+	}
+	afxdp_txcount -= xsk->sending;
+	xsk->sending = 0;
+
+	afxdp_ring_unmap(&xsk->rx);
+	afxdp_ring_unmap(&xsk->tx);
+	afxdp_ring_unmap(&xsk->fill);
+	afxdp_ring_unmap(&xsk->comp);
+
+	/* The frames on the fill and receive rings, others might still send from them */
+	for (i = 0; i < AFXDP_FRAMES; i++)
+	{
+		if (afxdp_owner[i] != xsk) continue;
+
+		afxdp_owner[i] = NULL;
+		afxdp_frame_put(i * AFXDP_FRAMESIZE);
+	}
+
+	if (xsk->fd >= 0 && (unsigned int)xsk->fd < afxdp_fdcount && afxdp_fds[xsk->fd] == xsk)
+	{
+		afxdp_fds[xsk->fd] = NULL;
+	}
+
+	if (afxdp_held == xsk) afxdp_held = NULL;
+
+	for (p = &afxdp_pending; *p; p = &(*p)->nextpending)
+	{
+		if (*p != xsk) continue;
+
+		*p = xsk->nextpending;
+		break;
+	}
+
+	free(xsk);
+}
+
+/* Make a socket findable by it's fd */
+static bool afxdp_fd_add(struct afxdp_sock *xsk);
+static bool afxdp_fd_add(struct afxdp_sock *xsk)
+{
+	struct afxdp_sock	**fds;
+	unsigned int		count, i;
+
+	if ((unsigned int)xsk->fd >= afxdp_fdcount)
+	{
+		count = xsk->fd + 16;
+
+		fds = realloc(afxdp_fds, count * sizeof(*fds));
+		if (!fds)
+		{
+			dolog(LOG_ERR, "Couldn't allocate the AF_XDP socket index\n");
+			return false;
+		}
+
+		for (i = afxdp_fdcount; i < count; i++) fds[i] = NULL;
+
+		afxdp_fds	= fds;
+		afxdp_fdcount	= count;
+	}
+
+	afxdp_fds[xsk->fd] = xsk;
+	return true;
+}
+
+/* Receive and send on an Ethernet interface through an AF_XDP socket */
+static void afxdp_int_add(struct intnode *intn);
+static void afxdp_int_add(struct intnode *intn)
+{
+	struct afxdp_sock *xsk;
+
+	if (afxdp_umemfd == -1 || intn->info.hwaddr.sa_family != ARPHRD_ETHER) return;
+
+	if (afxdp_socks >= AFXDP_SOCKS)
+	{
+		dolog(LOG_WARNING, "Using the PACKET socket for %s, AF_XDP is used on %u interfaces already\n", intn->info.name, AFXDP_SOCKS);
+		return;
+	}
+
+	xsk = calloc(1, sizeof(*xsk));
+	if (!xsk)
+	{
+		dolog(LOG_ERR, "Couldn't allocate an AF_XDP socket for %s\n", intn->info.name);
+		return;
+	}
+
+	xsk->fd		= -1;
+	xsk->map	= -1;
+	xsk->prog	= -1;
+	xsk->link	= -1;
+	xsk->intn	= intn;
+
+	if (	!afxdp_sock_open(xsk) ||
+		!afxdp_fd_add(xsk) ||
+		!afxdp_prog_load(xsk) ||
+		!afxdp_prog_attach(xsk))
+	{
+		dolog(LOG_WARNING, "Using the PACKET socket for %s\n", intn->info.name);
+		afxdp_sock_free(xsk);
+		return;
+	}
+
+	intn->xsk = xsk;
+	afxdp_socks++;
+}
+
+static void afxdp_int_del(struct intnode *intn);
+static void afxdp_int_del(struct intnode *intn)
+{
+	if (!intn->xsk) return;
+
+	afxdp_sock_free(intn->xsk);
+	intn->xsk = NULL;
+	afxdp_socks--;
+}
+
+/* The socket of an interface by it's fd, NULL when there is none */
+static struct afxdp_sock *afxdp_find(int fd);
+static struct afxdp_sock *afxdp_find(int fd)
+{
+	if (fd < 0 || (unsigned int)fd >= afxdp_fdcount) return NULL;
+
+	return afxdp_fds[fd];
+}
+
+/*
+ * The frames received, at most max, they stay ours till
+ * afxdp_release() hands them back. The program only
+ * redirects what has room for the headers.
+ */
+static unsigned int afxdp_receive(struct afxdp_sock *xsk, struct iopacket *pkts, unsigned int max);
+static unsigned int afxdp_receive(struct afxdp_sock *xsk, struct iopacket *pkts, unsigned int max)
+{
+	struct xdp_desc		*descs = (struct xdp_desc *)xsk->rx.descs, *desc;
+	struct ether_header	*eth;
+	uint32_t		avail = *xsk->rx.producer - xsk->rx.head;
+	unsigned int		i;
+
+	__sync_synchronize();
+
+	if (avail > max) avail = max;
+
+	for (i = 0; i < avail; i++)
+	{
+		desc = &descs[(xsk->rx.head + i) & (AFXDP_RING - 1)];
+		eth = (struct ether_header *)(afxdp_umem + desc->addr);
+
+		afxdp_state[desc->addr / AFXDP_FRAMESIZE] = AFXDP_FRAME_RECEIVED;
+
+		pkts[i].intn		= xsk->intn;
+		pkts[i].packet		= eth + 1;
+		pkts[i].len		= desc->len - sizeof(*eth);
+		pkts[i].ifindex		= xsk->intn->ifindex;
+		pkts[i].ether_type	= ntohs(eth->ether_type);
+	}
+
+	return avail;
+}
+
+/*
+ * Done with the first count frames afxdp_receive() returned
+ * Those that are still being sent come back on completion.
+ */
+static void afxdp_release(struct afxdp_sock *xsk, unsigned int count);
+static void afxdp_release(struct afxdp_sock *xsk, unsigned int count)
+{
+	struct xdp_desc	*descs = (struct xdp_desc *)xsk->rx.descs;
+	uint64_t	addr;
+	unsigned int	i;
+
+	for (i = 0; i < count; i++)
+	{
+		addr = descs[xsk->rx.head++ & (AFXDP_RING - 1)].addr;
+
+		afxdp_owner[addr / AFXDP_FRAMESIZE] = NULL;
+		afxdp_state[addr / AFXDP_FRAMESIZE] = AFXDP_FRAME_OTHER;
+		afxdp_frame_put(addr);
+	}
+	xsk->filled -= count;
+
+	__sync_synchronize();
+	*xsk->rx.consumer = xsk->rx.head;
+
+	afxdp_fill(xsk);
+}
+
+/* Let the kernel send what is on the transmit ring, copy mode does a batch per call */
+static void afxdp_kick(struct afxdp_sock *xsk);
+static void afxdp_kick(struct afxdp_sock *xsk)
+{
+	unsigned int i;
+
+	__sync_synchronize();
+	*xsk->tx.producer = xsk->tx.head;
+
+	for (i = 0; i < AFXDP_RING && *xsk->tx.consumer != xsk->tx.head; i++)
+	{
+		if (	sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+			errno != EAGAIN && errno != EBUSY && errno != EINTR)
+		{
+			break;
+		}
+
+		/* A full completion ring stops the kernel too */
+		afxdp_complete(xsk);
+	}
+
+	afxdp_complete(xsk);
+}
+
+/*
+ * Whether count more descriptors fit on the transmit ring, and
+ * in what is left for sending. Sends and completes what it can
+ * to make room, the descriptors stay on the ring till completed.
+ */
+static bool afxdp_room(struct afxdp_sock *xsk, unsigned int count);
+static bool afxdp_room(struct afxdp_sock *xsk, unsigned int count)
+{
+	struct intnode	*intn;
+	uint64_t	i;
+
+	if (xsk->sending + count > AFXDP_RING) afxdp_kick(xsk);
+
+	/* Used all for sending? Then see what all the others have sent */
+	if (afxdp_txcount + count > AFXDP_TXFRAMES)
+	{
+		INT_LOOP(intn, i)
+		{
+			if (intn->xsk) afxdp_complete(intn->xsk);
+		}
+	}
+
+	return (xsk->sending + count <= AFXDP_RING && afxdp_txcount + count <= AFXDP_TXFRAMES);
+}
+
+/* Put a descriptor on the transmit ring, it keeps the frame it points in */
+static void afxdp_desc(struct afxdp_sock *xsk, uint64_t addr, uint32_t len, uint32_t options);
+static void afxdp_desc(struct afxdp_sock *xsk, uint64_t addr, uint32_t len, uint32_t options)
+{
+	struct xdp_desc *desc = &((struct xdp_desc *)xsk->tx.descs)[xsk->tx.head++ & (AFXDP_RING - 1)];
+
+	desc->addr	= addr;
+	desc->len	= len;
+	desc->options	= options;
+
+	xsk->sending++;
+	afxdp_txcount++;
+}
+
+/* Per RFC2464 the destination MAC address is derived from the group */
+static void afxdp_ether(struct afxdp_sock *xsk, struct ether_header *eth, const struct ip6_hdr *iph);
+static void afxdp_ether(struct afxdp_sock *xsk, struct ether_header *eth, const struct ip6_hdr *iph)
+{
+	eth->ether_dhost[0] = 0x33;
+	eth->ether_dhost[1] = 0x33;
+	memcpy(&eth->ether_dhost[2], &iph->ip6_dst.s6_addr[12], 4);
+	memcpy(eth->ether_shost, xsk->intn->info.hwaddr.sa_data, sizeof(eth->ether_shost));
+	eth->ether_type = htons(ETH_P_IPV6);
+}
+
+/*
+ * Put a packet on the transmit ring, with the Ethernet header of
+ * the interface, it is sent with the next afxdp_flush(). A packet
+ * received on a socket is sent from it's frame: the first replica
+ * with the received header rewritten, the next ones as a frame with
+ * just their header followed by the packet in the received frame.
+ * Without multi-buffer, or when it was not received on a socket,
+ * the packet is copied into a frame behind the header instead.
+ * Returns false with errno set when it didn't fit.
+ */
+static bool afxdp_send(struct afxdp_sock *xsk, const struct ip6_hdr *iph, const uint16_t len);
+static bool afxdp_send(struct afxdp_sock *xsk, const struct ip6_hdr *iph, const uint16_t len)
+{
+	struct ether_header	*eth;
+	const uint8_t		*p = (const uint8_t *)iph;
+	uint64_t		addr = 0, hdr, frame = AFXDP_FRAMES;
+	uint8_t			state = AFXDP_FRAME_OTHER;
+
+	if (len > xsk->intn->mtu || len + sizeof(*eth) > AFXDP_FRAMESIZE)
+	{
+		errno = EMSGSIZE;
+		return false;
+	}
+
+	if (p >= afxdp_umem && p < afxdp_umem + (AFXDP_FRAMES * AFXDP_FRAMESIZE))
+	{
+		addr	= p - afxdp_umem;
+		frame	= addr / AFXDP_FRAMESIZE;
+		state	= afxdp_state[frame];
+	}
+
+	if (state == AFXDP_FRAME_REWRITTEN && !afxdp_sg) state = AFXDP_FRAME_OTHER;
+
+	if (!afxdp_room(xsk, state == AFXDP_FRAME_REWRITTEN ? 2 : 1))
+	{
+		errno = ENOBUFS;
+		return false;
+	}
+
+	if (state == AFXDP_FRAME_RECEIVED)
+	{
+		/* The received header is in front of the packet, and ours now */
+		eth = (struct ether_header *)(afxdp_umem + addr) - 1;
+		afxdp_ether(xsk, eth, iph);
+
+		afxdp_state[frame] = AFXDP_FRAME_REWRITTEN;
+		afxdp_refs[frame]++;
+		afxdp_desc(xsk, addr - sizeof(*eth), len + sizeof(*eth), 0);
+	}
+	else
+	{
+		if (!afxdp_frame_get(NULL, &hdr))
+		{
+			errno = ENOBUFS;
+			return false;
+		}
+
+		eth = (struct ether_header *)(afxdp_umem + hdr);
+		afxdp_ether(xsk, eth, iph);
+
+		if (state == AFXDP_FRAME_REWRITTEN)
+		{
+			/* Both are one packet, the kernel puts them together */
+			afxdp_refs[frame]++;
+			afxdp_desc(xsk, hdr, sizeof(*eth), XDP_PKT_CONTD);
+			afxdp_desc(xsk, addr, len, 0);
+		}
+		else
+		{
+			memcpy(eth + 1, iph, len);
+			afxdp_desc(xsk, hdr, len + sizeof(*eth), 0);
+		}
+	}
+
+	if (!xsk->pending)
+	{
+		xsk->pending		= true;
+		xsk->nextpending	= afxdp_pending;
+		afxdp_pending		= xsk;
+	}
+
+	return true;
+}
+
+/* Send what afxdp_send() queued */
+static void afxdp_flush(void);
+static void afxdp_flush(void)
+{
+	struct afxdp_sock *xsk;
+
+	while (afxdp_pending)
+	{
+		xsk = afxdp_pending;
+		afxdp_pending = xsk->nextpending;
+
+		xsk->pending = false;
+		xsk->nextpending = NULL;
+
+		afxdp_kick(xsk);
+	}
+}
+
+static bool io_afxdp_open(void);
+static bool io_afxdp_open(void)
+{
+	if (!afxdp_init()) return false;
+
+	/* For what the program passes on and the other interfaces */
+	if (!packet_open(&g_conf->control))
+	{
+		packet_close(&g_conf->control);
+		afxdp_cleanup();
+		return false;
+	}
+
+	return true;
+}
+
+static void io_afxdp_close(void);
+static void io_afxdp_close(void)
+{
+	afxdp_cleanup();
+	packet_close(&g_conf->control);
+}
+
+/* A socket of an interface or the PACKET socket */
+static int io_afxdp_receive(int fd, struct iopacket *pkts, unsigned int max);
+static int io_afxdp_receive(int fd, struct iopacket *pkts, unsigned int max)
+{
+	struct afxdp_sock *xsk = afxdp_find(fd);
+
+	if (!xsk)
+	{
+		return io_packet.receive(fd, pkts, max);
+	}
+
+	afxdp_held	= xsk;
+	afxdp_heldcount	= afxdp_receive(xsk, pkts, max);
+
+	return afxdp_heldcount;
+}
+
+/* The frames go back to the fill ring */
+static void io_afxdp_release(void);
+static void io_afxdp_release(void)
+{
+	if (afxdp_held)
+	{
+		afxdp_release(afxdp_held, afxdp_heldcount);
+		afxdp_held = NULL;
+	}
+
+	io_packet.release();
+}
+
+/* Interfaces with a socket get a copy on it's transmit ring, the others go out with sendmmsg() */
+static void io_afxdp_transmit(struct iotx *tx, unsigned int count);
+static void io_afxdp_transmit(struct iotx *tx, unsigned int count)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < count; i = j)
+	{
+		if (tx[i].intn->xsk)
+		{
+			tx[i].result = afxdp_send(tx[i].intn->xsk, tx[i].iph, tx[i].len) ? tx[i].len : -errno;
+			j = i + 1;
+			continue;
+		}
+
+		j = i + 1;
+		while (j < count && !tx[j].intn->xsk) j++;
+
+		io_packet.transmit(&tx[i], j - i);
+	}
+
+	afxdp_flush();
+}
+
+static void io_afxdp_stats(FILE *out);
+static void io_afxdp_stats(FILE *out)
+{
+	fprintf(out, "AF_XDP sockets       : %u of at most %u, %s\n", afxdp_socks, AFXDP_SOCKS, afxdp_sg ? "multi-buffer" : "no multi-buffer");
+	fprintf(out, "AF_XDP free frames   : %" PRIu64 " of %u, %" PRIu64 " descriptors sending\n", afxdp_freecount, AFXDP_FRAMES, afxdp_txcount);
+	io_packet.stats(out);
+}
+
+const struct iobackend io_afxdp =
+{
+	"xdp",
+	false,			/* workers, the sockets are not shared */
+	io_afxdp_open,
+	io_afxdp_close,
+	afxdp_int_add,
+	afxdp_int_del,
+	NULL,			/* wait, the sockets are in the epoll set */
+	NULL,			/* ready */
+	io_afxdp_receive,
+	io_afxdp_release,
+	io_afxdp_transmit,
+	io_afxdp_stats
+};
+
+#endif /* !ECMH_BPF */
@@ -0,0 +1,88 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Receiving and sending through AF_XDP sockets (Linux)
+ *
+ * With --io xdp every Ethernet interface gets an AF_XDP socket on it's
+ * first queue and a small XDP program that redirects the multicast we
+ * forward to it, MLD and everything else goes on to the stack and
+ * thus the PACKET socket. The groups forwarded are those in the map
+ * of the group filter, or all routable multicast with --nogroupfilter.
+ * Unlike with the PACKET socket, which gets a copy, what is redirected
+ * does not reach the stack, listeners on the router itself thus don't
+ * receive the groups that arrive on an interface with a socket.
+ * All sockets share one UMEM, which is registered by a socket on the
+ * loopback, thus a frame received on one interface is sent from on
+ * the others: the first replica gets the received Ethernet header
+ * rewritten, the others a frame with just their header followed by
+ * the received packet (multi-buffer, Linux 6.6), or when the kernel
+ * lacks that a copy of the packet behind their header. The sockets
+ * are in copy mode, the kernel copies what is sent into an skb, thus
+ * one copy per replica, and a system call per interface on every
+ * flush, not one per packet. A frame goes back to the fill ring once
+ * it was released and all replicas sent from it are completed.
+ * Every socket keeps AFXDP_FILL frames for receiving, AFXDP_TXFRAMES
+ * transmit descriptors can hold on to a frame, which limits the
+ * sockets to AFXDP_SOCKS.
+ * The program is attached in driver mode when the driver can, in
+ * generic (SKB) mode otherwise. When AF_XDP is not available at all,
+ * or for an interface, the PACKET socket is used, which also sees
+ * what arrives on the other queues.
+ */
+
+#ifndef __AFXDP_H
+#define __AFXDP_H
+
+#ifndef ECMH_BPF
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+
+/* Frames in the UMEM and their size */
+#define AFXDP_FRAMES		8192
+#define AFXDP_FRAMESIZE		2048
+
+/* Descriptors in every ring (power of 2) */
+#define AFXDP_RING		512
+
+/* Frames every socket keeps on it's fill ring */
+#define AFXDP_FILL		256
+
+/* Frames only sending can use, the fill rings can't take them */
+#define AFXDP_TXFRAMES		2048
+
+/* Interfaces that get a socket, the others use the PACKET socket */
+#define AFXDP_SOCKS		((AFXDP_FRAMES - AFXDP_TXFRAMES) / AFXDP_FILL)
+
+/* One of the rings of a socket, as mapped from the kernel */
+struct afxdp_ring
+{
+	volatile uint32_t	*producer;
+	volatile uint32_t	*consumer;
+	void			*descs;		/* struct xdp_desc (rx, tx) or uint64_t (fill, completion) */
+	void			*map;		/* The mmap()'d ring */
+	uint64_t		maplen;
+	uint32_t		head;		/* Our producer (fill, tx) or consumer (rx, completion) */
+	uint32_t		__padding;
+};
+
+/* The AF_XDP socket of an interface */
+struct afxdp_sock
+{
+	int			fd;		/* The socket */
+	int			map;		/* XSKMAP the program redirects with */
+	int			prog;		/* The XDP program */
+	int			link;		/* The program attached to the interface */
+	struct intnode		*intn;		/* The interface it is bound to */
+	struct afxdp_sock	*nextpending;	/* Sockets with queued frames, see afxdp_flush() */
+	bool			pending;	/* On the pending list? */
+	uint64_t		filled;		/* Frames on the fill ring */
+	uint64_t		sending;	/* Descriptors on the transmit ring not completed yet */
+	struct afxdp_ring	rx, tx, fill, comp;
+};
+
+#endif
+
+#endif /* __AFXDP_H */
@@ -83,3 +83,50 @@ uint64_t gettimes(void)
 #endif
 }
 
+/* Seconds that never jump with the wall clock, for the timers and ages */
+uint64_t getmonotimes(void)
+{
+#ifdef __MACH__
+	/* SYSTEM_CLOCK counts from boot */
+	clock_serv_t	cclock;
+	mach_timespec_t	mts;
+
+	host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+	clock_get_time(cclock, &mts);
+	mach_port_deallocate(mach_task_self(), cclock);
+
+	return (mts.tv_sec);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec);
+#endif
+}
+
+/* Ones complement sum of 16 bit words, for the IPv4 and IPv6 checksums */
+uint16_t inchksum(const void *data, uint32_t length)
+{
+	register long		sum = 0;
+	register const uint16_t *wrd = (const uint16_t *)data;
+	register long		slen = (long)length;
+
+	while (slen >= 2)
+	{
+		sum += *wrd++;
+		slen -= 2;
+	}
+
+	if (slen > 0)
+	{
+		sum += *(const uint8_t *)wrd;
+	}
+
+	while (sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return (uint16_t)sum;
+}
@@ -11,3 +11,5 @@ int huprunning(void);
 void savepid(void);
 void cleanpid(int i);
 uint64_t gettimes(void);
+uint64_t getmonotimes(void);
+uint16_t inchksum(const void *data, uint32_t length);
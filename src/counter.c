@@ -0,0 +1,150 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+/* The counters of the running thread */
+__thread struct counterctx *g_counters;
+
+static struct counterctx	*counter_ctx;		/* All the contexts */
+static uint64_t			counter_contexts;	/* Number of contexts */
+static uint64_t			counter_pages;		/* Pages every context has */
+static uint64_t			counter_blocks;		/* Blocks handed out so far */
+static uint64_t			counter_freelist;	/* Free block + 1, 0 when empty */
+
+/* A block of a context */
+#define COUNTER_BLOCK(ctx, block) \
+  (&(ctx)->pages[(block) >> COUNTER_PAGE_BITS][((block) & (COUNTER_PAGE_BLOCKS - 1)) << COUNTER_SLOTS_BITS])
+
+BUILD_CHECK(counter_block, COUNTER_SLOTS * sizeof(uint64_t) == ECMH_CACHELINE);
+
+/* Setup the counters, the calling thread is the first context */
+void counters_init(uint64_t contexts)
+{
+	counter_ctx = (struct counterctx *)calloc(contexts, sizeof(*counter_ctx));
+	if (!counter_ctx)
+	{
+		dolog(LOG_ERR, "Couldn't init() - no memory for the counters\n");
+		exit(-1);
+	}
+
+	counter_contexts	= contexts;
+	counter_pages		= 0;
+	counter_blocks		= 0;
+	counter_freelist	= 0;
+
+	counters_context(0);
+}
+
+void counters_cleanup(void)
+{
+	uint64_t i, p;
+
+	for (i = 0; i < counter_contexts; i++)
+	{
+		for (p = 0; p < counter_pages; p++)
+		{
+			free(counter_ctx[i].pages[p]);
+		}
+		free(counter_ctx[i].pages);
+	}
+
+	free(counter_ctx);
+	counter_ctx		= NULL;
+	counter_contexts	= 0;
+	counter_pages		= 0;
+	g_counters		= NULL;
+}
+
+/* Select the counters the running thread adds to */
+void counters_context(uint64_t context)
+{
+	g_counters = &counter_ctx[context];
+}
+
+/* Give every context another page */
+static bool counter_grow(void);
+static bool counter_grow(void)
+{
+	uint64_t	**pages, i;
+	void		*page;
+
+	for (i = 0; i < counter_contexts; i++)
+	{
+		pages = (uint64_t **)realloc(counter_ctx[i].pages, sizeof(*pages) * (counter_pages + 1));
+		if (!pages) break;
+		counter_ctx[i].pages = pages;
+
+		if (posix_memalign(&page, ECMH_CACHELINE, sizeof(uint64_t) * COUNTER_SLOTS * COUNTER_PAGE_BLOCKS) != 0) break;
+		pages[counter_pages] = (uint64_t *)page;
+	}
+
+	/* Only keep the page when every context got one */
+	if (i < counter_contexts)
+	{
+		dolog(LOG_ERR, "Couldn't allocate a page of counters\n");
+
+		while (i > 0)
+		{
+			i--;
+			free(counter_ctx[i].pages[counter_pages]);
+		}
+		return false;
+	}
+
+	counter_pages++;
+	return true;
+}
+
+/* Get a block of counters, all zero */
+bool counter_alloc(uint64_t *block)
+{
+	uint64_t i;
+
+	if (counter_freelist)
+	{
+		*block = counter_freelist - 1;
+
+		/* The next free one is kept in the first counter of the first context */
+		counter_freelist = COUNTER_BLOCK(&counter_ctx[0], *block)[0];
+	}
+	else
+	{
+		if (	counter_blocks == (counter_pages << COUNTER_PAGE_BITS) &&
+			!counter_grow())
+		{
+			return false;
+		}
+
+		*block = counter_blocks++;
+	}
+
+	for (i = 0; i < counter_contexts; i++)
+	{
+		memzero(COUNTER_BLOCK(&counter_ctx[i], *block), sizeof(uint64_t) * COUNTER_SLOTS);
+	}
+
+	return true;
+}
+
+void counter_free(uint64_t block)
+{
+	COUNTER_BLOCK(&counter_ctx[0], block)[0] = counter_freelist;
+	counter_freelist = block + 1;
+}
+
+/* The value of a counter, summed over all the contexts */
+uint64_t counter_get(uint64_t block, uint64_t slot)
+{
+	uint64_t i, total = 0;
+
+	for (i = 0; i < counter_contexts; i++)
+	{
+		total += COUNTER_BLOCK(&counter_ctx[i], block)[slot];
+	}
+
+	return total;
+}
+
@@ -0,0 +1,52 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Statistics counters
+ *
+ * Every context (the control and each worker) has it's own copy of
+ * all the counters, thus the forwarding threads never write to the
+ * same cache line. The counters come in blocks of one cache line,
+ * one for the global statistics and one per interface and group.
+ * A block is identified by it's index, the value of a counter is
+ * only summed up over the contexts when somebody asks for it.
+ *
+ * Blocks are allocated and freed by the control context while it
+ * holds the table lock, the workers only add to them under it.
+ */
+
+#ifndef __COUNTER_H
+#define __COUNTER_H
+
+#define COUNTER_SLOTS_BITS	3
+#define COUNTER_SLOTS		(1 << COUNTER_SLOTS_BITS)	/* Counters in a block */
+#define COUNTER_PAGE_BITS	6
+#define COUNTER_PAGE_BLOCKS	(1 << COUNTER_PAGE_BITS)	/* Blocks in a page */
+
+/* The counters of one context */
+struct counterctx
+{
+	uint64_t		**pages;	/* Pages of COUNTER_PAGE_BLOCKS blocks */
+};
+
+/* The counters of the running thread */
+extern __thread struct counterctx *g_counters;
+
+/* Prototypes. */
+void counters_init(uint64_t contexts);
+void counters_cleanup(void);
+void counters_context(uint64_t context);
+
+bool counter_alloc(uint64_t *block);
+void counter_free(uint64_t block);
+uint64_t counter_get(uint64_t block, uint64_t slot);
+
+/* Add to a counter of the running thread */
+#define COUNTER_ADD(block, slot, n) \
+  (g_counters->pages[(block) >> COUNTER_PAGE_BITS] \
+    [(((block) & (COUNTER_PAGE_BLOCKS - 1)) << COUNTER_SLOTS_BITS) + (slot)] += (n))
+
+#endif /* __COUNTER_H */
+
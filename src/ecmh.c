@@ -27,7 +27,14 @@
 
 /* Configuration Variables */
 struct conf	*g_conf;
-volatile int	g_needs_timeout = false;
+
+#ifndef ECMH_BPF
+/* The receive context of the running thread, control or a worker */
+__thread struct worker *g_worker;
+#endif
+
+/* The flow cache of the running thread, see l4_ipv6_multicast() */
+static __thread struct flowentry *g_flows;
 
 /*
  * 6to4 relay address 192.88.99.1
@@ -41,32 +48,6 @@ static void l2_ethtype(struct intnode *intn, const void *packet, const unsigned
 /**************************************
   Functions
 **************************************/
-static uint16_t inchksum(const void *data, uint32_t length);
-static uint16_t inchksum(const void *data, uint32_t length)
-{
-	register long		sum = 0;
-	register const uint16_t *wrd = (const uint16_t *)data;
-	register long		slen = (long)length;
-
-	while (slen >= 2)
-	{
-		sum += *wrd++;
-		slen -= 2;
-	}
-
-	if (slen > 0)
-	{
-		sum += *(const uint8_t *)wrd;
-	}
-
-	while (sum >> 16)
-	{
-		sum = (sum & 0xffff) + (sum >> 16);
-	}
-
-	return (uint16_t)sum;
-}
-
 static uint16_t ipv6_checksum(const struct ip6_hdr *ip6, uint8_t protocol, const void *data, const uint16_t length);
 static uint16_t ipv6_checksum(const struct ip6_hdr *ip6, uint8_t protocol, const void *data, const uint16_t length)
 {
@@ -258,8 +239,8 @@ static void update_interfaces(struct intnode *intn)
 	uint64_t		t;
 
 	/* Only update every 5 minutes to avoid rerunning it every packet */
-	t = gettimes();
-	if ((last_update + (5*60)) > t)
+	t = getmonotimes();
+	if (last_update != 0 && (last_update + (5*60)) > t)
 	{
 		return;
 	}
@@ -449,7 +430,7 @@ static void update_interfaces(struct intnode *intn)
 				IN6_IS_ADDR_LINKLOCAL(&addr))
 			{
 				/* Update the linklocal address */
-				memcpy(&intn->linklocal, &addr, sizeof(intn->linklocal));
+				memcpy(&intn->info.linklocal, &addr, sizeof(intn->info.linklocal));
 				gotlinkl = true;
 			}
 			else
@@ -471,9 +452,9 @@ static void update_interfaces(struct intnode *intn)
 
 					/* Update the Local IPv4 address */
 #ifdef DEBUG
-					dolog(LOG_DEBUG, "Updating local IPv4 address for %s: %s\n", intn->name, txt);
+					dolog(LOG_DEBUG, "Updating local IPv4 address for %s: %s\n", intn->info.name, txt);
 #else
-					dolog(LOG_DEBUG, "Updating local IPv4 address for %s\n", intn->name);
+					dolog(LOG_DEBUG, "Updating local IPv4 address for %s\n", intn->info.name);
 #endif
 					for (num = 0; num < INTNODE_MAXIPV4; num++)
 					{
@@ -502,7 +483,7 @@ static void update_interfaces(struct intnode *intn)
 						local_update(intn);
 					}
 #else
-					dolog(LOG_DEBUG, "Ignoring local IPv4 address for %s\n", intn->name);
+					dolog(LOG_DEBUG, "Ignoring local IPv4 address for %s\n", intn->info.name);
 #endif /* ECMH_BPF*/
 				}
 				else if (ifa->ifa_addr->sa_family == AF_INET6)
@@ -514,8 +495,8 @@ static void update_interfaces(struct intnode *intn)
 					inet_ntop(AF_INET6, &addr, txt, sizeof(txt));
 
 					/* Update the global address */
-					dolog(LOG_DEBUG, "Updating global IPv6 address for %s: %s\n", intn->name, txt);
-					memcpy(&intn->global, &addr, sizeof(intn->global));
+					dolog(LOG_DEBUG, "Updating global IPv6 address for %s: %s\n", intn->info.name, txt);
+					memcpy(&intn->info.global, &addr, sizeof(intn->info.global));
 					gotglobal = true;
 #ifdef ECMH_GETIFADDR
 				}
@@ -541,21 +522,21 @@ static void update_interfaces(struct intnode *intn)
 				if (gotlinkl || gotglobal || gotipv4)
 				{
 					dolog(LOG_DEBUG, "Added %s, link %" PRIu64 ", hw %s/%u with an MTU of %" PRIu64 "\n",
-						intn->name, intn->ifindex,
+						intn->info.name, intn->ifindex,
 #ifndef ECMH_BPF
-						(intn->hwaddr.sa_family == ARPHRD_ETHER ? "Ethernet" : 
-						 (intn->hwaddr.sa_family == ARPHRD_SIT ? "sit" : "Unknown")),
-						intn->hwaddr.sa_family,
+						(intn->info.hwaddr.sa_family == ARPHRD_ETHER ? "Ethernet" : 
+						 (intn->info.hwaddr.sa_family == ARPHRD_SIT ? "sit" : "Unknown")),
+						intn->info.hwaddr.sa_family,
 #else
-						(intn->dlt == DLT_NULL ? "Null":
-						 (intn->dlt == DLT_EN10MB ? "Ethernet" : "Unknown")),
-						(unsigned int)intn->dlt,
+						(intn->info.dlt == DLT_NULL ? "Null":
+						 (intn->info.dlt == DLT_EN10MB ? "Ethernet" : "Unknown")),
+						(unsigned int)intn->info.dlt,
 #endif
 						intn->mtu);
 				}
 				else
 				{
-					dolog(LOG_DEBUG, "[%-5s] Didn't get a linklocal or global address, ignoring this address on interface %" PRIu64 "\n", intn->name, intn->ifindex);
+					dolog(LOG_DEBUG, "[%-5s] Didn't get a linklocal or global address, ignoring this address on interface %" PRIu64 "\n", intn->info.name, intn->ifindex);
 					int_destroy(intn);
 				}
 			}
@@ -565,159 +546,123 @@ static void update_interfaces(struct intnode *intn)
 		freeifaddrs(ifap);
 #endif
 	}
-	dolog(LOG_DEBUG, "Updating Interfaces - done, highest ifindex: %" PRIu64 "\n", g_conf->maxinterfaces);
+	dolog(LOG_DEBUG, "Updating Interfaces - done, %" PRIu64 " interfaces\n", g_conf->intcount);
 #ifndef ECMH_GETIFADDR
 	fclose(file);
 #else
 #endif
 }
 
-/* Send a packet */
-static void sendpacket6(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len);
-static void sendpacket6(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len)
+static void sendpacket6_result(struct intnode *intn, const uint16_t len, int sent);
+static void sendpacket6_result(struct intnode *intn, const uint16_t len, int sent)
 {
-	int			sent;
-#ifndef ECMH_BPF
-	struct sockaddr_ll	sa;
-
-	memzero(&sa, sizeof(sa));
-
-	sa.sll_family	= AF_PACKET;
-	sa.sll_protocol	= htons(ETH_P_IPV6);
-	sa.sll_ifindex	= intn->ifindex;
-	sa.sll_hatype	= intn->hwaddr.sa_family;
-	sa.sll_pkttype	= 0;
-	sa.sll_halen	= 6;
-
-	/*
-	 * Construct a Ethernet MAC address from the IPv6 destination multicast address.
-	 * Per RFC2464
-	 */
-	sa.sll_addr[0] = 0x33;
-	sa.sll_addr[1] = 0x33;
-	sa.sll_addr[2] = iph->ip6_dst.s6_addr[12];
-	sa.sll_addr[3] = iph->ip6_dst.s6_addr[13];
-	sa.sll_addr[4] = iph->ip6_dst.s6_addr[14];
-	sa.sll_addr[5] = iph->ip6_dst.s6_addr[15];
-
-	/* Send the packet */
-	errno = 0;
-	sent = sendto(g_conf->rawsocket, iph, len, 0, (struct sockaddr *)&sa, sizeof(sa));
-
-#else /* !ECMH_BPF */
-
-	register uint32_t	chksum = 0;
-	struct ether_header	hdr_eth;
-	struct ip		hdr_ip;
-	struct iovec		vector[3];
-
-	/* There is always ethernet to send out */
-	vector[0].iov_base	= &hdr_eth;
-	vector[0].iov_len 	= sizeof(hdr_eth);
-
-	/*
-	 * Construct a Ethernet MAC address from the IPv6 destination multicast address.
-	 * Per RFC2464
-	 */
-	memzero(&hdr_eth, sizeof(hdr_eth));
-	hdr_eth.ether_dhost[0] = 0x33;
-	hdr_eth.ether_dhost[1] = 0x33;
-	hdr_eth.ether_dhost[2] = iph->ip6_dst.s6_addr[12];
-	hdr_eth.ether_dhost[3] = iph->ip6_dst.s6_addr[13];
-	hdr_eth.ether_dhost[4] = iph->ip6_dst.s6_addr[14];
-	hdr_eth.ether_dhost[5] = iph->ip6_dst.s6_addr[15];
-
-	/*
-	 * Handle non-tunneledmode & native ethernet
-	 */
-	if (!g_conf->tunnelmode || !intn->master)
-	{
-		/* Send a Native IPv6 packet */
-		hdr_eth.ether_type	= htons(ETH_P_IPV6);
-		vector[1].iov_base	= (void *)iph;
-		vector[1].iov_len 	= len;
-
-		dolog(LOG_DEBUG, "Sending Native IPv6 packet over %s/%" PRIu64 "\n", intn->name, intn->ifindex);
-		sent = writev(intn->socket, vector, 2);
-	}
-
-	/*
-	 * When this interface is a tunnel, send it over it's parent socket
-	 * After having it encapsulated in proto-41
-	 */
-	else
-	{	
-		/* Construct the proto-41 packet */
-		memzero(&hdr_ip, sizeof(hdr_ip));
-		hdr_ip.ip_v 	= 4;
-		hdr_ip.ip_hl	= 5;
-		hdr_ip.ip_tos	= 0;
-		hdr_ip.ip_len	= htons(len + sizeof(hdr_ip));
-		hdr_ip.ip_id	= htons(42);
-		hdr_ip.ip_off	= 0;
-		hdr_ip.ip_ttl	= 100;
-		hdr_ip.ip_p	= IPPROTO_IPV6;
-		hdr_ip.ip_sum	= 0;
-
-		/* The first ipv4_local is the interface, the rest should be empty for PtP interfaces */
-		memcpy(&hdr_ip.ip_src, &intn->ipv4_local[0], sizeof(hdr_ip.ip_src));
-		memcpy(&hdr_ip.ip_dst, &intn->ipv4_remote, sizeof(hdr_ip.ip_dst));
-
-		/* Calculate the checksum */
-		chksum = inchksum(&hdr_ip, sizeof(hdr_ip));
-
-		/* Wrap in the carries to reduce chksum to 16 bits. */
-		chksum  = (chksum >> 16) + (chksum & 0xffff);
-		chksum += (chksum >> 16);
-
-		/* Take ones-complement and replace 0 with 0xFFFF. */
-		chksum = (uint16_t) ~chksum;
-		if (chksum == 0UL) chksum = 0xffffUL;
-
-		/* Fill in the Checksum */
-		hdr_ip.ip_sum = (uint16_t)chksum;
-
-		/* Send a IPv4 proto-41 packet over the master's socket */
-		hdr_eth.ether_type	= htons(ETH_P_IP);
-		vector[1].iov_base 	= &hdr_ip;
-		vector[1].iov_len 	= sizeof(hdr_ip);
-		vector[2].iov_base	= (void *)iph;
-		vector[2].iov_len 	= len;
-
-		dolog(LOG_DEBUG, "Sending proto-41 IPv6 packet for %s/%" PRIu64 " over %s/%" PRIu64 "\n",
-			intn->name, intn->ifindex, intn->master->name, intn->master->ifindex);
-		sent = writev(intn->master->socket, vector, 3);
-	}
-#endif /* !ECMH_BPF */
 	if (sent < 0)
 	{
 		/*
 		 * Remove the device if it doesn't exist anymore,
 		 * can happen with dynamic tunnels etc
 		 */
-		if (errno == ENXIO)
+		if (errno == ENXIO && IS_CONTROL())
 		{
-			dolog(LOG_DEBUG, "[%-5s] couldn't send %u bytes, received ENXIO, destroying interface %" PRIu64 "\n", intn->name, len, intn->ifindex);
+			dolog(LOG_DEBUG, "[%-5s] couldn't send %u bytes, received ENXIO, destroying interface %" PRIu64 "\n", intn->info.name, len, intn->ifindex);
 			/* Destroy the interface itself */
 			int_destroy(intn);
 		}
 		else
 		{
-			dolog(LOG_DEBUG, "[%-5s] sending %u bytes failed, mtu = %" PRIu64 ": %s (%d)\n", intn->name, len, intn->mtu, strerror(errno), errno);
+			dolog(LOG_DEBUG, "[%-5s] sending %u bytes failed, mtu = %" PRIu64 ": %s (%d)\n", intn->info.name, len, intn->mtu, strerror(errno), errno);
 		}
 
 		return;
 	}
 
 	/* Update the global statistics */
-	g_conf->stat_packets_sent++;
-	g_conf->stat_bytes_sent+=len;
+	COUNTER_ADD(g_conf->counters, CNT_PACKETS_SENT, 1);
+	COUNTER_ADD(g_conf->counters, CNT_BYTES_SENT, len);
 
 	/* Update interface statistics */
-	intn->stat_bytes_sent+=len;
-	intn->stat_packets_sent++;
+	COUNTER_ADD(intn->info.counters, INT_CNT_BYTES_SENT, len);
+	COUNTER_ADD(intn->info.counters, INT_CNT_PACKETS_SENT, 1);
+}
 
-	return;
+/* Account for a packet the backend sent, or failed to */
+static void sendpacket6_done(struct iotx *tx);
+static void sendpacket6_done(struct iotx *tx)
+{
+	/* Destroyed since it was queued, by an earlier failure */
+	if (tx->intn->mtu == 0) return;
+
+	errno = tx->result < 0 ? -tx->result : 0;
+	sendpacket6_result(tx->intn, tx->len, tx->result);
+}
+
+/* Send a packet */
+static void sendpacket6(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len);
+static void sendpacket6(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len)
+{
+	struct iotx	tx;
+
+	memzero(&tx, sizeof(tx));
+	tx.intn	= intn;
+	tx.iph	= iph;
+	tx.len	= len;
+
+	g_conf->io->transmit(&tx, 1);
+
+	sendpacket6_done(&tx);
+}
+
+#ifndef ECMH_BPF
+/*
+ * Hand the packets that are queued to the backend, in one go.
+ * A packet that fails is handled like a failing sendpacket6().
+ */
+static void sendpacket6_flush(void);
+static void sendpacket6_flush(void)
+{
+	struct txqueue	*txq = &g_worker->txq;
+	unsigned int	i;
+
+	if (txq->count == 0) return;
+
+	g_conf->io->transmit(txq->tx, txq->count);
+
+	for (i = 0; i < txq->count; i++)
+	{
+		sendpacket6_done(&txq->tx[i]);
+	}
+
+	txq->count = 0;
+}
+#endif /* !ECMH_BPF */
+
+/*
+ * Queue a packet for sending, it goes out with the next
+ * sendpacket6_flush(), the packet data has to stay
+ * untouched till then. The receive path flushes after
+ * every burst.
+ */
+static void sendpacket6_queue(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len);
+static void sendpacket6_queue(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len)
+{
+#ifndef ECMH_BPF
+	struct txqueue	*txq = &g_worker->txq;
+	struct iotx	*tx;
+
+	if (txq->count >= ECMH_TXBATCH)
+	{
+		sendpacket6_flush();
+	}
+
+	tx = &txq->tx[txq->count++];
+	tx->intn	= intn;
+	tx->iph		= iph;
+	tx->len		= len;
+	tx->result	= 0;
+#else
+	/* BPF devices are written one packet at a time */
+	sendpacket6(intn, iph, len);
+#endif /* !ECMH_BPF */
 }
 
 /*
@@ -751,7 +696,7 @@ static void icmp6_send(struct intnode *intn, const struct in6_addr *src, int typ
 	 * The source address must be a global unicast IPv6 address
 	 * and should be associated to the interface we are sending on
 	 */
-	memcpy(&packet.ip6.ip6_src, &intn->global, sizeof(packet.ip6.ip6_src));
+	memcpy(&packet.ip6.ip6_src, &intn->info.global, sizeof(packet.ip6.ip6_src));
 
 	/* Target == Sender */
 	memcpy(&packet.ip6.ip6_dst, src, sizeof(*src));
@@ -766,12 +711,12 @@ static void icmp6_send(struct intnode *intn, const struct in6_addr *src, int typ
 	/* Calculate and fill in the checksum */
 	packet.icmp6.icmp6_cksum	= ipv6_checksum(&packet.ip6, IPPROTO_ICMPV6, &packet.icmp6, sizeof(packet.icmp6) + dlen - sizeof(packet.icmp6.icmp6_data32));
 
-	dolog(LOG_DEBUG, "Sending ICMPv6 Type %s (%u) code %s (%u) on %s/%" PRIu64 "\n", icmpv6_type(type), type, icmpv6_code(type, code), code, intn->name, intn->ifindex);
+	dolog(LOG_DEBUG, "Sending ICMPv6 Type %s (%u) code %s (%u) on %s/%" PRIu64 "\n", icmpv6_type(type), type, icmpv6_code(type, code), code, intn->info.name, intn->ifindex);
 	sendpacket6(intn, (const struct ip6_hdr *)&packet, sizeof(packet) - (sizeof(packet.data) - dlen) - sizeof(packet.icmp6.icmp6_data32));
 
 	/* Increase ICMP sent statistics */
-	g_conf->stat_icmp_sent++;
-	intn->stat_icmp_sent++;
+	COUNTER_ADD(g_conf->counters, CNT_ICMP_SENT, 1);
+	COUNTER_ADD(intn->info.counters, INT_CNT_ICMP_SENT, 1);
 }
 
 /*
@@ -822,7 +767,7 @@ static void mld_send_query(struct intnode *intn, const struct in6_addr *mca, con
 	 * The source address must be the link-local address
 	 * of the interface we are sending on
 	 */
-	memcpy(&packet.ip6.ip6_src, &intn->linklocal, sizeof(packet.ip6.ip6_src));
+	memcpy(&packet.ip6.ip6_src, &intn->info.linklocal, sizeof(packet.ip6.ip6_src));
 
 	/* Generaly Query -> link-scope all-nodes (ff02::1) */
 	packet.ip6.ip6_dst.s6_addr[0]	= 0xff;
@@ -889,19 +834,19 @@ static void mld_send_query(struct intnode *intn, const struct in6_addr *mca, con
 	if (g_conf->mld1only)
 	{
 #endif
-		dolog(LOG_DEBUG, "Sending MLDv1 Query on %s/%" PRIu64 "\n", intn->name, intn->ifindex);
+		dolog(LOG_DEBUG, "Sending MLDv1 Query on %s/%" PRIu64 "\n", intn->info.name, intn->ifindex);
 #ifdef ECMH_SUPPORT_MLD2
 	}
 	else
 	{
-		dolog(LOG_DEBUG, "Sending MLDv2 Query on %s/%" PRIu64 " with %u sources\n", intn->name, intn->ifindex, ntohs(packet.mldq.nsrcs));
+		dolog(LOG_DEBUG, "Sending MLDv2 Query on %s/%" PRIu64 " with %u sources\n", intn->info.name, intn->ifindex, ntohs(packet.mldq.nsrcs));
 	}
 #endif
 	sendpacket6(intn, (const struct ip6_hdr *)&packet, packetlen);
 
 	/* Increase ICMP sent statistics */
-	g_conf->stat_icmp_sent++;
-	intn->stat_icmp_sent++;
+	COUNTER_ADD(g_conf->counters, CNT_ICMP_SENT, 1);
+	COUNTER_ADD(intn->info.counters, INT_CNT_ICMP_SENT, 1);
 }
 
 static void mld1_send_report(struct intnode *intn, const struct in6_addr *mca);
@@ -935,7 +880,7 @@ static void mld1_send_report(struct intnode *intn, const struct in6_addr *mca)
 	 * The source address must be the link-local address
 	 * of the interface we are sending on
 	 */
-	memcpy(&packet.ip6.ip6_src, &intn->linklocal, sizeof(packet.ip6.ip6_src));
+	memcpy(&packet.ip6.ip6_src, &intn->info.linklocal, sizeof(packet.ip6.ip6_src));
 
 	/* Report -> Multicast address */
 	memcpy(&packet.ip6.ip6_dst, mca, sizeof(*mca));
@@ -961,62 +906,99 @@ static void mld1_send_report(struct intnode *intn, const struct in6_addr *mca)
 	/* Calculate and fill in the checksum */
 	packet.mld1.csum		= ipv6_checksum(&packet.ip6, IPPROTO_ICMPV6, &packet.mld1, sizeof(packet.mld1));
 
-	dolog(LOG_DEBUG, "Sending MLDv1 Report on %s/%" PRIu64 "\n", intn->name, intn->ifindex);
+	dolog(LOG_DEBUG, "Sending MLDv1 Report on %s/%" PRIu64 "\n", intn->info.name, intn->ifindex);
 	sendpacket6(intn, (const struct ip6_hdr *)&packet, sizeof(packet));
 
 	/* Increase ICMP sent statistics */
-	g_conf->stat_icmp_sent++;
-	intn->stat_icmp_sent++;
+	COUNTER_ADD(g_conf->counters, CNT_ICMP_SENT, 1);
+	COUNTER_ADD(intn->info.counters, INT_CNT_ICMP_SENT, 1);
 }
 
 #ifdef ECMH_SUPPORT_MLD2
-static void mld2_send_report(struct intnode *intn, const struct in6_addr *mca);
-static void mld2_send_report(struct intnode *intn, const struct in6_addr *mca)
+/* The fixed part of a MLDv2 report, the grecs follow it */
+struct mld2_report_packet
 {
-	struct groupnode		*groupn;
-	struct grpintnode		*grpintn;
-	struct subscrnode		*subscrn;
-	struct listnode			*ln, *gn, *sn;
-	unsigned int			length, i;
-	struct mld_report_packet
+	struct ip6_hdr		ip6;
+	struct ip6_hbh		hbh;
+	struct
 	{
-		struct ip6_hdr		ip6;
-		struct ip6_hbh		hbh;
-		struct
-		{
-			uint8_t		type;
-			uint8_t		length;
-			uint16_t	value;
-			uint8_t		optpad[2];
-		}			routeralert;
-		struct mld2_report	mld2r;
-	}				*packet;
-	struct mld2_grec		*grec = NULL;
-	void				*src = NULL;
-	bool				any = false;
+		uint8_t		type;
+		uint8_t		length;
+		uint16_t	value;
+		uint8_t		optpad[2];
+	}			routeralert;
+	struct mld2_report	mld2r;
+};
+
+/* Send out the report that is being built, if it has anything in it */
+static void mld2_report_send(struct intnode *intn);
+static void mld2_report_send(struct intnode *intn)
+{
+	struct reportbuf		*rb = &g_conf->report;
+	struct mld2_report_packet	*packet = (struct mld2_report_packet *)rb->packet;
+	uint16_t			length;
+
+	if (rb->ngrec == 0) return;
+
+	length = rb->length - sizeof(packet->ip6);
+
+	/* Calculate and fill in the checksum */
+	packet->mld2r.ngrec	= htons(rb->ngrec);
+	packet->ip6.ip6_plen	= htons(length);
+	packet->mld2r.csum	= htons(0);
+	packet->mld2r.csum	= ipv6_checksum(&packet->ip6, IPPROTO_ICMPV6, &packet->mld2r, length-sizeof(struct ip6_hbh)-sizeof(packet->routeralert));
+
+	dolog(LOG_DEBUG, "Sending2 MLDv2 Report on %s/%" PRIu64 ", ngrec=%" PRIu64 ", length=%u sources=%" PRIu64 " (in last grec)\n", intn->info.name, intn->ifindex, rb->ngrec, length, rb->nsrcs);
+	sendpacket6(intn, (const struct ip6_hdr *)packet, rb->length);
+
+	/* Increase ICMP sent statistics */
+	COUNTER_ADD(g_conf->counters, CNT_ICMP_SENT, 1);
+	COUNTER_ADD(intn->info.counters, INT_CNT_ICMP_SENT, 1);
+
+	/* Start over with an empty report */
+	rb->length	= sizeof(*packet);
+	rb->grec	= NULL;
+	rb->ngrec	= 0;
+	rb->nsrcs	= 0;
+}
+
+/* Setup the buffer for the reports that go out on intn */
+static bool mld2_report_begin(struct intnode *intn);
+static bool mld2_report_begin(struct intnode *intn)
+{
+	struct reportbuf		*rb = &g_conf->report;
+	struct mld2_report_packet	*packet;
+	uint8_t				*n;
 
-	if (intn->mtu < sizeof(*packet))
+	/* Room for at least one grec with a source */
+	if (intn->mtu < sizeof(*packet) + sizeof(struct mld2_grec) + sizeof(struct in6_addr))
 	{
 		/*
 		 * MTU is too small to support this type of packet
 		 * Should not happen though
 		 */
-		dolog(LOG_WARNING, "MTU too small for packet while sending MLDv2 report on interface %s/%" PRIu64 " mtu=%" PRIu64 "!?\n", intn->name, intn->ifindex, intn->mtu);
-		return;
+		dolog(LOG_WARNING, "MTU too small for packet while sending MLDv2 report on interface %s/%" PRIu64 " mtu=%" PRIu64 "!?\n", intn->info.name, intn->ifindex, intn->mtu);
+		return false;
 	}
 
-	/* Allocate a buffer matching the MTU size of this interface */
-	packet = (struct mld_report_packet *)calloc(1, intn->mtu);
-
-	if (!packet)
+	/* The buffer only grows, up to the largest MTU */
+	if (rb->size < intn->mtu)
 	{
-		dolog(LOG_ERR, "Couldn't allocate memory for MLD2 Report packet, aborting\n");
-		exit(-1);
+		n = (uint8_t *)realloc(rb->packet, intn->mtu);
+		if (!n)
+		{
+			dolog(LOG_ERR, "Couldn't allocate memory for MLD2 Report packet, aborting\n");
+			return false;
+		}
+		rb->packet	= n;
+		rb->size	= intn->mtu;
 	}
 
+	packet = (struct mld2_report_packet *)rb->packet;
+	memzero(packet, sizeof(*packet));
+
 	/* Create the IPv6 packet */
 	packet->ip6.ip6_vfc		= 0x60;
-	packet->ip6.ip6_plen		= ntohs(sizeof(*packet) - sizeof(packet->ip6));
 	packet->ip6.ip6_nxt		= IPPROTO_HOPOPTS;
 	packet->ip6.ip6_hlim		= 1;
 
@@ -1024,7 +1006,7 @@ static void mld2_send_report(struct intnode *intn, const struct in6_addr *mca)
 	 * The source address must be the link-local address
 	 * of the interface we are sending on
 	 */
-	memcpy(&packet->ip6.ip6_src, &intn->linklocal, sizeof(packet->ip6.ip6_src));
+	memcpy(&packet->ip6.ip6_src, &intn->info.linklocal, sizeof(packet->ip6.ip6_src));
 
 	/* MLDv2 Report -> All IPv6 Multicast Routers (ff02::16) */
 	packet->ip6.ip6_dst.s6_addr[0]	= 0xff;
@@ -1046,224 +1028,205 @@ static void mld2_send_report(struct intnode *intn, const struct in6_addr *mca)
 
 	/* ICMPv6 MLD Report */
 	packet->mld2r.type		= ICMP6_V2_MEMBERSHIP_REPORT;
-	packet->mld2r.ngrec		= 0;
-	length = 0;
-
-	/*
-	 * NOTE, we need to watch the MTU size, as there
-	 * will be more subscriptions + SSM combo's than
-	 * the size of one MTU can fit, thus we split it when needed.
-	 */
-
-	/* Loop through all the registered groups */
-	LIST_LOOP(g_conf->groups, groupn, ln)
-	{
-		/*
-		 * If we only need to send for this MCA
-		 * don't count anything else
-		 */
-		if (	(mca && !IN6_ARE_ADDR_EQUAL(mca, &groupn->mca)) ||
-			groupn->interfaces->count == 0)
-		{
-			continue;
-		}
-
-		/* No sources yet for this grec */
-		src = NULL;
-
-		/* Loop through the interested interfaces */
-		LIST_LOOP(groupn->interfaces, grpintn, gn)
-		{
-			/* Skip the sending interface */
-			if (grpintn->ifindex == intn->ifindex)
-			{
-				continue;
-			}
-
-			/* Go through the subscriptions */
-			LIST_LOOP(grpintn->subscriptions, subscrn, sn)
-			{
-				/* Exclusion record? -> Skip it, thus excluding it */
-				if (subscrn->mode == MLD2_MODE_IS_EXCLUDE)
-				{
-					continue;
-				}
-
-				/* Any sources already? */
-				if (src)
-				{
-					/* No grec? */
-					if (!grec)
-					{
-						dolog(LOG_WARNING, "No grec but we do have a source!\n");
-						continue;
-					}
 
-					/* Unspecified address but already have sources to include? */
-					if (IN6_IS_ADDR_UNSPECIFIED(&subscrn->ipv6))
-					{
-					 	/* Remove former sources */
-					 	grec->grec_nsrcs = 0;
+	rb->length	= sizeof(*packet);
+	rb->grec	= NULL;
+	rb->ngrec	= 0;
+	rb->nsrcs	= 0;
 
-						/* Jump to exclude mode with 0 sources -> Anything */
-						grec->grec_type = MLD2_MODE_IS_EXCLUDE;
+	return true;
+}
 
-						/* No sources yet in this grec */
-						src = NULL;
-						any = true;
-					}
+/* Start a new grec, sending the report first when it is full */
+static void mld2_report_record(struct intnode *intn, const struct in6_addr *mca, uint8_t type);
+static void mld2_report_record(struct intnode *intn, const struct in6_addr *mca, uint8_t type)
+{
+	struct reportbuf *rb = &g_conf->report;
 
-					/* Don't add sources twice (seperate interfaces might want the same S<->G) */
-					for (i=0; !any && src && (i < grec->grec_nsrcs); i++)
-					{
-						src = ((char *)grec) + sizeof(*grec) + (sizeof(struct in6_addr) * grec->grec_nsrcs);
+	if (rb->length + sizeof(*rb->grec) > intn->mtu) mld2_report_send(intn);
 
-						/* Skip it if it already exists */
-						if (memcmp(&subscrn->ipv6, src, sizeof(subscrn->ipv6)) == 0)
-						{
-							dolog(LOG_DEBUG, "Not adding source address as we have ANY already added\n");
-							src = NULL;
-							break;
-						}
-					}
+	rb->grec = (struct mld2_grec *)(rb->packet + rb->length);
+	memzero(rb->grec, sizeof(*rb->grec));
+	rb->grec->grec_type = type;
+	memcpy(&rb->grec->grec_mca, mca, sizeof(rb->grec->grec_mca));
 
-					/* Skip it */
-					if (!src)
-					{
-						continue;
-					}
-				}
+	rb->length += sizeof(*rb->grec);
+	rb->ngrec++;
+	rb->nsrcs = 0;
+}
 
-				/* Packet with at least one grec and one or more src's, excluding ip6 header */
-				if (grec)
-				{
-					length = (((char *)grec) - ((char *)packet) + sizeof(*grec) + (sizeof(struct in6_addr) * (grec->grec_nsrcs)) - sizeof(packet->ip6));
-				}
-				/* Empty packet, no grec+src's */
-				else
-				{
-					length = sizeof(*packet);
-				}
+/*
+ * Add a source to the INCLUDE grec of mca, when the report is full it
+ * is sent and the sources continue in a new grec in the next one
+ */
+static void mld2_report_source(struct intnode *intn, const struct in6_addr *mca, const struct in6_addr *src);
+static void mld2_report_source(struct intnode *intn, const struct in6_addr *mca, const struct in6_addr *src)
+{
+	struct reportbuf *rb = &g_conf->report;
 
-				/* Would adding it not fit? -> Send it out */
-				if ((length + sizeof(packet->ip6) + (grec ? 0 : sizeof(*grec)) +
-				    (any || IN6_IS_ADDR_UNSPECIFIED(&subscrn->ipv6) ? 0 : sizeof(struct in6_addr))) > intn->mtu)
-				{
-					if (!grec)
-					{
-						/* Should not happen! Would mean the MTU is smaller than a standard mld report */
-						dolog(LOG_WARNING, "No grec and MTU too small for packet while sending MLDv2 report on interface %s/%" PRIu64 " mtu=%" PRIu64 "!?\n", intn->name, intn->ifindex, intn->mtu);
-						free(packet);
-						return;
-					}
+	if (!rb->grec || rb->length + sizeof(*src) > intn->mtu)
+	{
+		/* Room for a new grec with this source? */
+		if (rb->length + sizeof(*rb->grec) + sizeof(*src) > intn->mtu) mld2_report_send(intn);
+		mld2_report_record(intn, mca, MLD2_MODE_IS_INCLUDE);
+	}
 
-					/* Take care of endianess */
-					packet->mld2r.ngrec	= htons(packet->mld2r.ngrec);
-					grec->grec_nsrcs	= htons(grec->grec_nsrcs);
+	memcpy(rb->packet + rb->length, src, sizeof(*src));
+	rb->length += sizeof(*src);
+	rb->grec->grec_nsrcs = htons(++rb->nsrcs);
+}
 
-					/* Calculate and fill in the checksum */
-					packet->ip6.ip6_plen	= htons(length);
-					packet->mld2r.csum	= htons(0);
-					packet->mld2r.csum	= ipv6_checksum(&packet->ip6, IPPROTO_ICMPV6, &packet->mld2r, length-sizeof(struct ip6_hbh)-sizeof(packet->routeralert));
+/* Hash a source address, mixing all it's bits into the low ones */
+static uint32_t mld2_report_hash(const struct in6_addr *src);
+static uint32_t mld2_report_hash(const struct in6_addr *src)
+{
+	uint32_t w[4], h;
 
-					dolog(LOG_DEBUG, "Sending2 MLDv2 Report on %s/%" PRIu64 ", ngrec=%u, length=%u sources=%u (in last grec)\n", intn->name, intn->ifindex, ntohs(packet->mld2r.ngrec), length, ntohs(grec->grec_nsrcs));
-					sendpacket6(intn, (const struct ip6_hdr *)packet, length + sizeof(packet->ip6));
+	memcpy(w, src, sizeof(w));
 
-					/* Increase ICMP sent statistics */
-					g_conf->stat_icmp_sent++;
-					intn->stat_icmp_sent++;
+	h  = (w[0] * 0x9e3779b1) ^ (w[1] * 0x85ebca6b) ^ (w[2] * 0xc2b2ae35) ^ (w[3] * 0x27d4eb2f);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
 
-					/* Reset the MLDv2 struct */
-					packet->mld2r.ngrec = 0;
-					grec = NULL;
-					src = NULL;
-				}
+	return h;
+}
 
-				/* First source to be added to this grec? */
-				if (!src)
-				{
-					/* A new grec */
-					packet->mld2r.ngrec++;
+/*
+ * Remember a source of the current group, returns true when
+ * it was seen already. The slots of earlier groups are told
+ * apart by their generation, thus nothing has to be cleared.
+ */
+static bool mld2_report_seen(const struct in6_addr *src);
+static bool mld2_report_seen(const struct in6_addr *src)
+{
+	struct reportbuf	*rb = &g_conf->report;
+	struct reportsrc	*slots, *s;
+	uint64_t		size, i, j;
+	uint32_t		h;
 
-					/* Already a grec in the packet? */
-					if (grec)
-					{
-						/* Fixup endianness */
-						grec->grec_nsrcs = htons(grec->grec_nsrcs);
+	/* Keep it at most half full */
+	if ((rb->srccount + 1) * 2 > rb->srcsize)
+	{
+		size = rb->srcsize ? rb->srcsize * 2 : 64;
+		slots = (struct reportsrc *)calloc(size, sizeof(*slots));
+		if (!slots)
+		{
+			/* Might cause a duplicate, which is harmless */
+			dolog(LOG_ERR, "Couldn't allocate memory for the MLD2 Report sources\n");
+			return false;
+		}
 
-						/* Next grec */
-						grec = (struct mld2_grec *)(((uint8_t *)grec) + sizeof(*grec) + (sizeof(struct in6_addr) * grec->grec_nsrcs));
-					}
-					else
-					{
-						/* First grec */
-						grec = (struct mld2_grec *)(((uint8_t *)packet) + sizeof(*packet));
-					}
+		/* Move the sources of the current group over */
+		for (i = 0; i < rb->srcsize; i++)
+		{
+			if (rb->srcs[i].gen != rb->gen) continue;
 
-					/* The Multicast address */
-					memcpy(&grec->grec_mca, &groupn->mca, sizeof(grec->grec_mca));
+			h = mld2_report_hash(&rb->srcs[i].src);
+			for (j = h & (size - 1); slots[j].gen == rb->gen; j = (j + 1) & (size - 1));
+			slots[j] = rb->srcs[i];
+		}
 
-					/* Zero sources upto now */
-					grec->grec_nsrcs = 0;
+		free(rb->srcs);
+		rb->srcs	= slots;
+		rb->srcsize	= size;
+	}
 
-					/* 0 Sources -> Exclude those */
-					grec->grec_type = MLD2_MODE_IS_EXCLUDE;
+	h = mld2_report_hash(src);
+	for (i = h & (rb->srcsize - 1); ; i = (i + 1) & (rb->srcsize - 1))
+	{
+		s = &rb->srcs[i];
 
-					/* Nothing added yet */
-					any = false;
-				}
+		if (s->gen != rb->gen)
+		{
+			memcpy(&s->src, src, sizeof(s->src));
+			s->gen = rb->gen;
+			rb->srccount++;
+			return false;
+		}
 
-				/* Only add non-:: addresses */
-				if (!IN6_IS_ADDR_UNSPECIFIED(&subscrn->ipv6))
-				{
-					/* First/Next address */
-					src = (struct in6_addr *)(((char *)grec) + sizeof(*grec) + (sizeof(struct in6_addr) * grec->grec_nsrcs));
+		if (IN6_ARE_ADDR_EQUAL(&s->src, src)) return true;
+	}
+}
 
-					/* An additional source */
-					grec->grec_nsrcs++;
+/* Add the grecs for a group, as seen from all interfaces but intn */
+static void mld2_report_group(struct intnode *intn, struct groupnode *groupn);
+static void mld2_report_group(struct intnode *intn, struct groupnode *groupn)
+{
+	struct reportbuf		*rb = &g_conf->report;
+	struct grpintnode		*grpintn;
+	struct subscrnode		*subscrn;
+	struct listnode			*gn, *sn;
 
-					/* State becomes include */
-					grec->grec_type = MLD2_MODE_IS_INCLUDE;
+	/* Does any interface want any source? -> Exclude nothing */
+	LIST_LOOP(&groupn->interfaces, grpintn, gn)
+	{
+		/* Skip the sending interface */
+		if (grpintn->interface == intn) continue;
 
-					/* Append the source address */
-					memcpy(src, &subscrn->ipv6, sizeof(struct in6_addr));
-				}
-				else
-				{
-					/* We added a 'any' address, thus don't add anything else */
-					any = true;
-				}
+		LIST_LOOP(&grpintn->subscriptions, subscrn, sn)
+		{
+			if (	subscrn->mode == MLD2_MODE_IS_INCLUDE &&
+				IN6_IS_ADDR_UNSPECIFIED(&subscrn->ipv6))
+			{
+				mld2_report_record(intn, &groupn->mca, MLD2_MODE_IS_EXCLUDE);
+				return;
 			}
 		}
 	}
 
-	/* Any groups left to send? */
-	if (packet->mld2r.ngrec == 0)
+	/* A new group, forget the sources of the previous one */
+	rb->gen++;
+	rb->srccount = 0;
+
+	/* Include the sources that are wanted, exclusion records are skipped */
+	rb->grec = NULL;
+	LIST_LOOP(&groupn->interfaces, grpintn, gn)
 	{
-		free(packet);
-		packet = NULL;
-		return;
-	}
+		if (grpintn->interface == intn) continue;
 
-	length = (((char *)grec) - ((char *)packet) + sizeof(*grec) + (sizeof(struct in6_addr) * (grec->grec_nsrcs)) - sizeof(packet->ip6));
+		LIST_LOOP(&grpintn->subscriptions, subscrn, sn)
+		{
+			if (	subscrn->mode != MLD2_MODE_IS_INCLUDE ||
+				mld2_report_seen(&subscrn->ipv6))
+			{
+				continue;
+			}
 
-	/* Take care of endianess */
-	packet->mld2r.ngrec	= htons(packet->mld2r.ngrec);
-	grec->grec_nsrcs	= htons(grec->grec_nsrcs);
+			mld2_report_source(intn, &groupn->mca, &subscrn->ipv6);
+		}
+	}
+}
 
-	/* Calculate and fill in the checksum */
-	packet->ip6.ip6_plen	= htons(length);
-	packet->mld2r.csum	= htons(0);
-	packet->mld2r.csum	= ipv6_checksum(&packet->ip6, IPPROTO_ICMPV6, &packet->mld2r, length-sizeof(struct ip6_hbh)-sizeof(packet->routeralert));
+/*
+ * Send a MLDv2 report of all the groups, or only mca, to intn
+ *
+ * The report is built in a buffer that is kept around, sources are
+ * de-duplicated with a hash of the sources of the group, and grecs
+ * that don't fit in one MTU continue in the next report.
+ */
+static void mld2_send_report(struct intnode *intn, const struct in6_addr *mca);
+static void mld2_send_report(struct intnode *intn, const struct in6_addr *mca)
+{
+	struct groupnode	*groupn;
+	uint64_t		hi;
 
-	dolog(LOG_DEBUG, "Sending2 MLDv2 Report on %s/%" PRIu64 ", ngrec=%u, length=%u sources=%u (in last grec)\n", intn->name, intn->ifindex, ntohs(packet->mld2r.ngrec), length, ntohs(grec->grec_nsrcs));
-	sendpacket6(intn, (const struct ip6_hdr *)packet, length + sizeof(packet->ip6));
+	if (!mld2_report_begin(intn)) return;
 
-	/* Increase ICMP sent statistics */
-	g_conf->stat_icmp_sent++;
-	intn->stat_icmp_sent++;
+	if (mca)
+	{
+		groupn = group_find(mca);
+		if (groupn) mld2_report_group(intn, groupn);
+	}
+	else
+	{
+		HASH_LOOP(g_conf->groups, groupn, hi)
+		{
+			mld2_report_group(intn, groupn);
+		}
+	}
 
-	free(packet);
+	mld2_report_send(intn);
 }
 #endif /* ECMH_SUPPORT_MLD2 */
 
@@ -1277,13 +1240,13 @@ static void mld_send_report(struct intnode *intn, const struct in6_addr *mca)
 	 *
 	 * Don't send packets to upstream interfaces when it is unknown what version they do
 	 */
-	if (!g_conf->mld2only && (g_conf->mld1only || (intn->mld_version == 0 && !intn->upstream) || intn->mld_version == 1))
+	if (!g_conf->mld2only && (g_conf->mld1only || (intn->info.mld_version == 0 && !intn->upstream) || intn->info.mld_version == 1))
 	{
 		mld1_send_report(intn, mca);
 	}
 
 #ifdef ECMH_SUPPORT_MLD2
-	if (!g_conf->mld1only && (g_conf->mld2only || intn->mld_version == 0 || intn->mld_version == 2))
+	if (!g_conf->mld1only && (g_conf->mld2only || intn->info.mld_version == 0 || intn->info.mld_version == 2))
 	{
 		mld2_send_report(intn, mca);
 	}
@@ -1293,28 +1256,22 @@ static void mld_send_report(struct intnode *intn, const struct in6_addr *mca)
 static void mld_send_report_all(struct intnode *interface, const struct in6_addr *mca);
 static void mld_send_report_all(struct intnode *interface, const struct in6_addr *mca)
 {
-	unsigned int		i;
+	uint64_t		i;
 	struct intnode		*intn;
 
-	dolog(LOG_DEBUG, "Broadcasting group to all interfaces but %s...\n", interface->name);
+	dolog(LOG_DEBUG, "Broadcasting group to all interfaces but %s...\n", interface->info.name);
 
 	/* Broadcast that we want this new group */
-	for (i = 0; i < g_conf->maxinterfaces; i++)
+	INT_LOOP(intn, i)
 	{
-		intn = &g_conf->ints[i];
-
-		/*
-		 * - Skip unconfigured interfaces
-		 * - Skip the interface it came from
-		 */
-		if (	intn->mtu == 0 ||
-			interface->ifindex == intn->ifindex) continue;
+		/* Skip the interface it came from */
+		if (interface->ifindex == intn->ifindex) continue;
 
 		/* Send the MLD Report */
 		mld_send_report(intn, mca);
 	}
 
-	dolog(LOG_DEBUG, "Broadcasting group to all interfaces but %s... - done\n", interface->name);
+	dolog(LOG_DEBUG, "Broadcasting group to all interfaces but %s... - done\n", interface->info.name);
 }
 
 #ifdef ECMH_SUPPORT_IPV4
@@ -1323,7 +1280,7 @@ static void mld_send_report_all(struct intnode *interface, const struct in6_addr
 static void l4_ipv4_icmp(struct intnode *intn, struct ip *iph, const void *packet, const uint16_t len);
 static void l4_ipv4_icmp(struct intnode *intn, struct ip *iph, const void *packet, const uint16_t len)
 {
-	D(dolog(LOG_DEBUG, "%5s L4:IPv4 ICMP\n", intn->name);)
+	D(dolog(LOG_DEBUG, "%5s L4:IPv4 ICMP\n", intn->info.name);)
 	return;
 }
 
@@ -1356,7 +1313,7 @@ static void l4_ipv4_proto41(struct intnode *intn, struct ip *iph, const void *pa
 	if (localn)
 	{
 #if 0
-		dolog(LOG_DEBUG, "Dropping packet originating from ourselves on %s\n", intn->name);
+		dolog(LOG_DEBUG, "Dropping packet originating from ourselves on %s\n", intn->info.name);
 #endif
 		return;
 	}
@@ -1388,7 +1345,7 @@ static void l4_ipv4_proto41(struct intnode *intn, struct ip *iph, const void *pa
 	}
 
 	/* Send it through our decoder again, looking as it is a native IPv6 received on intn ;) */
-	dolog(LOG_DEBUG, "Proto-41 from %08x->%08x on %s, tunnel %s\n", iph->ip_src, iph->ip_dst, intn->name, tun->name);
+	dolog(LOG_DEBUG, "Proto-41 from %08x->%08x on %s, tunnel %s\n", iph->ip_src, iph->ip_dst, intn->info.name, tun->info.name);
 	l2_ethtype(tun, packet, len, ETH_P_IPV6);
 
 	return;
@@ -1406,20 +1363,20 @@ static void l3_ipv4(struct intnode UNUSED *intn, struct ip *iph, const uint16_t
 {
 	if (iph->ip_v != 4)
 	{
-		D(dolog(LOG_DEBUG, "%5s L3:IPv4: IP version %u not supported\n", intn->name, iph->ip_v);)
+		D(dolog(LOG_DEBUG, "%5s L3:IPv4: IP version %u not supported\n", intn->info.name, iph->ip_v);)
 		return;
 	}
 
 	if (iph->ip_hl < 5)
 	{
-		D(dolog(LOG_DEBUG, "%5s L3IPv4: IP hlen < 5 bytes (%u)\n", intn->name, iph->ip_hl);)
+		D(dolog(LOG_DEBUG, "%5s L3IPv4: IP hlen < 5 bytes (%u)\n", intn->info.name, iph->ip_hl);)
 		return;
 	}
 
 	if (ntohs(iph->ip_len) > len)
 	{
 		/* This happens mostly with unknown ARPHRD_* types */
-		D(dolog(LOG_DEBUG, "%5s L3:IPv4: *** L3 length > L2 length (%u != %u)\n", intn->name, ntohs(iph->ip_len), len);)
+		D(dolog(LOG_DEBUG, "%5s L3:IPv4: *** L3 length > L2 length (%u != %u)\n", intn->info.name, ntohs(iph->ip_len), len);)
 #if 0
 		return;
 #endif
@@ -1433,7 +1390,7 @@ static void l3_ipv4(struct intnode UNUSED *intn, struct ip *iph, const uint16_t
 		inet_ntop(AF_INET, &iph->ip_dst, dst, sizeof(dst));
 		inet_ntop(AF_INET, &ipv4_6to4_relay, to4, sizeof(to4));
 
-		dolog(LOG_DEBUG, "%5s L3:IPv4: IPv%01u %-16s %-16s %4u (%-16s)\n", intn->name, iph->ip_v, src, dst, ntohs(iph->ip_len), to4);
+		dolog(LOG_DEBUG, "%5s L3:IPv4: IPv%01u %-16s %-16s %4u (%-16s)\n", intn->info.name, iph->ip_v, src, dst, ntohs(iph->ip_len), to4);
 	}
 #endif
 	/* Ignore traffic from/to 6to4 relay address */
@@ -1469,7 +1426,7 @@ static void mld_log(unsigned int level, const char *msg, const struct in6_addr *
 	memzero(mca, sizeof(mca));
 	inet_ntop(AF_INET6, i_mca, mca, sizeof(mca));
 
-	dolog(level, "%s for %s on %s/%" PRIu64 "\n", msg, mca, intn->name, intn->ifindex);
+	dolog(level, "%s for %s on %s/%" PRIu64 "\n", msg, mca, intn->info.name, intn->ifindex);
 }
 
 static void l4_ipv6_icmpv6_mld1_report(struct intnode *intn, struct mld1 *mld1);
@@ -1526,6 +1483,9 @@ static void l4_ipv6_icmpv6_mld1_report(struct intnode *intn, struct mld1 *mld1)
 		return;
 	}
 
+	/* Recompile the outgoing interfaces if this changed anything */
+	group_oil_update(grpintn->groupn);
+
 	if (isnew)
 	{
 		mld_send_report_all(intn, &mld1->mca);
@@ -1579,7 +1539,7 @@ static void l4_ipv6_icmpv6_mld1_reduction(struct intnode *intn, struct mld1 *mld
 	}
 
 	/* Find the grpintnode */
-	grpintn = grpint_find(groupn->interfaces, intn);
+	grpintn = grpint_find(&groupn->interfaces, intn);
 	if (!grpintn)
 	{
 		mld_log(LOG_WARNING, "Couldn't find the grpint to reduce", &mld1->mca, intn);
@@ -1589,13 +1549,16 @@ static void l4_ipv6_icmpv6_mld1_reduction(struct intnode *intn, struct mld1 *mld
 	/* No source address, so use any */
 	memzero(&any, sizeof(any));
 
-	if (!subscr_unsub(grpintn->subscriptions, &any))
+	if (!subscr_unsub(grpintn, &any))
 	{
 		mld_log(LOG_WARNING, "Couldn't unsubscribe", &mld1->mca, intn);
 		return;
 	}
 
-	if (grpintn->subscriptions->count <= 0)
+	/* The interface does not want the group anymore */
+	group_oil_build(groupn);
+
+	if (grpintn->subscriptions.count <= 0)
 	{
 		/* Requery if somebody still want it, as it will timeout otherwise. */
 		mld_log(LOG_DEBUG, "Querying for other listeners", &mld1->mca, intn);
@@ -1603,8 +1566,11 @@ static void l4_ipv6_icmpv6_mld1_reduction(struct intnode *intn, struct mld1 *mld
 
 #ifdef ECMH_SUPPORT_MLD2
 		/* Skip Robustness */
-		grpintn->subscriptions->count = -ECMH_ROBUSTNESS_FACTOR;
+		grpintn->subscriptions.count = -ECMH_ROBUSTNESS_FACTOR;
 #endif
+
+		/* Remove it later on if nobody answers */
+		grpint_leave(grpintn);
 	}
 
 	return;
@@ -1624,7 +1590,7 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 #ifdef ECMH_SUPPORT_MLDV2
 	if (g_conf->mld1only)
 	{
-		dolog(LOG_DEBUG, "Ignoring ICMPv6 MLDv2 Report on %s/%u due to MLDv1Only mode\n", intn->name, intn->ifindex);
+		dolog(LOG_DEBUG, "Ignoring ICMPv6 MLDv2 Report on %s/%u due to MLDv1Only mode\n", intn->info.name, intn->ifindex);
 		return;
 	}
 #endif
@@ -1637,7 +1603,7 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 	int_set_mld_version(intn, 2);
 
 	dolog(LOG_DEBUG, "Received a ICMPv6 MLDv2 Report (%u) on %s (grec's: %u)\n",
-		(unsigned int)mld2r->type, intn->name, ngrec);
+		(unsigned int)mld2r->type, intn->info.name, ngrec);
 
 	if ((sizeof(*mld2r) + ngrec*sizeof(*grec)) > plen)
 	{
@@ -1656,7 +1622,7 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 		if (((char *)grec) > (((char *)mld2r)+plen))
 		{
 			dolog(LOG_ERR, "Reached outside the packet (ngrec=%u) received on %s, length %u -> ignoring\n",
-				ngrec, intn->name, plen);
+				ngrec, intn->info.name, plen);
 			return;
 		}
 
@@ -1669,7 +1635,7 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 		inet_ntop(AF_INET6, &grec->grec_mca, mca, sizeof(mca));
 		dolog(LOG_DEBUG, "MLDv2 Report (grec=%u) wanting %s %s with %u sources on %s\n",
 			ngrec, lookup(mld2_grec_types, grec->grec_type),
-			mca, nsrcs, intn->name);
+			mca, nsrcs, intn->info.name);
 #endif
 
 		if (	grec->grec_type != MLD2_MODE_IS_INCLUDE &&
@@ -1680,7 +1646,7 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 			grec->grec_type != MLD2_BLOCK_OLD_SOURCES)
 		{
 			dolog(LOG_ERR, "Unknown Group Record Type %u/0x%x (ngrec=%u) on %s -> Ignoring Report\n",
-				grec->grec_type, grec->grec_type, ngrec, intn->name);
+				grec->grec_type, grec->grec_type, ngrec, intn->info.name);
 			return;
 		}
 
@@ -1744,6 +1710,12 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 			}
 		}
 
+		/* Recompile the outgoing interfaces if this changed anything */
+		if (grpintn)
+		{
+			group_oil_update(grpintn->groupn);
+		}
+
 		if (isnew)
 		{
 			mld_send_report_all(intn, &grec->grec_mca);
@@ -1761,12 +1733,10 @@ static void l4_ipv6_icmpv6_mld2_report(struct intnode *intn, struct mld2_report
 static void l4_ipv6_icmpv6_mld_query(struct intnode *intn, const uint16_t plen);
 static void l4_ipv6_icmpv6_mld_query(struct intnode *intn, const uint16_t plen)
 {
-	struct groupnode	*groupn;
-	struct listnode		*ln;
 	struct grpintnode	*grpintn;
 	struct listnode		*gn;
 
-	dolog(LOG_DEBUG, "Received a ICMPv6 MLD Query on %s\n", intn->name);
+	dolog(LOG_DEBUG, "Received a ICMPv6 MLD Query on %s\n", intn->info.name);
 	
 	/* It's MLDv1 when the packet has the size of a MLDv1 packet */
 	if (plen == sizeof(struct mld1))
@@ -1774,7 +1744,7 @@ static void l4_ipv6_icmpv6_mld_query(struct intnode *intn, const uint16_t plen)
 #ifdef ECMH_SUPPORT_MLDV2
 		if (g_conf->mld2only)
 		{
-			dolog(LOG_DEBUG, "Ignoring ICMPv6 MLDv2 Query on %s/%u due to MLDv2Only mode\n", intn->name, intn->ifindex);
+			dolog(LOG_DEBUG, "Ignoring ICMPv6 MLDv2 Query on %s/%u due to MLDv2Only mode\n", intn->info.name, intn->ifindex);
 			return;
 		}
 #endif
@@ -1790,7 +1760,7 @@ static void l4_ipv6_icmpv6_mld_query(struct intnode *intn, const uint16_t plen)
 #ifdef ECMH_SUPPORT_MLDV2
 		if (g_conf->mld1only)
 		{
-			dolog(LOG_DEBUG, "Ignoring ICMPv6 MLDv1 Query on %s/%u due to MLDv1Only mode\n", intn->name, intn->ifindex);
+			dolog(LOG_DEBUG, "Ignoring ICMPv6 MLDv1 Query on %s/%u due to MLDv1Only mode\n", intn->info.name, intn->ifindex);
 			return;
 		}
 #endif
@@ -1804,60 +1774,67 @@ static void l4_ipv6_icmpv6_mld_query(struct intnode *intn, const uint16_t plen)
 	 * as the above code just determined what
 	 * version it is.
 	 */
-	if (!g_conf->mld2only && (g_conf->mld1only || intn->mld_version == 0 || intn->mld_version == 1))
+	if (!g_conf->mld2only && (g_conf->mld1only || intn->info.mld_version == 0 || intn->info.mld_version == 1))
 	{
 #endif /* ECMH_SUPPORT_MLD2 */
 		/* MLDv1 sends reports one group at a time */
 
 		/*
-		 * Walk along the list of groups
-		 * and report all the groups we are subscribed for
+		 * Walk along the groups joined on this interface
+		 * and report all of them to the querying router
 		 */
-		LIST_LOOP(g_conf->groups, groupn, ln)
+		LIST_LOOP(&intn->info.groups, grpintn, gn)
 		{
-			LIST_LOOP(groupn->interfaces, grpintn, gn)
-			{
-				/* We only are sending for this interface */
-				if (grpintn->ifindex != intn->ifindex)
-				{
-					continue;
-				}
-	
-				/* Report this group to the querying router */
-				mld_send_report(intn, &groupn->mca);
-			}
+			mld_send_report(intn, &grpintn->groupn->mca);
 		}
 #ifdef ECMH_SUPPORT_MLD2
 	}
-	else if (!g_conf->mld1only && (g_conf->mld2only || intn->mld_version == 2))
+	else if (!g_conf->mld1only && (g_conf->mld2only || intn->info.mld_version == 2))
 	{
 		/* Send all the groups to this interface */
 		mld2_send_report(intn, NULL);
 	}
 	else
 	{
-		dolog(LOG_DEBUG, "Did not answer query on %s\n", intn->name);
+		dolog(LOG_DEBUG, "Did not answer query on %s\n", intn->info.name);
 	}
 #endif /* ECMH_SUPPORT_MLD2 */
 
 	return;
 }
 
+/* Hash a flow to it's slot in the flow cache */
+static struct flowentry *flow_slot(const struct intnode *intn, const struct ip6_hdr *iph);
+static struct flowentry *flow_slot(const struct intnode *intn, const struct ip6_hdr *iph)
+{
+	uint32_t	s, d, h;
+
+	/* The low bits of the addresses are the ones that differ */
+	memcpy(&s, &iph->ip6_src.s6_addr[12], sizeof(s));
+	memcpy(&d, &iph->ip6_dst.s6_addr[12], sizeof(d));
+
+	h = (s * 0x9e3779b1) ^ (d * 0x85ebca6b) ^ ((uint32_t)intn->ifindex * 0xc2b2ae35);
+	h ^= h >> 16;
+
+	return &g_flows[h & (ECMH_FLOWCACHE - 1)];
+}
+
 /*
- * Forward a multicast packet to interfaces that have subscriptions for it
- *
- * intn		= The interface we received this packet on
- * packet	= The packet, starting with IPv6 header
- * len		= Length of the complete packet
+ * Resolve where a multicast packet has to go and cache it
+ * flow->groupn is left NULL when it isn't forwarded at all
  */
-static void l4_ipv6_multicast(struct intnode *intn, struct ip6_hdr *iph, const uint16_t len);
-static void l4_ipv6_multicast(struct intnode *intn, struct ip6_hdr *iph, const uint16_t len)
+static void flow_resolve(struct intnode *intn, const struct ip6_hdr *iph, struct flowentry *flow);
+static void flow_resolve(struct intnode *intn, const struct ip6_hdr *iph, struct flowentry *flow)
 {
-	struct intnode		*interface;
 	struct groupnode	*groupn;
-	struct grpintnode	*grpintn;
-	struct subscrnode	*subscrn;
-	struct listnode		*in, *in2;
+	struct oilsrc		*oils;
+
+	memcpy(&flow->src, &iph->ip6_src, sizeof(flow->src));
+	memcpy(&flow->dst, &iph->ip6_dst, sizeof(flow->dst));
+	flow->ifindex	= intn->ifindex;
+	flow->gen	= g_conf->oil_gen;
+	flow->groupn	= NULL;
+	flow->oils	= NULL;
 
 	/* 
 	 * Don't route multicast packets that:
@@ -1886,13 +1863,18 @@ D(
 
 		inet_ntop(AF_INET6, &iph->ip6_src, src, sizeof(src));
 		inet_ntop(AF_INET6, &iph->ip6_dst, dst, sizeof(dst));
-		dolog(LOG_DEBUG, "%5s L3:IPv6: IPv%0x %40s %40s %4u %u\n", intn->name, (int)((iph->ip6_vfc>>4)&0x0f), src, dst, ntohs(iph->ip6_plen), iph->ip6_nxt);
+		dolog(LOG_DEBUG, "%5s L3:IPv6: IPv%0x %40s %40s %4u %u\n", intn->info.name, (int)((iph->ip6_vfc>>4)&0x0f), src, dst, ntohs(iph->ip6_plen), iph->ip6_nxt);
 	}
 )
 #endif
 
-	/* Find the group belonging to this multicast destination */
-	groupn = group_find(&iph->ip6_dst);
+	/*
+	 * A SSM channel is found with one probe on (S,G), the source
+	 * and destination follow each other in the header.
+	 * Otherwise find the group belonging to this multicast destination
+	 */
+	oils = IN6_IS_ADDR_MC_SSM(&iph->ip6_dst) ? channel_find(&iph->ip6_src) : NULL;
+	groupn = oils ? oils->groupn : group_find(&iph->ip6_dst);
 
 	if (!groupn)
 	{
@@ -1908,55 +1890,163 @@ D(
 		return;
 	}
 
+	/* Interfaces that want this specific source */
+	flow->groupn	= groupn;
+	flow->oils	= oils ? oils : group_oil_find(groupn, &iph->ip6_src);
+}
+
+/* Is the cached flow the one of this packet and still valid? */
+static bool flow_hit(const struct flowentry *flow, const struct intnode *intn, const struct ip6_hdr *iph);
+static bool flow_hit(const struct flowentry *flow, const struct intnode *intn, const struct ip6_hdr *iph)
+{
+	return (flow->gen == g_conf->oil_gen &&
+		flow->ifindex == intn->ifindex &&
+		IN6_ARE_ADDR_EQUAL(&flow->src, &iph->ip6_src) &&
+		IN6_ARE_ADDR_EQUAL(&flow->dst, &iph->ip6_dst));
+}
+
+/*
+ * Send a packet to the interfaces that want it
+ *
+ * intn		= The interface we received this packet on
+ * groupn	= The group of the packet
+ * oils		= The interfaces wanting the source of the packet, NULL when none
+ */
+static void l4_ipv6_replicate(struct intnode *intn, struct ip6_hdr *iph, const uint16_t len, struct groupnode *groupn, const struct oilsrc *oils);
+static void l4_ipv6_replicate(struct intnode *intn, struct ip6_hdr *iph, const uint16_t len, struct groupnode *groupn, const struct oilsrc *oils)
+{
+	struct intnode		*interface;
+	uint64_t		i;
+
 	/* Increase the statistics for this group */
-	groupn->bytes+=len;
-	groupn->packets++;
+	COUNTER_ADD(groupn->counters, GROUP_CNT_BYTES, len);
+	COUNTER_ADD(groupn->counters, GROUP_CNT_PACKETS, 1);
 
-	LIST_LOOP(groupn->interfaces, grpintn, in)
+	/* Interfaces that want any source */
+	for (i = 0; i < groupn->oil_count; i++)
 	{
-		/* Don't send to the interface this packet originated from */
-		if (intn->ifindex == grpintn->ifindex)
+		interface = groupn->oil[i];
+
+		/*
+		 * Don't send to the interface this packet originated from
+		 * nor to interfaces that have been destroyed meanwhile
+		 */
+		if (interface == intn || interface->mtu == 0)
 		{
 			continue;
 		}
 
-		/* Check the subscriptions for this group */
-		LIST_LOOP(grpintn->subscriptions, subscrn, in2)
+		/* Queue the packet for this interface */
+		sendpacket6_queue(interface, iph, len);
+	}
+
+	/* Interfaces that want this specific source */
+	if (!oils)
+	{
+		return;
+	}
+
+	for (i = 0; i < oils->count; i++)
+	{
+		interface = oils->ints[i];
+
+		if (interface == intn || interface->mtu == 0)
 		{
-			/* Unspecified or specific subscription to this address? */
-			if (	!IN6_ARE_ADDR_EQUAL(&subscrn->ipv6, &in6addr_any) &&
-				!IN6_ARE_ADDR_EQUAL(&subscrn->ipv6, &iph->ip6_src))
-			{
-				continue;
-			}
+			continue;
+		}
 
-			/*
-			 * If it was explicitly requested to include
-			 * packets from this source,
-			 * don't even look further and do so.
-			 * This is the case when an MLDv1 listener
-			 * is on the link too for example.
-			 */
-			if (subscrn->mode != MLD2_MODE_IS_INCLUDE)
-			{
-				continue;
-			}
+		sendpacket6_queue(interface, iph, len);
+	}
+}
 
-			/* Get the interface */
-			interface = int_find(grpintn->ifindex);
-			if (!interface)
-			{
-				continue;
-			}
+#ifndef ECMH_BPF
+/*
+ * Forward the packets collected in the burst
+ *
+ * Every stage is done for all the packets before the next one,
+ * the cache lines the next stage needs are prefetched meanwhile:
+ * first the flow cache slots, then the groups, and last the
+ * replicas are queued for sendmmsg().
+ * The packets have to stay untouched till sendpacket6_flush().
+ */
+static void burst_run(void);
+static void burst_run(void)
+{
+	struct rxburst		*b = &g_worker->burst;
+	struct flowentry	*flow;
+	unsigned int		i;
 
-			/* Send the packet to this interface */
-			sendpacket6(interface, iph, len);
-			
-			/* Packet is forwarded thus proceed to next interface */
-			break;
+	for (i = 0; i < b->count; i++)
+	{
+		b->flow[i] = flow_slot(b->intn[i], b->iph[i]);
+		PREFETCH(b->flow[i]);
+	}
+
+	for (i = 0; i < b->count; i++)
+	{
+		flow = b->flow[i];
+		if (!flow_hit(flow, b->intn[i], b->iph[i]))
+		{
+			flow_resolve(b->intn[i], b->iph[i], flow);
 		}
 
+		/* Another packet of the burst might take over the slot */
+		b->groupn[i]	= flow->groupn;
+		b->oils[i]	= flow->oils;
+
+		if (b->groupn[i]) PREFETCH(b->groupn[i]);
+	}
+
+	for (i = 0; i < b->count; i++)
+	{
+		if (!b->groupn[i]) continue;
+
+		l4_ipv6_replicate(b->intn[i], b->iph[i], b->len[i], b->groupn[i], b->oils[i]);
+	}
+
+	b->count = 0;
+}
+#endif /* !ECMH_BPF */
+
+/*
+ * Forward a multicast packet to interfaces that have subscriptions for it
+ * Packets received on a PACKET socket are only added to the burst,
+ * the receive path forwards them all with burst_run().
+ *
+ * intn		= The interface we received this packet on
+ * packet	= The packet, starting with IPv6 header
+ * len		= Length of the complete packet
+ */
+static void l4_ipv6_multicast(struct intnode *intn, struct ip6_hdr *iph, const uint16_t len);
+static void l4_ipv6_multicast(struct intnode *intn, struct ip6_hdr *iph, const uint16_t len)
+{
+#ifndef ECMH_BPF
+	struct rxburst		*b = &g_worker->burst;
+
+	if (b->count >= ECMH_RXBURST)
+	{
+		burst_run();
+	}
+
+	b->intn[b->count]	= intn;
+	b->iph[b->count]	= iph;
+	b->len[b->count]	= len;
+	b->count++;
+#else
+	struct flowentry	*flow;
+
+	/* The few streams that make up most of the traffic hit the cache */
+	flow = flow_slot(intn, iph);
+	if (!flow_hit(flow, intn, iph))
+	{
+		flow_resolve(intn, iph, flow);
+	}
+
+	if (flow->groupn)
+	{
+		l4_ipv6_replicate(intn, iph, len, flow->groupn, flow->oils);
 	}
+#endif
 }
 
 /*
@@ -1974,8 +2064,8 @@ static void l4_ipv6_icmpv6(struct intnode *intn, struct ip6_hdr *iph, const uint
 	uint16_t		csum;
 
 	/* Increase ICMP received statistics */
-	g_conf->stat_icmp_received++;
-	intn->stat_icmp_received++;
+	COUNTER_ADD(g_conf->counters, CNT_ICMP_RECEIVED, 1);
+	COUNTER_ADD(intn->info.counters, INT_CNT_ICMP_RECEIVED, 1);
 
 	/*
 	 * We are only interrested in these types
@@ -1993,7 +2083,7 @@ static void l4_ipv6_icmpv6(struct intnode *intn, struct ip6_hdr *iph, const uint
 		dolog(LOG_DEBUG, "Ignoring ICMPv6: %s (%u), %s (%u) received on %s\n",
 			icmpv6_type(icmpv6->icmp6_type), icmpv6->icmp6_type,
 			icmpv6_code(icmpv6->icmp6_type, icmpv6->icmp6_code), icmpv6->icmp6_code,
-			intn->name);
+			intn->info.name);
 		return;
 	}
 
@@ -2007,7 +2097,7 @@ static void l4_ipv6_icmpv6(struct intnode *intn, struct ip6_hdr *iph, const uint
 	if (icmpv6->icmp6_cksum != csum)
 	{
 		dolog(LOG_WARNING, "CORRUPT->DROP (%s): Received a ICMPv6 %s/%s (%u:%u) with wrong checksum (%x vs %x)\n",
-			intn->name,
+			intn->info.name,
 			icmpv6_type(icmpv6->icmp6_type),
 			icmpv6_code(icmpv6->icmp6_type, icmpv6->icmp6_code),
 			icmpv6->icmp6_type,
@@ -2019,7 +2109,7 @@ static void l4_ipv6_icmpv6(struct intnode *intn, struct ip6_hdr *iph, const uint
 	dolog(LOG_DEBUG, "Received ICMPv6: %s (%u), %s (%u) received on %s\n",
 		icmpv6_type(icmpv6->icmp6_type), icmpv6->icmp6_type,
 		icmpv6_code(icmpv6->icmp6_type, icmpv6->icmp6_code), icmpv6->icmp6_code,
-		intn->name);
+		intn->info.name);
 
 	if (icmpv6->icmp6_type == ICMP6_ECHO_REQUEST)
 	{
@@ -2040,7 +2130,7 @@ static void l4_ipv6_icmpv6(struct intnode *intn, struct ip6_hdr *iph, const uint
 
 		if (iph->ip6_hlim == 0)
 		{
-			g_conf->stat_hlim_exceeded++;
+			COUNTER_ADD(g_conf->counters, CNT_HLIM_EXCEEDED, 1);
 
 			/* Send a time_exceed_transit error */
 			icmp6_send(intn, &iph->ip6_src, ICMP6_ECHO_REPLY, ICMP6_TIME_EXCEED_TRANSIT, &icmpv6->icmp6_data32, plen-sizeof(*icmpv6)+sizeof(icmpv6->icmp6_data32));
@@ -2113,10 +2203,10 @@ static void l3_ipv6(struct intnode *intn, struct ip6_hdr *iph, const uint16_t le
 	}
 
 	/* Source should not be us (linklocal/global) */
-	if (	memcmp(&iph->ip6_src, &intn->linklocal, sizeof(iph->ip6_dst)) == 0 ||
-		memcmp(&iph->ip6_src, &intn->global, sizeof(iph->ip6_dst)) == 0)
+	if (	memcmp(&iph->ip6_src, &intn->info.linklocal, sizeof(iph->ip6_dst)) == 0 ||
+		memcmp(&iph->ip6_src, &intn->info.global, sizeof(iph->ip6_dst)) == 0)
 	{
-		dolog(LOG_DEBUG, "Skipping packet from own host on %s\n", intn->name);
+		dolog(LOG_DEBUG, "Skipping packet from own host on %s\n", intn->info.name);
 		return;
 	}
 
@@ -2144,7 +2234,7 @@ static void l3_ipv6(struct intnode *intn, struct ip6_hdr *iph, const uint16_t le
 		/* Check for corrupt packets */
 		if ((char *)ipe > (((char *)iph)+len))
 		{
-			dolog(LOG_WARNING, "CORRUPT->DROP (%s): Header chain beyond packet data\n", intn->name);
+			dolog(LOG_WARNING, "CORRUPT->DROP (%s): Header chain beyond packet data\n", intn->info.name);
 			return;
 		}
 	}
@@ -2152,6 +2242,9 @@ static void l3_ipv6(struct intnode *intn, struct ip6_hdr *iph, const uint16_t le
 	/* Check for ICMP */
 	if (ipe_type == IPPROTO_ICMPV6)
 	{
+		/* MLD is for the control context, workers only forward */
+		if (!IS_CONTROL()) return;
+
 		/* Take care of ICMPv6 */
 		l4_ipv6_icmpv6(intn, iph, len, (struct icmp6_hdr *)ipe, plen);
 		return;
@@ -2172,7 +2265,7 @@ static void l3_ipv6(struct intnode *intn, struct ip6_hdr *iph, const uint16_t le
 
 		if (iph->ip6_hlim == 0)
 		{
-			g_conf->stat_hlim_exceeded++;
+			COUNTER_ADD(g_conf->counters, CNT_HLIM_EXCEEDED, 1);
 		}
 		else
 		{
@@ -2205,13 +2298,6 @@ static void l2_ethtype(struct intnode *intn, const void *packet, const unsigned
 	}
 }
 
-#ifdef ECMH_BPF
-static void l2_eth(struct intnode *intn, struct ether_header *eth, const unsigned int len);
-static void l2_eth(struct intnode *intn, struct ether_header *eth, const unsigned int len)
-{
-	l2_ethtype(intn, ((uint8_t *)eth + sizeof(*eth)), len-sizeof(*eth), ntohs(eth->ether_type));
-}
-#endif
 
 static void init(void);
 static void init(void)
@@ -2223,6 +2309,17 @@ static void init(void)
 		exit(-1);
 	}
 
+	/* The pools the group state is allocated from */
+	pool_init(&g_conf->pool_int,		"interfaces",		sizeof(struct intnode));
+	pool_init(&g_conf->pool_group,		"groups",		sizeof(struct groupnode));
+	pool_init(&g_conf->pool_grpint,		"group interfaces",	sizeof(struct grpintnode));
+	pool_init(&g_conf->pool_subscr,		"subscriptions",	sizeof(struct subscrnode));
+	pool_init(&g_conf->pool_list,		"lists",		sizeof(struct list));
+	pool_init(&g_conf->pool_listnode,	"list nodes",		sizeof(struct listnode));
+#ifndef ECMH_BPF
+	pool_init(&g_conf->pool_route,		"kernel routes",	sizeof(struct mrtroute));
+#endif
+
 	/*
 	 * 32k of buffer should be enough
 	 * we can then have ~30 packets in
@@ -2231,10 +2328,38 @@ static void init(void)
 	g_conf->bufferlen		= (32*1024);
 
 #ifndef ECMH_BPF
-	/* Raw socket is not open yet */
-	g_conf->rawsocket		= -1;
+	/* Raw socket is not open yet, the main thread is the control */
+	g_conf->control.socket		= -1;
+	g_worker			= &g_conf->control;
+
+	/* Everything is done by the main thread unless asked otherwise */
+	g_conf->workers			= 0;
+	g_conf->fanout			= PACKET_FANOUT_HASH;
+
+	/* No event loop yet */
+	g_conf->epoll			= -1;
+	g_conf->timerfd			= -1;
+	g_conf->signalfd		= -1;
+
+	/* We forward ourselves unless asked otherwise */
+	g_conf->mroute			= false;
+	g_conf->mrtfd			= -1;
+	g_conf->tcbpf			= false;
+
+	/* Receive and send with the PACKET socket unless asked otherwise */
+	g_conf->io			= &io_packet;
+
+	/* Receive ring, only used when enabled */
+	g_conf->rxring			= false;
+	g_conf->rxring_blocks		= ECMH_RXRING_BLOCKS;
+	g_conf->rxring_blocksize	= ECMH_RXRING_BLOCKSIZE;
+
+	/* Only receive the groups we joined, if the kernel can */
+	g_conf->groupfilter		= true;
+	g_conf->groupfilter_size	= FILTER_GROUPS_MAX;
 #else
 	FD_ZERO(&g_conf->selectset);
+	g_conf->io			= &io_bpf;
 	g_conf->tunnelmode		= true;
 	g_conf->locals			= list_new();
 	g_conf->locals->del 		= (void(*)(void *))local_destroy;
@@ -2242,7 +2367,6 @@ static void init(void)
 
 	/* Initialize our configuration */
 	g_conf->maxgroups		= 42;		/* XXX: Todo: Not verified yet... */
-	g_conf->maxinterfaces		= 0;
 	g_conf->daemonize		= true;
 
 #ifdef ECMH_BPF
@@ -2252,20 +2376,45 @@ static void init(void)
 #endif
 
 	/* Initialize our list of groups */
-	g_conf->groups			= list_new();
+	g_conf->groups			= hash_new(offsetof(struct groupnode, mca), sizeof(struct in6_addr));
+	if (!g_conf->groups)
+	{
+		dolog(LOG_ERR, "Couldn't init() - no memory for group table\n");
+		exit(-1);
+	}
 	g_conf->groups->del		= (void(*)(void *))group_destroy;
 
-	/* Initialize our counters */
+	/* And the channels of the SSM groups, part of their OIL */
+	g_conf->channels		= hash_new(offsetof(struct oilsrc, src), 2 * sizeof(struct in6_addr));
+	if (!g_conf->channels)
+	{
+		dolog(LOG_ERR, "Couldn't init() - no memory for channel table\n");
+		exit(-1);
+	}
+
+	/* Start the clock */
+	timers_init(getmonotimes());
+
 	g_conf->stat_starttime		= gettimes();
-	g_conf->stat_packets_received	= 0;
-	g_conf->stat_packets_sent	= 0;
-	g_conf->stat_bytes_received	= 0;
-	g_conf->stat_bytes_sent		= 0;
-	g_conf->stat_icmp_received	= 0;
-	g_conf->stat_icmp_sent		= 0;
-	g_conf->stat_hlim_exceeded	= 0;
 }
 
+/* Send a report of all our groups to the upstream */
+static void report_upstream(void);
+static void report_upstream(void)
+{
+	struct intnode *intn;
+
+	if (g_conf->upstream)
+	{
+		intn = int_find(g_conf->upstream_id);
+		if (intn)
+		{
+			mld2_send_report(intn, NULL);
+		}
+	}
+}
+
+#ifdef ECMH_BPF
 static void sighup(int i);
 static void sighup(int i)
 {
@@ -2276,43 +2425,33 @@ static void sighup(int i)
 static void sigusr2(int i);
 static void sigusr2(int i)
 {
-	struct intnode *intn;
-
 	signal(i, SIG_IGN);
 
-	if (g_conf->upstream)
-	{
-		intn = int_find(g_conf->upstream_id);
-		if (intn)
-		{
-			mld2_send_report(intn, NULL);
-		}
-	}
+	report_upstream();
 
 	signal(i, &sigusr2);
 }
+#endif
 
 /* Dump the statistical information */
-static void sigusr1(int i);
-static void sigusr1(int i)
+static void stats_dump(void);
+static void stats_dump(void)
 {
 	struct intnode		*intn;
 	struct groupnode	*groupn;
-	struct listnode		*ln;
+	uint64_t		hi, i;
 	struct grpintnode	*grpintn;
 	struct listnode		*gn;
 	struct subscrnode	*subscrn;
 	struct listnode		*ssn;
-	uint64_t		time_tee;
+	uint64_t		time_tee, mono;
 	char			addr[INET6_ADDRSTRLEN];
-	unsigned int		subscriptions = 0, j, count;
+	unsigned int		subscriptions = 0, count;
 	unsigned int		uptime_s, uptime_m, uptime_h, uptime_d;
 
-	/* Ignore further signals */
-	signal(i, SIG_IGN);
-
 	/* Get the current time */
 	time_tee  = gettimes();
+	mono	  = getmonotimes();
 	uptime_s  = time_tee - g_conf->stat_starttime;
 	uptime_d  = uptime_s / (24*60*60);
 	uptime_s -= uptime_d *  24*60*60;
@@ -2331,32 +2470,32 @@ static void sigusr1(int i)
 	fprintf(g_conf->stat_file, "*** Subscription Information Dump\n");
 	fprintf(g_conf->stat_file, "\n");
 
-	LIST_LOOP(g_conf->groups, groupn, ln)
+	HASH_LOOP(g_conf->groups, groupn, hi)
 	{
 		inet_ntop(AF_INET6, &groupn->mca, addr, sizeof(addr));
 
 		fprintf(g_conf->stat_file, "Group : %s\n", addr);
-		fprintf(g_conf->stat_file, "\tBytes  : %" PRIu64 "\n", groupn->bytes);
-		fprintf(g_conf->stat_file, "\tPackets: %" PRIu64 "\n", groupn->packets);
+		fprintf(g_conf->stat_file, "\tBytes  : %" PRIu64 "\n", counter_get(groupn->counters, GROUP_CNT_BYTES));
+		fprintf(g_conf->stat_file, "\tPackets: %" PRIu64 "\n", counter_get(groupn->counters, GROUP_CNT_PACKETS));
 
-		LIST_LOOP(groupn->interfaces, grpintn, gn)
+		LIST_LOOP(&groupn->interfaces, grpintn, gn)
 		{
-			intn = int_find(grpintn->ifindex);
-			if (!intn)
+			intn = grpintn->interface;
+			if (intn->mtu == 0)
 			{
 				continue;
 			}
 
 			fprintf(g_conf->stat_file, "\tInterface: %s (%" PRIi64 ")\n",
-				intn->name, grpintn->subscriptions->count);
+				intn->info.name, grpintn->subscriptions.count);
 
-			LIST_LOOP(grpintn->subscriptions, subscrn, ssn)
+			LIST_LOOP(&grpintn->subscriptions, subscrn, ssn)
 			{
-				int d = time_tee - subscrn->refreshtime;
+				int d = mono - subscrn->refreshtime;
 
 				if (d < 0)
 				{
-					d = -i;
+					d = -d;
 				}
 
 				inet_ntop(AF_INET6, &subscrn->ipv6, addr, sizeof(addr));
@@ -2379,27 +2518,22 @@ static void sigusr1(int i)
 	fprintf(g_conf->stat_file, "*** Interface Dump\n");
 	fprintf(g_conf->stat_file, "\n");
 
-	for (count=0, j=0; j < g_conf->maxinterfaces; j++)
+	count = 0;
+	INT_LOOP(intn, i)
 	{
-		intn = &g_conf->ints[j];
-
-		if (intn->mtu == 0)
-		{
-			continue;
-		}
-
 		count++;
 
-		fprintf(g_conf->stat_file, "Interface: %s\n", intn->name);
+		fprintf(g_conf->stat_file, "Interface: %s\n", intn->info.name);
 		fprintf(g_conf->stat_file, "  Index number           : %" PRIu64 "\n", intn->ifindex);
 		fprintf(g_conf->stat_file, "  MTU                    : %" PRIu64 "\n", intn->mtu);
+		fprintf(g_conf->stat_file, "  Groups joined          : %" PRIi64 "\n", intn->info.groups.count);
 
 #ifdef ECMH_BPF
 		/* Tunnel has a master interface? */
 		if (intn->master)
 		{
 			inet_ntop(AF_INET, &intn->master->ipv4_local, addr, sizeof(addr));
-			fprintf(g_conf->stat_file, "  Master interface       : %s (%" PRIu64 "/%s)\n", intn->master->name, intn->master->ifindex, addr);
+			fprintf(g_conf->stat_file, "  Master interface       : %s (%" PRIu64 "/%s)\n", intn->master->info.name, intn->master->ifindex, addr);
 			inet_ntop(AF_INET, &intn->ipv4_remote, addr, sizeof(addr));
 			fprintf(g_conf->stat_file, "  IPv4 Remote            : %s\n", addr);
 		}
@@ -2407,33 +2541,33 @@ static void sigusr1(int i)
 
 		fprintf(g_conf->stat_file, "  Interface Type         : %s (%" PRIu64 ")\n",
 #ifndef ECMH_BPF
-			(intn->hwaddr.sa_family == ARPHRD_ETHER ? "Ethernet" : 
-			 (intn->hwaddr.sa_family == ARPHRD_SIT ? "sit" : "Unknown")),
-			(uint64_t)intn->hwaddr.sa_family
+			(intn->info.hwaddr.sa_family == ARPHRD_ETHER ? "Ethernet" : 
+			 (intn->info.hwaddr.sa_family == ARPHRD_SIT ? "sit" : "Unknown")),
+			(uint64_t)intn->info.hwaddr.sa_family
 #else
-			(intn->dlt == DLT_NULL ? "Null":
-			 (intn->dlt == DLT_EN10MB ? "Ethernet" : "Unknown")),
-			intn->dlt
+			(intn->info.dlt == DLT_NULL ? "Null":
+			 (intn->info.dlt == DLT_EN10MB ? "Ethernet" : "Unknown")),
+			intn->info.dlt
 #endif
 		);
 
-		inet_ntop(AF_INET6, &intn->linklocal, addr, sizeof(addr));
+		inet_ntop(AF_INET6, &intn->info.linklocal, addr, sizeof(addr));
 		fprintf(g_conf->stat_file, "  Link-local address     : %s\n", addr);
 
-		inet_ntop(AF_INET6, &intn->global, addr, sizeof(addr));
+		inet_ntop(AF_INET6, &intn->info.global, addr, sizeof(addr));
 		fprintf(g_conf->stat_file, "  Global unicast address : %s\n", addr);
 
-		if (intn->mld_version == 0)
+		if (intn->info.mld_version == 0)
 		fprintf(g_conf->stat_file, "  MLD version            : none\n");
 		else
-		fprintf(g_conf->stat_file, "  MLD version            : v%" PRIu64 "\n", intn->mld_version);
-
-		fprintf(g_conf->stat_file, "  Packets received       : %" PRIu64 "\n", intn->stat_packets_received);
-		fprintf(g_conf->stat_file, "  Packets sent           : %" PRIu64 "\n", intn->stat_packets_sent);
-		fprintf(g_conf->stat_file, "  Bytes received         : %" PRIu64 "\n", intn->stat_bytes_received);
-		fprintf(g_conf->stat_file, "  Bytes sent             : %" PRIu64 "\n", intn->stat_bytes_sent);
-		fprintf(g_conf->stat_file, "  ICMP's received        : %" PRIu64 "\n", intn->stat_icmp_received);
-		fprintf(g_conf->stat_file, "  ICMP's sent            : %" PRIu64 "\n", intn->stat_icmp_sent);
+		fprintf(g_conf->stat_file, "  MLD version            : v%" PRIu64 "\n", intn->info.mld_version);
+
+		fprintf(g_conf->stat_file, "  Packets received       : %" PRIu64 "\n", counter_get(intn->info.counters, INT_CNT_PACKETS_RECEIVED));
+		fprintf(g_conf->stat_file, "  Packets sent           : %" PRIu64 "\n", counter_get(intn->info.counters, INT_CNT_PACKETS_SENT));
+		fprintf(g_conf->stat_file, "  Bytes received         : %" PRIu64 "\n", counter_get(intn->info.counters, INT_CNT_BYTES_RECEIVED));
+		fprintf(g_conf->stat_file, "  Bytes sent             : %" PRIu64 "\n", counter_get(intn->info.counters, INT_CNT_BYTES_SENT));
+		fprintf(g_conf->stat_file, "  ICMP's received        : %" PRIu64 "\n", counter_get(intn->info.counters, INT_CNT_ICMP_RECEIVED));
+		fprintf(g_conf->stat_file, "  ICMP's sent            : %" PRIu64 "\n", counter_get(intn->info.counters, INT_CNT_ICMP_SENT));
 		fprintf(g_conf->stat_file, "\n");
 	}
 
@@ -2449,26 +2583,47 @@ static void sigusr1(int i)
 	fprintf(g_conf->stat_file, "Git Hash             : %s\n", ECMH_GITHASH);
 	fprintf(g_conf->stat_file, "Started              : %s GMT\n", addr);
 	fprintf(g_conf->stat_file, "Uptime               : %u days %02u:%02u:%02u\n", uptime_d, uptime_h, uptime_m, uptime_s);
+	fprintf(g_conf->stat_file, "\n");
+	fprintf(g_conf->stat_file, "I/O backend          : %s\n", g_conf->io->name);
+	if (g_conf->io->stats) g_conf->io->stats(g_conf->stat_file);
 #ifdef ECMH_BPF
 	fprintf(g_conf->stat_file, "\n");
 	fprintf(g_conf->stat_file, "Tunnelmode           : %s\n", g_conf->tunnelmode ? "Active" : "Disabled");
+#else
+	fprintf(g_conf->stat_file, "\n");
+	fprintf(g_conf->stat_file, "Group filter         : %s (holds %" PRIu64 " groups)\n",
+		!g_conf->groupfilter ? "Disabled" : (filter_groups_full() ? "Full, passing all multicast" : "Active"),
+		g_conf->groupfilter_size);
+	fprintf(g_conf->stat_file, "Workers              : %" PRIu64 "\n", g_conf->workers);
 #endif /* ECMH_BPF */
 	fprintf(g_conf->stat_file, "\n");
 	fprintf(g_conf->stat_file, "Interfaces Monitored : %u\n", count);
 	fprintf(g_conf->stat_file, "Groups Managed       : %" PRIi64 "\n", g_conf->groups->count);
+	fprintf(g_conf->stat_file, "SSM Channels         : %" PRIi64 "\n", g_conf->channels->count);
 	fprintf(g_conf->stat_file, "Total Subscriptions  : %u\n", subscriptions);
 #ifdef ECMH_SUPPORT_MLD2
 	fprintf(g_conf->stat_file, "v2 Robustness Factor : %u\n", ECMH_ROBUSTNESS_FACTOR);
 #endif
 	fprintf(g_conf->stat_file, "Subscription Timeout : %u\n", ECMH_SUBSCRIPTION_TIMEOUT * ECMH_ROBUSTNESS_FACTOR);
+	fprintf(g_conf->stat_file, "Timers Pending       : %" PRIu64 "\n", timers_pending());
+	fprintf(g_conf->stat_file, "\n");
+	pool_dump(&g_conf->pool_int, g_conf->stat_file);
+	pool_dump(&g_conf->pool_group, g_conf->stat_file);
+	pool_dump(&g_conf->pool_grpint, g_conf->stat_file);
+	pool_dump(&g_conf->pool_subscr, g_conf->stat_file);
+	pool_dump(&g_conf->pool_list, g_conf->stat_file);
+	pool_dump(&g_conf->pool_listnode, g_conf->stat_file);
+#ifndef ECMH_BPF
+	if (g_conf->mroute) pool_dump(&g_conf->pool_route, g_conf->stat_file);
+#endif
 	fprintf(g_conf->stat_file, "\n");
-	fprintf(g_conf->stat_file, "Packets Received     : %" PRIu64 "\n", g_conf->stat_packets_received);
-	fprintf(g_conf->stat_file, "Packets Sent         : %" PRIu64 "\n", g_conf->stat_packets_sent);
-	fprintf(g_conf->stat_file, "Bytes Received       : %" PRIu64 "\n", g_conf->stat_bytes_received);
-	fprintf(g_conf->stat_file, "Bytes Sent           : %" PRIu64 "\n", g_conf->stat_bytes_sent);
-	fprintf(g_conf->stat_file, "ICMP's received      : %" PRIu64 "\n", g_conf->stat_icmp_received);
-	fprintf(g_conf->stat_file, "ICMP's sent          : %" PRIu64 "\n", g_conf->stat_icmp_sent);
-	fprintf(g_conf->stat_file, "Hop Limit Exceeded   : %" PRIu64 "\n", g_conf->stat_hlim_exceeded);
+	fprintf(g_conf->stat_file, "Packets Received     : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_PACKETS_RECEIVED));
+	fprintf(g_conf->stat_file, "Packets Sent         : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_PACKETS_SENT));
+	fprintf(g_conf->stat_file, "Bytes Received       : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_BYTES_RECEIVED));
+	fprintf(g_conf->stat_file, "Bytes Sent           : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_BYTES_SENT));
+	fprintf(g_conf->stat_file, "ICMP's received      : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_ICMP_RECEIVED));
+	fprintf(g_conf->stat_file, "ICMP's sent          : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_ICMP_SENT));
+	fprintf(g_conf->stat_file, "Hop Limit Exceeded   : %" PRIu64 "\n", counter_get(g_conf->counters, CNT_HLIM_EXCEEDED));
 	fprintf(g_conf->stat_file, "\n");
 	fprintf(g_conf->stat_file, "*** Statistics Dump (end)\n");
 
@@ -2476,10 +2631,21 @@ static void sigusr1(int i)
 	fflush(g_conf->stat_file);
 
 	dolog(LOG_INFO, "Dumped statistics into %s\n", ECMH_DUMPFILE);
+}
+
+#ifdef ECMH_BPF
+static void sigusr1(int i);
+static void sigusr1(int i)
+{
+	/* Ignore further signals */
+	signal(i, SIG_IGN);
+
+	stats_dump();
 
 	/* Reset the signal */
 	signal(i, &sigusr1);
 }
+#endif
 
 /* Let's tell everybody we are a querier and ask */
 /* them which groups they want to receive. */
@@ -2488,7 +2654,7 @@ static void send_mld_querys(void)
 {
 	struct intnode		*intn;
 	struct in6_addr		any;
-	unsigned int		i;
+	uint64_t		i;
 
 	dolog(LOG_DEBUG, "Sending MLD Queries\n");
 
@@ -2496,250 +2662,497 @@ static void send_mld_querys(void)
 	memzero(&any, sizeof(any));
 
 	/* Send MLD query's */
-	/* Use listloop2 as the node can disappear in sendpacket() */
-	for (i=0; i < g_conf->maxinterfaces; i++)
+	/* The interface can disappear in sendpacket(), INT_LOOP copes */
+	INT_LOOP(intn, i)
 	{
-		intn = &g_conf->ints[i];
-
-		if (intn->mtu == 0)
-		{
-			continue;
-		}
-
 		mld_send_query(intn, &any, NULL, false);
 	}
 
 	dolog(LOG_DEBUG, "Sending MLD Queries - done\n");
 }
 
-static void timeout_signal(int i);
-static void timeout_signal(int i)
+static void timeout(void *data);
+static void timeout(void *data)
 {
-	/*
-	 * Mark it to be ignored, this avoids double timeouts
-	 * one never knows if it takes too long to handle
-	 * the first one.
-	 */
-	signal(i, SIG_IGN);
-	
-	/* Set the needs_timeout */
-	g_needs_timeout = true;
-}
-
-static void timeout(void);
-static void timeout(void)
-{
-	struct groupnode	*groupn;
-	struct listnode		*ln, *ln2;
-	struct grpintnode	*grpintn;
-	struct listnode		*gn, *gn2;
-	struct subscrnode	*subscrn;
-	struct listnode		*ssn, *ssn2;
-	uint64_t		time_tee;
-	int64_t			i;
-
 	dolog(LOG_DEBUG, "Timeout\n");
 
 	/* Update the complete interfaces list */
 	update_interfaces(NULL);
 
-	/* Get the current time */
-	time_tee = gettimes();
-
-	/* Timeout all the groups that didn't refresh yet */
-	LIST_LOOP2(g_conf->groups, groupn, ln, ln2)
-	{
-		printf("Groups\n");
-
-		LIST_LOOP2(groupn->interfaces, grpintn, gn, gn2)
-		{
-			printf("Group Interfaces\n");
-
-			LIST_LOOP2(grpintn->subscriptions, subscrn, ssn, ssn2)
-			{
-				/* Calculate the difference */
-				i = time_tee - subscrn->refreshtime;
-
-				if (i < 0)
-				{
-					i = -i;
-				}
-
-				/* Dead too long? */
-				if (i > (ECMH_SUBSCRIPTION_TIMEOUT * ECMH_ROBUSTNESS_FACTOR))
-				{
-					/* Dead too long -> delete it */
-					list_delete_node(grpintn->subscriptions, ssn);
-					/* Destroy the subscription itself */
-					subscr_destroy(subscrn);
-				}
-			}
-			LIST_LOOP2_END
-
-#ifndef ECMH_SUPPORT_MLD2
-			if (grpintn->subscriptions->count == 0)
-#else
-			if (grpintn->subscriptions->count <= (-ECMH_ROBUSTNESS_FACTOR))
-#endif
-			{
-				/* Delete from the list */
-				list_delete_node(groupn->interfaces, gn);
-				/* Destroy the grpint */
-				grpint_destroy(grpintn);
-			}
-		}
-		LIST_LOOP2_END
-
-		if (groupn->interfaces->count == 0)
-		{
-			/* Delete from the list */
-			list_delete_node(g_conf->groups, ln);
-
-			/* Destroy the group */
-			group_destroy(groupn);
-		}
-	}
-	LIST_LOOP2_END
+	/*
+	 * Subscriptions and groups that didn't refresh
+	 * are expired by their own timers
+	 */
 
 	/* Send out MLD queries */
 	send_mld_querys();
 
+	/* Again in a while */
+	timer_set((struct timer *)data, getmonotimes() + ECMH_SUBSCRIPTION_TIMEOUT);
+
 	dolog(LOG_DEBUG, "Timeout - done\n");
 }
 
-static bool handleinterfaces(void *buffer);
-static bool handleinterfaces(void *buffer)
+/*
+ * The tables (groups, interfaces) are only changed by the control
+ * context, which takes the lock for writing, while the workers
+ * take it for reading. Without workers there is nothing to lock.
+ */
+static void table_lock(void);
+static void table_lock(void)
 {
-	int			i = 0, len;
-	struct intnode		*intn = NULL;
-
 #ifndef ECMH_BPF
-	struct sockaddr_ll	sa;
-	socklen_t		salen;
+	if (!g_conf->workers) return;
 
-	salen = sizeof(sa);
-	memzero(&sa, sizeof(sa));
-	len = recvfrom(g_conf->rawsocket, buffer, g_conf->bufferlen, 0, (struct sockaddr *)&sa, &salen);
+	if (IS_CONTROL())	pthread_rwlock_wrlock(&g_conf->lock);
+	else			pthread_rwlock_rdlock(&g_conf->lock);
+#endif
+}
 
-	if (len == -1)
-	{
-		dolog(LOG_ERR, "Couldn't Read from RAW Socket\n");
-		return false;
-	}
+static void table_unlock(void);
+static void table_unlock(void)
+{
+#ifndef ECMH_BPF
+	if (!g_conf->workers) return;
 
-	/*
-	 * Ignore:
-	 * - loopback traffic
-	 * - any packets that originate from this host
-	 */
-	if (	sa.sll_hatype == ARPHRD_LOOPBACK ||
-		sa.sll_pkttype == PACKET_OUTGOING)
-	{
-		return true;
-	}
+	pthread_rwlock_unlock(&g_conf->lock);
+#endif
+}
+
+/*
+ * Handle a packet the backend received
+ * Interfaces the PACKET socket sees for the first
+ * time are created by the control context.
+ */
+static void handlepacket(struct iopacket *pkt);
+static void handlepacket(struct iopacket *pkt)
+{
+	struct intnode		*intn = pkt->intn;
 
 	/* Update statistics */
-	g_conf->stat_packets_received++;
-	g_conf->stat_bytes_received+=len;
+	COUNTER_ADD(g_conf->counters, CNT_PACKETS_RECEIVED, 1);
+	COUNTER_ADD(g_conf->counters, CNT_BYTES_RECEIVED, pkt->len);
 
 	/* The interface we need to find */
-	i = sa.sll_ifindex;
-
-	intn = int_find(i);
 	if (!intn)
+	{
+		intn = int_find(pkt->ifindex);
+	}
+
+#ifndef ECMH_BPF
+	/* Only the control context discovers interfaces */
+	if (!intn && IS_CONTROL())
 	{
 		/* Create a new interface */
-		intn = int_create(i);
+		intn = int_create(pkt->ifindex);
 		if (intn)
 		{
 			/* Determine linklocal address etc. */
 			update_interfaces(intn);
 		}
 	}
+#endif
 
 	if (intn)
 	{
-		intn->stat_packets_received++;
-		intn->stat_bytes_received+=len;
+		COUNTER_ADD(intn->info.counters, INT_CNT_PACKETS_RECEIVED, 1);
+		COUNTER_ADD(intn->info.counters, INT_CNT_BYTES_RECEIVED, pkt->len);
 
 		/* Handle the packet */
-		l2_ethtype(intn, buffer, len, ntohs(sa.sll_protocol));
+		l2_ethtype(intn, pkt->packet, pkt->len, pkt->ether_type);
 	}
-	else
+	else if (IS_CONTROL())
 	{
-		dolog(LOG_ERR, "Couldn't find interface link %u\n", i);
+		dolog(LOG_ERR, "Couldn't find interface link %u\n", pkt->ifindex);
 	}
+}
 
-	return true;
-#else /* !ECMH_BPF */
-	void			*bp, *ep, *rbuffer = buffer;
-	struct bpf_hdr		*bhp;
-	fd_set			fd_read;
-	struct timeval		timeout;
-
-	/* What we want to know */
-	memcpy(&fd_read, &g_conf->selectset, sizeof(fd_read));
+/*
+ * Receive and handle a burst in the context of the running
+ * thread, fd is the readable descriptor, -1 when the backend
+ * waited itself. Returns 1 when something was handled, 0 when
+ * there was nothing to receive and -1 on a fatal error.
+ */
+static int handlereceive(int fd);
+static int handlereceive(int fd)
+{
+	struct iopacket		pkts[ECMH_RXBURST];
+	int			i, n;
 
-	memzero(&timeout, sizeof(timeout));
-	timeout.tv_sec = 5;
+	n = g_conf->io->receive(fd, pkts, ECMH_RXBURST);
 
-	i = select(g_conf->hifd+1, &fd_read, NULL, NULL, &timeout);
-	if (i < 0)
+	if (n > 0)
 	{
-		if (errno == EINTR)
+		table_lock();
+
+		for (i = 0; i < n; i++)
 		{
-			return true;
+			handlepacket(&pkts[i]);
 		}
 
-		dolog(LOG_ERR, "Select failed\n");
-		return false;
+#ifndef ECMH_BPF
+		/* Forward what was collected, it still points into the backend's buffers */
+		burst_run();
+		sendpacket6_flush();
+#endif
+
+		table_unlock();
 	}
 
-	if (i == 0)
+	/* Also releases what was skipped */
+	if (n >= 0 && g_conf->io->release)
 	{
-		return true;
+		g_conf->io->release();
 	}
 
-	for (i = 0; ((uint64_t)i) < g_conf->maxinterfaces; i++)
+	return n > 0 ? 1 : n;
+}
+
+#ifndef ECMH_BPF
+/* The main loop of a forwarding worker */
+static void *worker_run(void *arg);
+static void *worker_run(void *arg)
+{
+	struct pollfd	pfd[2];
+	int		ret = 0;
+
+	g_worker	= (struct worker *)arg;
+
+	/* The control is the first counter context and flow cache */
+	counters_context(1 + (g_worker - g_conf->worker));
+	g_flows = &g_conf->flows[(1 + (g_worker - g_conf->worker)) * ECMH_FLOWCACHE];
+
+	/* Our socket and the eventfd that tells us to quit */
+	memzero(pfd, sizeof(pfd));
+	pfd[0].fd	= g_worker->socket;
+	pfd[0].events	= POLLIN | POLLERR;
+	pfd[1].fd	= g_conf->wakefd;
+	pfd[1].events	= POLLIN;
+
+	while (!g_conf->quit && ret >= 0)
 	{
-		intn = &g_conf->ints[i];
-		if (intn->mtu == 0)
+		ret = handlereceive(g_worker->socket);
+
+		/* Nothing there, wait for it */
+		if (ret == 0 && poll(pfd, 2, -1) < 0 && errno != EINTR)
 		{
-			continue;
+			dolog(LOG_ERR, "Couldn't poll the RAW Socket\n");
+			ret = -1;
 		}
+	}
+
+	return NULL;
+}
+
+/* Setup the forwarding workers, their threads are started later */
+static bool workers_init(void);
+static bool workers_init(void)
+{
+	pthread_rwlockattr_t	attr;
+	uint64_t		i;
+
+	/* Don't let MLD processing be starved by the forwarding */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&g_conf->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	g_conf->wakefd = eventfd(0, EFD_CLOEXEC);
+	if (g_conf->wakefd == -1)
+	{
+		dolog(LOG_ERR, "Couldn't create eventfd for the workers: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
 
-		if (	intn->socket == -1 ||
-			!FD_ISSET(intn->socket, &fd_read))
+	g_conf->worker = calloc(g_conf->workers, sizeof(*g_conf->worker));
+	if (!g_conf->worker)
+	{
+		dolog(LOG_ERR, "Couldn't allocate memory for the workers\n");
+		return false;
+	}
+
+	for (i = 0; i < g_conf->workers; i++)
+	{
+		g_conf->worker[i].socket = -1;
+	}
+
+	/* They receive and send with the PACKET backend, each on it's own socket */
+	for (i = 0; i < g_conf->workers; i++)
+	{
+		if (!packet_open(&g_conf->worker[i])) return false;
+	}
+
+	dolog(LOG_INFO, "Forwarding with %" PRIu64 " workers (%s fanout)\n",
+		g_conf->workers, g_conf->fanout == PACKET_FANOUT_CPU ? "cpu" : "hash");
+
+	return true;
+}
+
+/* Start the worker threads, they leave the signals to the main thread */
+static bool workers_start(void);
+static bool workers_start(void)
+{
+	sigset_t	all, old;
+	uint64_t	i;
+	bool		ret = true;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < g_conf->workers; i++)
+	{
+		if (pthread_create(&g_conf->worker[i].thread, NULL, worker_run, &g_conf->worker[i]) != 0)
 		{
-			continue;
+			dolog(LOG_ERR, "Couldn't start worker %" PRIu64 "\n", i);
+			g_conf->workers = i;
+			ret = false;
+			break;
 		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return ret;
+}
+
+/* Stop the workers, g_conf->quit has to be set already */
+static void workers_stop(void);
+static void workers_stop(void)
+{
+	uint64_t	i, one = 1;
+
+	if (!g_conf->worker) return;
+
+	/* Wake them up, the eventfd stays readable */
+	if (write(g_conf->wakefd, &one, sizeof(one)) != sizeof(one))
+	{
+		dolog(LOG_WARNING, "Couldn't wake up the workers\n");
+	}
+
+	for (i = 0; i < g_conf->workers; i++)
+	{
+		pthread_join(g_conf->worker[i].thread, NULL);
+	}
+
+	/* Their counters stay around for the last statistics dump */
+	for (i = 0; i < g_conf->workers; i++)
+	{
+		packet_close(&g_conf->worker[i]);
+	}
+
+	free(g_conf->worker);
+	g_conf->worker = NULL;
+	g_conf->workers = 0;
+
+	close(g_conf->wakefd);
+	pthread_rwlock_destroy(&g_conf->lock);
+}
+
+/* The signals the main thread handles through its signalfd */
+static void events_sigset(sigset_t *set);
+static void events_sigset(sigset_t *set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGHUP);
+	sigaddset(set, SIGTERM);
+	sigaddset(set, SIGINT);
+	sigaddset(set, SIGUSR1);
+	sigaddset(set, SIGUSR2);
+}
+
+static bool events_add(int fd);
+static bool events_add(int fd)
+{
+	struct epoll_event	ev;
+
+	memzero(&ev, sizeof(ev));
+	ev.events	= EPOLLIN;
+	ev.data.fd	= fd;
 
-		len = read(intn->socket, rbuffer, intn->bufferlen);
-		if (len < 0)
+	if (epoll_ctl(g_conf->epoll, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+		dolog(LOG_ERR, "Couldn't add fd %d to epoll: %s (%d)\n", fd, strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Setup the event loop of the main thread: the control socket,
+ * a timerfd for the subscription timeout and the queries and
+ * a signalfd, the signals are blocked early on in main().
+ */
+static bool events_init(void);
+static bool events_init(void)
+{
+	struct itimerspec	its;
+	sigset_t		set;
+
+	g_conf->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (g_conf->epoll == -1)
+	{
+		dolog(LOG_ERR, "Couldn't create epoll: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	g_conf->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (g_conf->timerfd == -1)
+	{
+		dolog(LOG_ERR, "Couldn't create timerfd: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	memzero(&its, sizeof(its));
+	its.it_value.tv_sec	= 1;
+	its.it_interval.tv_sec	= 1;
+	if (timerfd_settime(g_conf->timerfd, 0, &its, NULL) == -1)
+	{
+		dolog(LOG_ERR, "Couldn't arm timerfd: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	events_sigset(&set);
+	g_conf->signalfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (g_conf->signalfd == -1)
+	{
+		dolog(LOG_ERR, "Couldn't create signalfd: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	/* A backend that waits itself reads the PACKET socket itself */
+	return	(g_conf->io->wait || events_add(g_conf->control.socket)) &&
+		events_add(g_conf->timerfd) &&
+		events_add(g_conf->signalfd) &&
+		(g_conf->mrtfd == -1 || events_add(g_conf->mrtfd));
+}
+
+static void events_cleanup(void);
+static void events_cleanup(void)
+{
+	if (g_conf->signalfd != -1) close(g_conf->signalfd);
+	if (g_conf->timerfd != -1) close(g_conf->timerfd);
+	if (g_conf->epoll != -1) close(g_conf->epoll);
+}
+
+/* Handle the signals that came in */
+static void events_signals(void);
+static void events_signals(void)
+{
+	struct signalfd_siginfo	si;
+
+	while (read(g_conf->signalfd, &si, sizeof(si)) == sizeof(si))
+	{
+		switch (si.ssi_signo)
 		{
-			dolog(LOG_ERR, "Couldn't read from BPF device: %s (%d)\n", strerror(errno), errno);
-			return false;
+		case SIGTERM:
+		case SIGINT:
+			cleanpid(si.ssi_signo);
+			break;
+
+		case SIGUSR1:
+			stats_dump();
+			break;
+
+		case SIGUSR2:
+			table_lock();
+			report_upstream();
+			table_unlock();
+			break;
+
+		default:
+			/* SIGHUP: Nothing to reload (yet) */
+			break;
 		}
+	}
+}
 
-		bp = buffer = rbuffer;
-		bhp = (struct bpf_hdr *)bp;
+/* Wait (timeout in milliseconds, -1 forever) for and handle the next events of the main thread */
+static bool handleevents(int timeout);
+static bool handleevents(int timeout)
+{
+	struct epoll_event	ev[4];
+	uint64_t		expired;
+	int			i, j, n, ret;
 
-		for (	ep = ((uint8_t *)bp) + bhp->bh_caplen;
-			bp < ep;
-			bp = ((uint8_t *)bp) + BPF_WORDALIGN(bhp->bh_caplen + bhp->bh_hdrlen))
+	n = epoll_wait(g_conf->epoll, ev, 4, timeout);
+	if (n == -1)
+	{
+		if (errno == EINTR)
 		{
-		 	bhp = (struct bpf_hdr *)bp;
-		  	buffer = ((uint8_t *)bp) + bhp->bh_hdrlen;
+			return true;
+		}
 
-			intn->stat_packets_received++;
-			intn->stat_bytes_received += bhp->bh_caplen;
+		dolog(LOG_ERR, "Couldn't wait for events: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
 
-			/* Layer 2 packet */
-			l2_eth(intn, buffer, bhp->bh_caplen);
+	for (i = 0; i < n; i++)
+	{
+		if (ev[i].data.fd == g_conf->timerfd)
+		{
+			if (read(g_conf->timerfd, &expired, sizeof(expired)) == sizeof(expired))
+			{
+				table_lock();
+				timers_run(getmonotimes());
+				table_unlock();
+			}
 		}
-	} /* Interfaces */
+		else if (ev[i].data.fd == g_conf->signalfd)
+		{
+			events_signals();
+		}
+		else if (ev[i].data.fd == g_conf->mrtfd)
+		{
+			table_lock();
+			mrt_upcalls();
+			table_unlock();
+		}
+		else
+		{
+			/* The PACKET socket or another socket of the backend */
+			for (j = 0; j < ECMH_EVENT_BUDGET; j++)
+			{
+				ret = handlereceive(ev[i].data.fd);
+				if (ret < 0) return false;
+				if (ret == 0) break;
+			}
+		}
+	}
+
+	return true;
+}
+
 #endif /* !ECMH_BPF */
 
+/*
+ * Wait with a backend that does that itself and handle what it
+ * received, the epoll set is looked at without waiting when it
+ * has something.
+ */
+static bool handlewait(void);
+static bool handlewait(void)
+{
+	unsigned int	j;
+	int		ret;
+
+	if (!g_conf->io->wait()) return false;
+
+	/* Limited, so a busy link does not delay the timers */
+	for (j = 0; j < ECMH_EVENT_BUDGET; j++)
+	{
+		ret = handlereceive(-1);
+		if (ret < 0) return false;
+		if (ret == 0) break;
+	}
+
+#ifndef ECMH_BPF
+	if (g_conf->io->ready && g_conf->io->ready())
+	{
+		return handleevents(0);
+	}
+#endif
+
 	return true;
 }
 
@@ -2747,6 +3160,7 @@ static bool handleinterfaces(void *buffer)
 static struct option const long_options[] = {
 	{"foreground",		no_argument,		NULL, 'f'},
 	{"upstream",		required_argument,	NULL, 'i'},
+	{"io",			required_argument,	NULL, 'I'},
 	{"promisc",		no_argument,		NULL, 'p'},
 	{"nopromisc",		no_argument,		NULL, 'P'},
 	{"user",		required_argument,	NULL, 'u'},
@@ -2754,6 +3168,19 @@ static struct option const long_options[] = {
 	{"notunnelmode",	no_argument,		NULL, 'T'},
 	{"verbose",		no_argument,		NULL, 'v'},
 	{"version",		no_argument,		NULL, 'V'},
+#ifndef ECMH_BPF
+	{"rxring",		no_argument,		NULL, 'r'},
+	{"nogroupfilter",	no_argument,		NULL, 'G'},
+	{"groupfilter-size",	required_argument,	NULL, 'g'},
+	{"rxring-blocks",	required_argument,	NULL, 'b'},
+	{"rxring-blocksize",	required_argument,	NULL, 'B'},
+	{"workers",		required_argument,	NULL, 'w'},
+	{"fanout",		required_argument,	NULL, 'F'},
+	{"mroute",		no_argument,		NULL, 'm'},
+	{"tcbpf",		no_argument,		NULL, 'c'},
+	{"xdp",			no_argument,		NULL, 'x'},
+	{"uring",		no_argument,		NULL, 'U'},
+#endif
 #ifdef ECMH_SUPPORT_MLD2
 	{"mld1only",		no_argument,		NULL, '1'},
 	{"mld2only",		no_argument,		NULL, '2'},
@@ -2764,22 +3191,29 @@ static struct option const long_options[] = {
 int main(int argc, char *argv[])
 {
 	int			i, drop_uid = 0, drop_gid = 0, option_index = 0;
-	unsigned int		j;
+	uint64_t		j;
 	struct passwd		*passwd;
-	bool			quit = false;
+	bool			quit = false, opened;
 	struct intnode		*intn;
+	void			*mem;
 #ifdef _LINUX
 	struct sched_param	schedparam;
 #endif
+#ifndef ECMH_BPF
+	sigset_t		sigset;
+#endif
 
 	init();
 
 	/* Handle arguments */
-	while ((i = getopt_long(argc, argv, "fi:pPu:"
+	while ((i = getopt_long(argc, argv, "fi:I:pPu:"
 #ifdef ECMH_BPF
 		"tT"
 #endif
 		"vV"
+#ifndef ECMH_BPF
+		"rb:B:Gg:w:F:mcxU"
+#endif
 #ifdef ECMH_SUPPORT_MLD2
 		"12"
 #endif
@@ -2804,6 +3238,15 @@ int main(int argc, char *argv[])
 
 			g_conf->upstream = strdup(optarg);
 			break;
+
+		case 'I':
+			g_conf->io = io_find(optarg);
+			if (!g_conf->io)
+			{
+				fprintf(stderr, "Unknown I/O backend %s\n", optarg);
+				return -1;
+			}
+			break;
 			
 		case 'p':
 			g_conf->promisc = true;
@@ -2842,6 +3285,85 @@ int main(int argc, char *argv[])
 			printf(ECMH_VERSION_STRING, ECMH_VERSION, ECMH_GITHASH);
 			return 0;
 
+#ifndef ECMH_BPF
+		case 'r':
+			g_conf->rxring = true;
+			break;
+
+		case 'G':
+			g_conf->groupfilter = false;
+			break;
+
+		case 'g':
+			g_conf->groupfilter_size = strtoul(optarg, NULL, 10);
+			if (g_conf->groupfilter_size == 0 || g_conf->groupfilter_size > UINT32_MAX)
+			{
+				fprintf(stderr, "Invalid group filter size %s\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'b':
+			g_conf->rxring_blocks = strtoul(optarg, NULL, 10);
+			if (g_conf->rxring_blocks == 0)
+			{
+				fprintf(stderr, "Invalid number of receive ring blocks %s\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'B':
+			g_conf->rxring_blocksize = strtoul(optarg, NULL, 10);
+			if (	g_conf->rxring_blocksize < ECMH_RXRING_FRAMESIZE ||
+				(g_conf->rxring_blocksize % getpagesize()) != 0)
+			{
+				fprintf(stderr, "Receive ring blocksize %s is not a multiple of the pagesize (%u)\n", optarg, getpagesize());
+				return -1;
+			}
+			break;
+
+		case 'w':
+			g_conf->workers = strtoul(optarg, NULL, 10);
+			if (g_conf->workers == 0 || g_conf->workers > ECMH_WORKERS_MAX)
+			{
+				fprintf(stderr, "Number of workers %s should be between 1 and %u\n", optarg, ECMH_WORKERS_MAX);
+				return -1;
+			}
+			break;
+
+		case 'F':
+			if (strcmp(optarg, "hash") == 0)
+			{
+				g_conf->fanout = PACKET_FANOUT_HASH;
+			}
+			else if (strcmp(optarg, "cpu") == 0)
+			{
+				g_conf->fanout = PACKET_FANOUT_CPU;
+			}
+			else
+			{
+				fprintf(stderr, "Unknown fanout mode %s, use hash or cpu\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'm':
+			g_conf->mroute = true;
+			break;
+
+		case 'c':
+			g_conf->tcbpf = true;
+			break;
+
+		case 'x':
+			g_conf->io = &io_afxdp;
+			break;
+
+		case 'U':
+			g_conf->io = &io_uring;
+			break;
+#endif
+
 #ifdef ECMH_SUPPORT_MLD2
 		case '1':
 			g_conf->mld1only = true;
@@ -2855,7 +3377,7 @@ int main(int argc, char *argv[])
 #endif
 		default:
 			fprintf(stderr,
-				"%s [-f] [-u username] [-i interface]"
+				"%s [-f] [-u username] [-i interface] [-I backend]"
 #ifdef ECMH_BPF
 				" [-t|-T]"
 #endif
@@ -2864,11 +3386,21 @@ int main(int argc, char *argv[])
 				" [-1|-2]"
 #endif
 				" [-p|-P]"
+#ifndef ECMH_BPF
+				" [-r [-b blocks] [-B blocksize]] [-G] [-w workers [-F hash|cpu]] [-m|-c|-x] [-U]"
+#endif
 				"\n"
-				"\n"
+				"\n",
+				argv[0]);
+			fprintf(stderr,
 				"-f, --foreground           don't daemonize\n"
 				"-u, --user username        drop (setuid+setgid) to user after startup\n"
 				"-i, --upstream interface   upstream interface\n"
+#ifndef ECMH_BPF
+				"-I, --io backend           Receive and send with packet (default), uring or xdp\n"
+#else
+				"-I, --io backend           Receive and send with bpf (default)\n"
+#endif
 #ifdef ECMH_BPF
 				"-t, --tunnelmode           Don't attach to tunnels, but use proto-41 decapsulation (default)\n"
 				"-T, --notunnelmode         Attach to tunnels seperatly\n"
@@ -2879,8 +3411,25 @@ int main(int argc, char *argv[])
 				"-1, --mld1only             Act as a MLDv1 only host\n"
 				"-2, --mld2only             Act as a MLDv2 only host (*)\n"
 #endif
-				,
-				argv[0]);
+				);
+#ifndef ECMH_BPF
+			fprintf(stderr,
+				"-r, --rxring               Receive through a memory mapped ring (TPACKET_V3)\n"
+				"-b, --rxring-blocks n      Number of blocks in the ring (default %u)\n"
+				"-B, --rxring-blocksize n   Size of a ring block in bytes (default %u)\n"
+				"-G, --nogroupfilter        Receive all multicast, not only joined groups\n"
+				"-g, --groupfilter-size n   Number of groups the filter holds (default %u)\n",
+				ECMH_RXRING_BLOCKS, ECMH_RXRING_BLOCKSIZE, FILTER_GROUPS_MAX);
+			fprintf(stderr,
+				"-w, --workers n            Forward with n threads, each with its own socket\n"
+				"-F, --fanout hash|cpu      How the kernel spreads packets over the workers (default hash)\n"
+				"-m, --mroute               Let the kernel forward (IPv6 multicast routing), only handle MLD\n"
+				"-c, --tcbpf                Forward with a tc eBPF program, only handle MLD\n");
+			fprintf(stderr,
+				"-x, --xdp                  Same as --io xdp, AF_XDP sockets, what is forwarded\n"
+				"                           does not reach listeners on this host\n"
+				"-U, --uring                Same as --io uring, io_uring in the main thread\n");
+#endif
 			fprintf(stderr,
 				"-p, --promisc              Make interfaces promisc"
 #ifdef ECMH_BPF
@@ -2929,6 +3478,14 @@ int main(int argc, char *argv[])
 		freopen("/dev/null","w",stderr);
 	}
 
+#ifndef ECMH_BPF
+	/*
+	 * Signals are read from a signalfd in the event loop,
+	 * until that is setup they stay pending
+	 */
+	events_sigset(&sigset);
+	sigprocmask(SIG_BLOCK, &sigset, NULL);
+#else
 	/* Handle a SIGHUP to reload the config */
 	signal(SIGHUP, &sighup);
 
@@ -2937,14 +3494,11 @@ int main(int argc, char *argv[])
 	signal(SIGINT,	&cleanpid);
 	signal(SIGKILL,	&cleanpid);
 
-	/* Timeout handling */
-	signal(SIGALRM, &timeout_signal);
-	alarm(ECMH_SUBSCRIPTION_TIMEOUT);
-
 	/* Dump operations */
 	signal(SIGUSR1,	&sigusr1);
 
 	signal(SIGUSR2, &sigusr2);
+#endif
 
 	/* Show our version in the startup logs ;) */
 	dolog(LOG_INFO, ECMH_VERSION_STRING, ECMH_VERSION, ECMH_GITHASH);
@@ -2989,17 +3543,93 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* The main thread and every worker count and cache for themselves */
+#ifndef ECMH_BPF
+	j = 1 + g_conf->workers;
+#else
+	j = 1;
+#endif
+	counters_init(j);
+	if (posix_memalign(&mem, ECMH_CACHELINE, sizeof(*g_conf->flows) * ECMH_FLOWCACHE * j) != 0)
+	{
+		dolog(LOG_ERR, "Couldn't allocate the flow caches\n");
+		return -1;
+	}
+	g_conf->flows = (struct flowentry *)mem;
+	memzero(g_conf->flows, sizeof(*g_conf->flows) * ECMH_FLOWCACHE * j);
+	g_conf->oil_gen = 1;
+	g_flows = g_conf->flows;
+	if (!counter_alloc(&g_conf->counters))
+	{
+		dolog(LOG_ERR, "Couldn't allocate the global counters\n");
+		return -1;
+	}
 
 #ifndef ECMH_BPF
+	if (g_conf->mroute + g_conf->tcbpf + (g_conf->io == &io_afxdp) > 1)
+	{
+		dolog(LOG_ERR, "Only one of --mroute, --tcbpf and --io xdp can be used\n");
+		return -1;
+	}
+
+	/* Without a tc program we forward ourselves */
+	if (g_conf->tcbpf && !tcfwd_init())
+	{
+		dolog(LOG_WARNING, "Falling back to forwarding in userspace\n");
+		g_conf->tcbpf = false;
+	}
+
+	/* The kernel forwards, there is nothing for the workers to do */
+	if ((g_conf->mroute || g_conf->tcbpf) && g_conf->workers)
+	{
+		dolog(LOG_WARNING, "Not starting workers, the kernel forwards\n");
+		g_conf->workers = 0;
+	}
+
+	if (!g_conf->io->workers && g_conf->workers)
+	{
+		dolog(LOG_WARNING, "Not starting workers, the %s backend receives in the main thread\n", g_conf->io->name);
+		g_conf->workers = 0;
+	}
+#endif /* ECMH_BPF */
+
 	/*
-	 * Allocate a single PACKET socket which can send and receive
-	 * anything we want (anything ???.... anythinggg... ;)
-	 * This is only available on Linux though
+	 * Open the I/O backend, on Linux all of them have a PACKET
+	 * socket which can send and receive anything we want
+	 * (anything ???.... anythinggg... ;)
 	 */
-	g_conf->rawsocket = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL));
-	if (g_conf->rawsocket < 0)
+	opened = g_conf->io->open();
+#ifndef ECMH_BPF
+	if (!opened && g_conf->io != &io_packet)
+	{
+		dolog(LOG_WARNING, "Falling back to the packet backend\n");
+		g_conf->io = &io_packet;
+		opened = g_conf->io->open();
+	}
+#endif
+	if (!opened)
+	{
+		return -1;
+	}
+
+	dolog(LOG_INFO, "Receiving and sending with the %s backend\n", g_conf->io->name);
+
+#ifndef ECMH_BPF
+	/* Setup the forwarding workers */
+	if (g_conf->workers && !workers_init())
+	{
+		return -1;
+	}
+
+	/* Become the multicast router, before the interfaces are found */
+	if (g_conf->mroute && !mrt_init())
+	{
+		return -1;
+	}
+
+	/* Wait for packets, upcalls, timers and signals */
+	if (!events_init())
 	{
-		dolog(LOG_ERR, "Couldn't allocate a RAW socket\n");
 		return -1;
 	}
 
@@ -3048,27 +3678,53 @@ int main(int argc, char *argv[])
 
 	send_mld_querys();
 
+	/* Query again in a while */
+	timer_init(&g_conf->querytimer, timeout, &g_conf->querytimer);
+	timer_set(&g_conf->querytimer, getmonotimes() + ECMH_SUBSCRIPTION_TIMEOUT);
+
+#ifndef ECMH_BPF
+	/* Start forwarding */
+	if (g_conf->workers && !workers_start())
+	{
+		quit = true;
+	}
+#endif
+
 	while (!g_conf->quit && !quit)
 	{
-		/* Was a timeout set? */
-		if (g_needs_timeout)
-		{
-			/* Run timeout routine */
-			timeout();
-			
-			/* Turn it off */
-			g_needs_timeout = false;
+#ifndef ECMH_BPF
+		quit = g_conf->io->wait ? !handlewait() : !handleevents(-1);
+#else
+		/* Expire what has to, the backend wakes us up every few seconds */
+		timers_run(getmonotimes());
 
-			/* Reset the alarm */
-			signal(SIGALRM, &timeout_signal);
-			alarm(ECMH_SUBSCRIPTION_TIMEOUT);
-		}
+		quit = !handlewait();
+#endif
 
-		quit = !handleinterfaces(g_conf->buffer);
+		/* Did interfaces disappear? */
+		if (g_conf->intgone)
+		{
+			table_lock();
+			int_purge();
+#ifndef ECMH_BPF
+			/*
+			 * Nothing points to the destroyed interfaces anymore,
+			 * the tunnels and locals of BPF keep theirs around
+			 */
+			int_reap();
+#endif
+			table_unlock();
+		}
 	}
 
+#ifndef ECMH_BPF
+	/* Let the workers finish */
+	g_conf->quit = true;
+	workers_stop();
+#endif
+
 	/* Dump the stats one last time */
-	sigusr1(SIGUSR1);
+	stats_dump();
 
 	/* Show the message in the log */
 	dolog(LOG_INFO, "Shutdown, thank you for using ecmh\n");
@@ -3078,7 +3734,7 @@ int main(int argc, char *argv[])
 	 * names are gone when we need them when displaying
 	 * the group deletions from the interfaces ;)
 	 */
-	list_delete_all_node(g_conf->groups);
+	hash_delete_all(g_conf->groups);
 
 #ifdef ECMH_BPF
 	/* Clear the locals */
@@ -3086,27 +3742,55 @@ int main(int argc, char *argv[])
 #endif
 
 	/* Get rid of the interfaces too now */
-	for (j = 0; j < g_conf->maxinterfaces; j++)
+	INT_LOOP(intn, j)
 	{
-		intn = &g_conf->ints[j];
+		int_destroy(intn);
+	}
+	int_reap();
 
-		if (intn->mtu == 0)
-		{
-			continue;
-		}
+#ifndef ECMH_BPF
+	/* The routes are gone, leave multicast routing */
+	mrt_cleanup();
+	tcfwd_cleanup();
+#endif
 
-		int_destroy(intn);
+	/* The interfaces are detached, the backend can go */
+	if (g_conf->io->close) g_conf->io->close();
+
+	/* Free the interface map and list */
+	for (j = 0; j < g_conf->intmap_pages; j++)
+	{
+		free(g_conf->intmap[j]);
 	}
-	
-	/* Free the interfaces memory block */
+	free(g_conf->intmap);
 	free(g_conf->ints);
 
-	list_free(g_conf->groups);
+	hash_free(g_conf->channels);
+	hash_free(g_conf->groups);
+
+#ifdef ECMH_SUPPORT_MLD2
+	free(g_conf->report.packet);
+	free(g_conf->report.srcs);
+#endif
+
+	/* Everything is gone, release the pools */
+	pool_destroy(&g_conf->pool_int);
+	pool_destroy(&g_conf->pool_group);
+	pool_destroy(&g_conf->pool_grpint);
+	pool_destroy(&g_conf->pool_subscr);
+	pool_destroy(&g_conf->pool_list);
+	pool_destroy(&g_conf->pool_listnode);
+#ifndef ECMH_BPF
+	pool_destroy(&g_conf->pool_route);
+#endif
+	counters_cleanup();
+	free(g_conf->flows);
 
 	/* Close files and sockets */
 	fclose(g_conf->stat_file);
 #ifndef ECMH_BPF
-	close(g_conf->rawsocket);
+	events_cleanup();
+	filter_cleanup();
 #endif
 
 	if (g_conf->buffer)
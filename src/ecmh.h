@@ -12,12 +12,16 @@
 #define PACKED __attribute__((packed))
 #define ALIGNED __attribute__((aligned))
 #define UNUSED __attribute__ ((__unused__))
+#define CACHE_ALIGNED __attribute__((aligned(ECMH_CACHELINE)))
+#define PREFETCH(p) __builtin_prefetch(p)
 #else
 #define ATTR_FORMAT(type, x, y)	/* nothing */
 #define ATTR_RESTRICT		/* nothing */
 #define PACKED
 #define ALIGNED
 #define UNUSED
+#define CACHE_ALIGNED
+#define PREFETCH(p)
 #endif
 
 #include <stdint.h>
@@ -32,6 +36,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <string.h>
 #include <strings.h>
@@ -48,7 +53,19 @@
 #include <netinet/if_ether.h>
 #include <sched.h>
 #ifdef __linux__
-#include <netpacket/packet.h>
+/* Instead of netpacket/packet.h as we need the TPACKET ring structures */
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #endif
 #if defined(__FreeBSD__) || defined(__MACH__)
 #include <fcntl.h>
@@ -93,6 +110,35 @@
 /* Robustness Factor, per RFC3810 MLDv2 "9.1.  Robustness Variable" */
 #define ECMH_ROBUSTNESS_FACTOR		2
 
+/* Receive ring defaults (Linux TPACKET_V3) */
+#define ECMH_RXRING_BLOCKS		64
+#define ECMH_RXRING_BLOCKSIZE		(256*1024)
+#define ECMH_RXRING_FRAMESIZE		2048
+/* Milliseconds after which a partially filled block is handed to us */
+#define ECMH_RXRING_TIMEOUT		2
+
+/* Maximum number of forwarded packets handed to a single sendmmsg() */
+#define ECMH_TXBATCH			64
+
+/* Maximum number of received packets that are forwarded together, see burst_run() */
+#define ECMH_RXBURST			32
+
+/* Maximum number of forwarding workers */
+#define ECMH_WORKERS_MAX		64
+
+/* Bursts the main thread receives before looking at its timers and signals */
+#define ECMH_EVENT_BUDGET		64
+
+/* Size of a cache line, for keeping what is used together on one */
+#define ECMH_CACHELINE			64
+
+/* Entries in the flow cache of every context (power of 2) */
+#define ECMH_FLOWCACHE_BITS		8
+#define ECMH_FLOWCACHE			(1 << ECMH_FLOWCACHE_BITS)
+
+/* Fails the build when a layout assumption does not hold */
+#define BUILD_CHECK(name, cond)		typedef char build_check_##name[(cond) ? 1 : -1]
+
 #ifndef ICMP6_MEMBERSHIP_QUERY
 #define ICMP6_MEMBERSHIP_QUERY	MLD_LISTENER_QUERY
 #endif
@@ -113,18 +159,149 @@
 #define true	(!false)
 #define bool	uint64_t
 
+#include "hash.h"
+#include "timer.h"
+#include "pool.h"
+#include "counter.h"
 #include "interfaces.h"
 #include "groups.h"
 #include "grpint.h"
 #include "subscr.h"
+#include "filter.h"
+#include "mrt.h"
+#include "tcfwd.h"
+#include "afxdp.h"
+#include "uring.h"
+#include "io.h"
+
+/*
+ * The forwarding decision for a flow, cached per context
+ * Only valid while gen matches g_conf->oil_gen, which changes
+ * whenever an OIL is rebuilt or a group comes or goes.
+ */
+struct flowentry
+{
+	struct in6_addr		src;				/* Source of the packet */
+	struct in6_addr		dst;				/* Destination (group) of the packet */
+	uint64_t		ifindex;			/* Interface it was received on */
+	uint64_t		gen;				/* g_conf->oil_gen when resolved, 0 = empty */
+	struct groupnode	*groupn;			/* The group, NULL when it isn't forwarded */
+	struct oilsrc		*oils;				/* Interfaces for this source, NULL when none */
+};
+
+/* An entry is one cache line */
+BUILD_CHECK(flowentry_line, sizeof(struct flowentry) == ECMH_CACHELINE);
+
+/* The global statistics, slots of g_conf->counters */
+#define CNT_PACKETS_RECEIVED		0		/* Number of packets received */
+#define CNT_PACKETS_SENT		1		/* Number of packets forwarded */
+#define CNT_BYTES_RECEIVED		2		/* Number of bytes received */
+#define CNT_BYTES_SENT			3		/* Number of bytes forwarded */
+#define CNT_HLIM_EXCEEDED		4		/* Packets that where dropped due to hlim == 0 */
+#define CNT_ICMP_RECEIVED		5		/* Number of ICMP's received */
+#define CNT_ICMP_SENT			6		/* Number of ICMP's sent */
+
+#ifdef ECMH_SUPPORT_MLD2
+/* A source in the de-duplication hash of reportbuf */
+struct reportsrc
+{
+	struct in6_addr		src;				/* The source address */
+	uint64_t		gen;				/* In use when it matches reportbuf.gen */
+};
+
+/* The MLDv2 report being built, only used by the control context */
+struct reportbuf
+{
+	uint8_t			*packet;			/* The packet, as large as the largest MTU */
+	uint64_t		size;				/* Size of the buffer */
+	uint64_t		length;				/* Bytes of the packet in use */
+	struct mld2_grec	*grec;				/* The grec being filled, NULL when none */
+	uint64_t		ngrec;				/* Number of grecs in the packet */
+	uint64_t		nsrcs;				/* Number of sources in grec */
+	struct reportsrc	*srcs;				/* Sources of the current group (open addressing) */
+	uint64_t		srcsize;			/* Number of slots in srcs (power of 2) */
+	uint64_t		srccount;			/* Sources of the current group in srcs */
+	uint64_t		gen;				/* Generation of the current group */
+};
+#endif
+
+#ifndef ECMH_BPF
+/* Forwarded packets waiting to be handed to the I/O backend */
+struct txqueue
+{
+	struct iotx		tx[ECMH_TXBATCH];
+	unsigned int		count;				/* Number of queued packets */
+	unsigned int		__padding;
+};
+
+/* What the PACKET backend hands to sendmmsg(), see packet_msgs() */
+struct txmsgs
+{
+	struct mmsghdr		msgs[ECMH_TXBATCH];
+	struct iovec		iovs[ECMH_TXBATCH];
+	struct sockaddr_ll	addrs[ECMH_TXBATCH];
+};
+
+/*
+ * Received packets that are to be forwarded, they are looked
+ * up and replicated stage by stage instead of one by one
+ */
+struct rxburst
+{
+	struct intnode		*intn[ECMH_RXBURST];		/* Interface it was received on */
+	struct ip6_hdr		*iph[ECMH_RXBURST];		/* The packet */
+	struct flowentry	*flow[ECMH_RXBURST];		/* It's slot in the flow cache */
+	struct groupnode	*groupn[ECMH_RXBURST];		/* The group, NULL when not forwarded */
+	struct oilsrc		*oils[ECMH_RXBURST];		/* Interfaces for the source, NULL when none */
+	uint16_t		len[ECMH_RXBURST];		/* Length of the packet */
+	unsigned int		count;				/* Number of packets in the burst */
+	unsigned int		__padding;
+};
+
+/*
+ * A receive context, either the control context (main thread),
+ * which handles MLD and owns the tables, or a forwarding worker.
+ * Every context has its own socket, receive ring and transmit queue.
+ */
+struct worker
+{
+	int			socket;				/* The PACKET socket */
+	int			__padding;
+	void			*buffer;			/* Buffer for recvfrom() */
+	uint8_t			*rxring_map;			/* The mmap()'d ring, NULL when not used */
+	uint64_t		rxring_block;			/* The block we are waiting on or walking */
+	struct tpacket3_hdr	*rxring_next;			/* Next frame of the block, NULL when not walking one */
+	uint64_t		rxring_left;			/* Frames of the block that are left */
+	pthread_t		thread;				/* The thread of a worker */
+	struct rxburst		burst;				/* Received packets to be forwarded */
+	struct txqueue		txq;				/* Forwarded packets to be sent */
+	struct txmsgs		msgs;				/* The messages they are sent with */
+};
+
+/* The receive context of the running thread, control or a worker */
+extern __thread struct worker *g_worker;
+
+/* Only the control context may change the tables and interfaces */
+#define IS_CONTROL()	(g_worker == &g_conf->control)
+#else
+#define IS_CONTROL()	true
+#endif
 
 /* Our configuration structure */
 struct conf
 {
 	uint64_t		maxgroups;
-	uint64_t		maxinterfaces;			/* The max number of interfaces the array can hold */
-	struct intnode		*ints;				/* The interfaces we are watching */
-	struct list		*groups;			/* The groups we are joined to */
+	struct intnode		***intmap;			/* ifindex -> interface, pages are allocated on demand */
+	uint64_t		intmap_pages;			/* Number of pages the map can hold */
+	struct intnode		**ints;				/* The interfaces we are watching */
+	uint64_t		intcount;			/* Number of interfaces we are watching */
+	uint64_t		intsize;			/* Number of interfaces the array can hold */
+	struct intnode		*intdead;			/* Destroyed interfaces, freed after the oil rebuild */
+	struct hashtable	*groups;			/* The groups we are joined to, hashed on their address */
+	struct hashtable	*channels;			/* The SSM sources of those groups, hashed on (S,G) */
+	bool			intgone;			/* Interfaces went away, their memberships need a purge */
+	uint64_t		oil_gen;			/* Bumped when an OIL changes, invalidates the flow caches */
+	struct flowentry	*flows;				/* The flow caches of all the contexts */
 
 	char			*upstream;			/* Upstream interface */
 	uint64_t		upstream_id;			/* Interface ID of upstream interface */
@@ -138,11 +315,33 @@ struct conf
 #endif
 	bool			promisc;			/* Make interfaces promisc? (To be sure to receive all MLD's) */
 	
+	const struct iobackend	*io;				/* How packets are received and sent, see io.h */
+
 	void			*buffer;			/* Our buffer */
 	uint64_t		bufferlen;			/* Length of the buffer */
 
 #ifndef ECMH_BPF
-	int			rawsocket;			/* Single RAW socket for sending and receiving everything */
+	struct worker		control;			/* The PACKET socket etc of the main thread */
+
+	bool			rxring;				/* Receive through a TPACKET_V3 ring? */
+	uint64_t		rxring_blocks;			/* Number of blocks in the ring */
+	uint64_t		rxring_blocksize;		/* Size of a block in bytes */
+
+	bool			groupfilter;			/* Only receive joined groups (eBPF)? */
+	uint64_t		groupfilter_size;		/* Number of groups the filter holds */
+	bool			mroute;				/* Let the kernel forward (MRT6), see mrt.h */
+	bool			tcbpf;				/* Forward with a tc eBPF program, see tcfwd.h */
+
+	uint64_t		workers;			/* Number of forwarding workers (0 = none) */
+	uint64_t		fanout;				/* PACKET_FANOUT_* mode used by the workers */
+	struct worker		*worker;			/* The forwarding workers */
+	pthread_rwlock_t	lock;				/* Taken for writing by control, reading by workers */
+
+	int			epoll;				/* The event loop of the main thread */
+	int			timerfd;			/* Ticks the timer wheel every second */
+	int			signalfd;			/* The signals we handle */
+	int			wakefd;				/* eventfd that tells the workers to quit */
+	int			mrtfd;				/* The mroute socket, -1 when not forwarding in the kernel */
 	int			__padding;
 #else
 	bool			tunnelmode;			/* Intercept&handle proto-41 packets? */
@@ -151,15 +350,24 @@ struct conf
 	uint64_t		hifd;				/* Highest File Descriptor */
 #endif
 
+	struct timer		querytimer;			/* Sends the periodic queries */
+#ifdef ECMH_SUPPORT_MLD2
+	struct reportbuf	report;				/* Builds the MLDv2 reports */
+#endif
+
+	struct pool		pool_int;			/* intnode's */
+	struct pool		pool_group;			/* groupnode's */
+	struct pool		pool_grpint;			/* grpintnode's */
+	struct pool		pool_subscr;			/* subscrnode's */
+	struct pool		pool_list;			/* list's */
+	struct pool		pool_listnode;			/* listnode's */
+#ifndef ECMH_BPF
+	struct pool		pool_route;			/* mrtroute's */
+#endif
+
 	FILE			*stat_file;			/* The file handle of ourdump file */
 	time_t			stat_starttime;			/* When did we start */
-	uint64_t		stat_packets_received;		/* Number of packets received */
-	uint64_t		stat_packets_sent;		/* Number of packets forwarded */
-	uint64_t		stat_bytes_received;		/* Number of bytes received */
-	uint64_t		stat_bytes_sent;		/* Number of bytes forwarded */
-	uint64_t		stat_icmp_received;		/* Number of ICMP's received */
-	uint64_t		stat_icmp_sent;			/* Number of ICMP's sent */
-	uint64_t		stat_hlim_exceeded;		/* Packets that where dropped due to hlim == 0 */
+	uint64_t		counters;			/* Counter block of the global statistics, CNT_* */
 };
 
 #ifndef ETH_P_IPV6
@@ -0,0 +1,377 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+#ifndef ECMH_BPF
+
+/* Where things are in the group filter, patched in at load time */
+#define FILTER_INSN_PROTOCOL	2
+#define FILTER_INSN_MAP		17
+#define FILTER_INSN_ICMP	27
+
+static int filter_map = -1;
+static int filter_prog = -1;
+
+/* The sockets the group filter is attached to, with their mode */
+static int filter_socks[ECMH_WORKERS_MAX + 1];
+static unsigned int filter_modes[ECMH_WORKERS_MAX + 1];
+static unsigned int filter_count = 0;
+
+/* Not all groups fit in the map, the sockets have the classic filter */
+static bool filter_full = false;
+
+/* The bpf() system call, glibc has no wrapper */
+int filter_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * Let the kernel drop everything we are not interested in
+ * before it gets copied to us: only IPv6 with a multicast
+ * destination is passed, loopback and our own transmitted
+ * packets are dropped. Depending on the mode ICMPv6 (MLD),
+ * or everything but ICMPv6, or both are passed.
+ * Failing is not fatal, handlepacket() checks these too.
+ */
+static bool filter_classic(int sock, unsigned int mode);
+static bool filter_classic(int sock, unsigned int mode)
+{
+	struct sock_filter filter[] =
+	{
+		/* 0: Loopback? -> drop */
+		BPF_STMT(BPF_LD  + BPF_W   + BPF_ABS, SKF_AD_OFF + SKF_AD_HATYPE),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPHRD_LOOPBACK, 11, 0),
+
+		/* 2: Not IPv6? -> drop */
+		BPF_STMT(BPF_LD  + BPF_W   + BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_IPV6, 0, 9),
+
+		/* 4: First byte of the destination not ff::/8? -> drop */
+		BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, offsetof(struct ip6_hdr, ip6_dst)),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xff, 0, 7),
+
+		/* 6: ICMPv6, directly or behind a Hop-by-Hop header? */
+		BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, offsetof(struct ip6_hdr, ip6_nxt)),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMPV6, 4, 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_HOPOPTS, 0, 2),
+		BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, sizeof(struct ip6_hdr)),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMPV6, 1, 0),
+
+		/* 11: Other multicast, 12: ICMPv6, 13: drop */
+		BPF_STMT(BPF_RET + BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET + BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+	struct sock_fprog	prog;
+
+	if (mode == FILTER_CONTROL)	filter[11].k = 0;
+	if (mode == FILTER_DATA)	filter[12].k = 0;
+
+	memzero(&prog, sizeof(prog));
+	prog.len	= sizeof(filter) / sizeof(filter[0]);
+	prog.filter	= filter;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't attach socket filter: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Load the group filter, the packet data starts at the IPv6 header
+ *
+ * MLD is ICMPv6 behind a Hop-by-Hop header (Router Alert),
+ * all ICMPv6 is passed (or dropped for FILTER_DATA), other
+ * multicast only when the destination is in the map.
+ */
+static bool filter_groups_load(void);
+static bool filter_groups_load(void)
+{
+	struct bpf_insn insns[] =
+	{
+		/* 0: Not IPv6? -> drop */
+		EBPF_MOV_REG(BPF_REG_6, BPF_REG_1),
+		EBPF_LDX_W(BPF_REG_0, BPF_REG_6, offsetof(struct __sk_buff, protocol)),
+		EBPF_JNE_IMM(BPF_REG_0, 0, 22),
+
+		/* 3: Not multicast? -> drop */
+		EBPF_LD_ABS_B(offsetof(struct ip6_hdr, ip6_dst)),
+		EBPF_JNE_IMM(BPF_REG_0, 0xff, 20),
+
+		/* 5: ICMPv6, directly or behind a Hop-by-Hop header */
+		EBPF_LD_ABS_B(offsetof(struct ip6_hdr, ip6_nxt)),
+		EBPF_JEQ_IMM(BPF_REG_0, IPPROTO_ICMPV6, 20),
+		EBPF_JNE_IMM(BPF_REG_0, IPPROTO_HOPOPTS, 2),
+		EBPF_LD_ABS_B(sizeof(struct ip6_hdr)),
+		EBPF_JEQ_IMM(BPF_REG_0, IPPROTO_ICMPV6, 17),
+
+		/* 10: Copy the destination to the stack */
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		EBPF_MOV_IMM(BPF_REG_2, offsetof(struct ip6_hdr, ip6_dst)),
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, -(int)sizeof(struct in6_addr)),
+		EBPF_MOV_IMM(BPF_REG_4, sizeof(struct in6_addr)),
+		EBPF_CALL(BPF_FUNC_skb_load_bytes),
+		EBPF_JNE_IMM(BPF_REG_0, 0, 8),
+
+		/* 17: Not a group we joined? -> drop */
+		EBPF_LD_MAP_FD(BPF_REG_1),
+		EBPF_MOV_REG(BPF_REG_2, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_2, -(int)sizeof(struct in6_addr)),
+		EBPF_CALL(BPF_FUNC_map_lookup_elem),
+		EBPF_JEQ_IMM(BPF_REG_0, 0, 2),
+
+		/* 23: Accept */
+		EBPF_MOV_IMM(BPF_REG_0, -1),
+		EBPF_EXIT(),
+
+		/* 25: Drop */
+		EBPF_MOV_IMM(BPF_REG_0, 0),
+		EBPF_EXIT(),
+
+		/* 27: ICMPv6, accept or drop */
+		EBPF_MOV_IMM(BPF_REG_0, -1),
+		EBPF_EXIT(),
+	};
+	union bpf_attr	attr;
+
+	insns[FILTER_INSN_PROTOCOL].imm	= htons(ETH_P_IPV6);
+
+	/* Only the control context receives MLD when there are workers */
+	if (g_conf->workers) insns[FILTER_INSN_ICMP].imm = 0;
+
+	/* The map holding the groups */
+	memzero(&attr, sizeof(attr));
+	attr.map_type		= BPF_MAP_TYPE_HASH;
+	attr.key_size		= sizeof(struct in6_addr);
+	attr.value_size		= sizeof(uint8_t);
+	attr.max_entries	= g_conf->groupfilter_size;
+	attr.map_flags		= BPF_F_NO_PREALLOC;
+
+	filter_map = filter_bpf(BPF_MAP_CREATE, &attr);
+	if (filter_map < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't create group filter map: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	insns[FILTER_INSN_MAP].imm	= filter_map;
+
+	/* The program */
+	memzero(&attr, sizeof(attr));
+	attr.prog_type		= BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insn_cnt		= sizeof(insns) / sizeof(insns[0]);
+	attr.insns		= (uint64_t)(unsigned long)insns;
+	attr.license		= (uint64_t)(unsigned long)"GPL";
+
+	filter_prog = filter_bpf(BPF_PROG_LOAD, &attr);
+	if (filter_prog < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't load group filter: %s (%d)\n", strerror(errno), errno);
+		filter_cleanup();
+		return false;
+	}
+
+	return true;
+}
+
+/* Attach the group filter, loading it the first time */
+static bool filter_groups(int sock, unsigned int mode);
+static bool filter_groups(int sock, unsigned int mode)
+{
+	struct groupnode	*groupn;
+	uint64_t		hi;
+
+	if (filter_prog < 0)
+	{
+		if (!filter_groups_load()) return false;
+
+		/* Groups that already exist */
+		HASH_LOOP(g_conf->groups, groupn, hi)
+		{
+			filter_group_add(&groupn->mca);
+		}
+
+		dolog(LOG_INFO, "Filtering on joined groups in the kernel\n");
+	}
+
+	/* The groups don't fit? -> It gets the group filter with the others */
+	if (filter_full)
+	{
+		if (!filter_classic(sock, mode)) return false;
+	}
+	else if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_BPF, &filter_prog, sizeof(filter_prog)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't attach group filter: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	filter_socks[filter_count] = sock;
+	filter_modes[filter_count] = mode;
+	filter_count++;
+
+	return true;
+}
+
+/*
+ * Setup filtering on a PACKET socket, the group filter when
+ * requested and possible, otherwise the classic filter
+ * mode is one of FILTER_*, the group filter is not
+ * used for FILTER_CONTROL, which only receives MLD.
+ */
+bool filter_init(int sock, unsigned int mode)
+{
+	int			on = 1;
+	bool			ret = true;
+
+	/* Our own packets don't have to be looped back to us */
+	if (setsockopt(sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't ignore outgoing packets: %s (%d)\n", strerror(errno), errno);
+		ret = false;
+	}
+
+	if (g_conf->groupfilter && mode != FILTER_CONTROL)
+	{
+		if (filter_groups(sock, mode)) return ret;
+
+		dolog(LOG_WARNING, "Falling back to passing all multicast\n");
+		g_conf->groupfilter = false;
+	}
+
+	if (!filter_classic(sock, mode)) ret = false;
+
+	return ret;
+}
+
+/* The groups don't fit, replace the group filter with the classic one everywhere */
+static void filter_groups_suspend(void);
+static void filter_groups_suspend(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < filter_count; i++)
+	{
+		filter_classic(filter_socks[i], filter_modes[i]);
+	}
+
+	filter_full = true;
+}
+
+/* Enough groups are gone, put them all in the map and attach the group filter again */
+static void filter_groups_resume(void);
+static void filter_groups_resume(void)
+{
+	struct groupnode	*groupn;
+	union bpf_attr		attr;
+	uint8_t			value = 1;
+	uint64_t		hi;
+	unsigned int		i;
+
+	HASH_LOOP(g_conf->groups, groupn, hi)
+	{
+		memzero(&attr, sizeof(attr));
+		attr.map_fd	= filter_map;
+		attr.key	= (uint64_t)(unsigned long)&groupn->mca;
+		attr.value	= (uint64_t)(unsigned long)&value;
+		attr.flags	= BPF_ANY;
+
+		if (filter_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) return;
+	}
+
+	for (i = 0; i < filter_count; i++)
+	{
+		if (setsockopt(filter_socks[i], SOL_SOCKET, SO_ATTACH_BPF, &filter_prog, sizeof(filter_prog)) != 0)
+		{
+			dolog(LOG_WARNING, "Couldn't attach group filter: %s (%d)\n", strerror(errno), errno);
+		}
+	}
+
+	filter_full = false;
+	dolog(LOG_INFO, "The groups fit in the filter again, only receiving joined groups\n");
+}
+
+bool filter_groups_full(void)
+{
+	return filter_full;
+}
+
+/* The map with the groups, -1 when there is no group filter */
+int filter_groups_map(void)
+{
+	return filter_map;
+}
+
+void filter_cleanup(void)
+{
+	if (filter_prog >= 0) close(filter_prog);
+	if (filter_map >= 0) close(filter_map);
+
+	filter_prog = -1;
+	filter_map = -1;
+	filter_count = 0;
+	filter_full = false;
+}
+
+void filter_group_add(const struct in6_addr *mca)
+{
+	union bpf_attr	attr;
+	uint8_t		value = 1;
+
+	if (filter_map < 0) return;
+
+	memzero(&attr, sizeof(attr));
+	attr.map_fd	= filter_map;
+	attr.key	= (uint64_t)(unsigned long)mca;
+	attr.value	= (uint64_t)(unsigned long)&value;
+	attr.flags	= BPF_ANY;
+
+	if (filter_bpf(BPF_MAP_UPDATE_ELEM, &attr) == 0 || filter_full) return;
+
+	/*
+	 * Without it in the map we would never see this group,
+	 * thus rather pass all multicast till the groups fit again
+	 */
+	dolog(LOG_WARNING, "Couldn't add group to the filter: %s (%d), passing all multicast\n", strerror(errno), errno);
+	filter_groups_suspend();
+}
+
+void filter_group_del(const struct in6_addr *mca)
+{
+	union bpf_attr	attr;
+
+	if (filter_map < 0) return;
+
+	memzero(&attr, sizeof(attr));
+	attr.map_fd	= filter_map;
+	attr.key	= (uint64_t)(unsigned long)mca;
+
+	filter_bpf(BPF_MAP_DELETE_ELEM, &attr);
+
+	/* Some room to spare, so that a few joins don't flip it right back */
+	if (	filter_full &&
+		(uint64_t)hashcount(g_conf->groups) <= g_conf->groupfilter_size - (g_conf->groupfilter_size / 8))
+	{
+		filter_groups_resume();
+	}
+}
+
+#else /* !ECMH_BPF */
+
+void filter_group_add(const struct in6_addr UNUSED *mca)
+{
+}
+
+void filter_group_del(const struct in6_addr UNUSED *mca)
+{
+}
+
+#endif /* !ECMH_BPF */
+
@@ -0,0 +1,61 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Kernel side filtering of the packets we receive (Linux)
+ *
+ * The classic filter passes all IPv6 multicast, the group filter
+ * is an eBPF program that only passes MLD/ICMPv6 and multicast
+ * for the groups that are in a BPF hash map. The map is kept in
+ * sync with the group table by filter_group_add/del(). When the
+ * groups don't fit the sockets pass all multicast till enough
+ * groups are gone again.
+ * On BSD the per interface BPF devices are filtered, see
+ * int_create_bpf(), and the group functions do nothing.
+ */
+
+#ifndef __FILTER_H
+#define __FILTER_H
+
+/* Number of groups that fit in the group filter map (default of --groupfilter-size) */
+#define FILTER_GROUPS_MAX	65536
+
+/* What a socket wants to receive */
+#define FILTER_ALL		0	/* MLD and multicast to forward */
+#define FILTER_CONTROL		1	/* Only MLD (ICMPv6) */
+#define FILTER_DATA		2	/* Only multicast to forward */
+
+#ifndef ECMH_BPF
+/* eBPF instructions, see linux/bpf.h */
+#define EBPF_INSN(code, dst, src, off, imm)	{ (code), (dst), (src), (off), (imm) }
+#define EBPF_MOV_REG(dst, src)			EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0)
+#define EBPF_MOV_IMM(dst, imm)			EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm)
+#define EBPF_ADD_IMM(dst, imm)			EBPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm)
+#define EBPF_AND_IMM(dst, imm)			EBPF_INSN(BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm)
+#define EBPF_LDX_B(dst, src, off)		EBPF_INSN(BPF_LDX | BPF_MEM | BPF_B, dst, src, off, 0)
+#define EBPF_LDX_H(dst, src, off)		EBPF_INSN(BPF_LDX | BPF_MEM | BPF_H, dst, src, off, 0)
+#define EBPF_LDX_W(dst, src, off)		EBPF_INSN(BPF_LDX | BPF_MEM | BPF_W, dst, src, off, 0)
+#define EBPF_LD_ABS_B(off)			EBPF_INSN(BPF_LD | BPF_ABS | BPF_B, 0, 0, 0, off)
+#define EBPF_LD_MAP_FD(dst)			EBPF_INSN(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, 0), \
+						EBPF_INSN(0, 0, 0, 0, 0)
+#define EBPF_JEQ_IMM(dst, imm, off)		EBPF_INSN(BPF_JMP | BPF_JEQ | BPF_K, dst, 0, off, imm)
+#define EBPF_JNE_IMM(dst, imm, off)		EBPF_INSN(BPF_JMP | BPF_JNE | BPF_K, dst, 0, off, imm)
+#define EBPF_JLE_IMM(dst, imm, off)		EBPF_INSN(BPF_JMP | BPF_JLE | BPF_K, dst, 0, off, imm)
+#define EBPF_JGT_REG(dst, src, off)		EBPF_INSN(BPF_JMP | BPF_JGT | BPF_X, dst, src, off, 0)
+#define EBPF_CALL(func)				EBPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, func)
+#define EBPF_EXIT()				EBPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/* Prototypes. */
+bool filter_init(int sock, unsigned int mode);
+void filter_cleanup(void);
+int filter_bpf(int cmd, union bpf_attr *attr);
+bool filter_groups_full(void);
+int filter_groups_map(void);
+#endif
+void filter_group_add(const struct in6_addr *mca);
+void filter_group_del(const struct in6_addr *mca);
+
+#endif /* __FILTER_H */
+
@@ -5,20 +5,76 @@
 
 #include "ecmh.h"
 
+/* Release the outgoing interface list of a group */
+static void group_oil_free(struct groupnode *groupn);
+static void group_oil_free(struct groupnode *groupn)
+{
+	uint64_t i;
+
+	/* The tc program stops forwarding with it */
+	tcfwd_group_del(groupn);
+
+	for (i = 0; i < groupn->oil_srccount; i++)
+	{
+		/* Does nothing for the ones that aren't in the channel table */
+		if (IN6_IS_ADDR_MC_SSM(&groupn->mca)) hash_remove(g_conf->channels, &groupn->oil_src[i]);
+
+		free(groupn->oil_src[i].ints);
+	}
+
+	hash_free(groupn->oil_srchash);
+	free(groupn->oil_src);
+	free(groupn->oil);
+
+	groupn->oil		= NULL;
+	groupn->oil_count	= 0;
+	groupn->oil_src		= NULL;
+	groupn->oil_srccount	= 0;
+	groupn->oil_srchash	= NULL;
+
+	/* Cached forwarding decisions might point to it */
+	g_conf->oil_gen++;
+}
+
+/* Append an interface to an interface array */
+static bool group_oil_add(struct intnode ***ints, uint64_t *count, struct intnode *intn);
+static bool group_oil_add(struct intnode ***ints, uint64_t *count, struct intnode *intn)
+{
+	struct intnode **n;
+
+	n = realloc(*ints, sizeof(**ints) * (*count + 1));
+	if (!n) return false;
+
+	n[(*count)++] = intn;
+	*ints = n;
+
+	return true;
+}
+
 /* Create a groupnode */
 static struct groupnode *group_create(const struct in6_addr *mca);
 static struct groupnode *group_create(const struct in6_addr *mca)
 {
-	struct groupnode *groupn = calloc(1, sizeof(*groupn));
+	struct groupnode *groupn = pool_alloc(&g_conf->pool_group);
 
 	if (!groupn) return NULL;
 
+	if (!counter_alloc(&groupn->counters))
+	{
+		pool_free(&g_conf->pool_group, groupn);
+		return NULL;
+	}
+
 	/* Fill her in */
 	memcpy(&groupn->mca, mca, sizeof(*mca));
 
-	/* Setup the list */
-	groupn->interfaces = list_new();
-	groupn->interfaces->del = (void(*)(void *))grpint_destroy;
+	/* Flows to it might be cached as not forwarded */
+	g_conf->oil_gen++;
+
+	/* Setup the list, the grpints carry their own node */
+	groupn->interfaces.del = (void(*)(void *))grpint_destroy;
+	groupn->interfaces.embedded = true;
+	groupn->routes.embedded = true;
 
 D(
 	{
@@ -47,22 +103,20 @@ D(
 )
 
 	/* Empty the subscriber list */
-	list_delete_all_node(groupn->interfaces);
+	list_delete_all_node(&groupn->interfaces);
+
+	/* Drop the outgoing interface list and the kernel routes using it */
+	mrt_group_del(groupn);
+	group_oil_free(groupn);
 
 	/* Free the node */
-	free(groupn);
+	counter_free(groupn->counters);
+	pool_free(&g_conf->pool_group, groupn);
 }
 
 struct groupnode *group_find(const struct in6_addr *mca)
 {
-	struct groupnode	*groupn;
-	struct listnode		*ln;
-
-	LIST_LOOP(g_conf->groups, groupn, ln)
-	{
-		if (IN6_ARE_ADDR_EQUAL(mca, &groupn->mca)) return groupn;
-	}
-	return NULL;
+	return (struct groupnode *)hash_find(g_conf->groups, mca);
 }
 
 /*
@@ -74,7 +128,7 @@ struct grpintnode *groupint_get(const struct in6_addr *mca, struct intnode *inte
 {
 	struct groupnode	*groupn;
 	struct grpintnode	*grpintn;
-	uint64_t		t = gettimes();
+	uint64_t		t = getmonotimes();
 
 	*isnew = false;
 
@@ -86,10 +140,18 @@ struct grpintnode *groupint_get(const struct in6_addr *mca, struct intnode *inte
 		/* Create the group node */
 		groupn = group_create(mca);
 
-		/* Add the group to the list */
+		/* Add the group to the table */
+		if (groupn && !hash_add(g_conf->groups, (void *)groupn))
+		{
+			group_destroy(groupn);
+			groupn = NULL;
+		}
+
 		if (groupn)
 		{
-			listnode_add(g_conf->groups, (void *)groupn);
+			/* Let the kernel pass it on to us */
+			filter_group_add(mca);
+
 			*isnew = true;
 		}
 	}
@@ -112,7 +174,7 @@ struct grpintnode *groupint_get(const struct in6_addr *mca, struct intnode *inte
 	}
 
 	/* Find the interface in this group */
-	grpintn = grpint_find(groupn->interfaces, interface);
+	grpintn = grpint_find(&groupn->interfaces, interface);
 
 	if (!grpintn)
 	{
@@ -120,8 +182,277 @@ struct grpintnode *groupint_get(const struct in6_addr *mca, struct intnode *inte
 		grpintn = grpint_create(interface);
 
 		/* Add the group to the list */
-		if (grpintn) listnode_add(groupn->interfaces, (void *)grpintn);
+		if (grpintn)
+		{
+			grpintn->groupn = groupn;
+			listnode_link(&groupn->interfaces, &grpintn->node, (void *)grpintn);
+			listnode_link(&interface->info.groups, &grpintn->ifnode, (void *)grpintn);
+		}
 	}
 	return grpintn;
 }
 
+/*
+ * Remove a grpint from it's group and interface, and the group
+ * when that was the last interface. The OIL is left dirty.
+ * Returns false when the group is gone too.
+ */
+bool groupint_delete(struct grpintnode *grpintn)
+{
+	struct groupnode *groupn = grpintn->groupn;
+
+	/* Delete from the list */
+	list_delete_node(&groupn->interfaces, &grpintn->node);
+	/* Destroy the grpint */
+	grpint_destroy(grpintn);
+
+	/* Membership changed */
+	groupn->oil_dirty = true;
+
+	if (groupn->interfaces.count == 0)
+	{
+		/* Delete from the table and the kernel filter */
+		hash_remove(g_conf->groups, groupn);
+		filter_group_del(&groupn->mca);
+
+		/* Destroy the group */
+		group_destroy(groupn);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Called from the timers when a grpint might have become empty
+ * Removes the grpint without listeners and the group when that
+ * was the last interface, otherwise updates the group's OIL.
+ */
+void groupint_expire(struct grpintnode *grpintn)
+{
+	struct groupnode *groupn = grpintn->groupn;
+
+#ifndef ECMH_SUPPORT_MLD2
+	if (grpintn->subscriptions.count == 0)
+#else
+	if (grpintn->subscriptions.count <= (-ECMH_ROBUSTNESS_FACTOR))
+#endif
+	{
+		if (!groupint_delete(grpintn)) return;
+	}
+
+	/* Recompile the outgoing interfaces if this changed anything */
+	group_oil_update(groupn);
+}
+
+/* A source an interface wants, collected while compiling the OIL */
+struct oilpair
+{
+	struct in6_addr	src;		/* The source */
+	struct intnode	*intn;		/* The interface that wants it */
+};
+
+static int group_oil_cmp(const void *a, const void *b);
+static int group_oil_cmp(const void *a, const void *b)
+{
+	return memcmp(&((const struct oilpair *)a)->src, &((const struct oilpair *)b)->src, sizeof(struct in6_addr));
+}
+
+/*
+ * Compile the per source lists out of the collected pairs
+ * Sorting brings the interfaces of one source together,
+ * this keeps it O(n log n) for reports with many sources.
+ */
+static bool group_oil_sources(struct groupnode *groupn, struct oilpair *pairs, uint64_t count);
+static bool group_oil_sources(struct groupnode *groupn, struct oilpair *pairs, uint64_t count)
+{
+	struct oilsrc	*oils;
+	uint64_t	i, j, sources = 0;
+
+	qsort(pairs, count, sizeof(*pairs), group_oil_cmp);
+
+	for (i = 0; i < count; i++)
+	{
+		if (i == 0 || !IN6_ARE_ADDR_EQUAL(&pairs[i].src, &pairs[i-1].src)) sources++;
+	}
+
+	groupn->oil_src = calloc(sources, sizeof(*groupn->oil_src));
+	if (!groupn->oil_src) return false;
+
+	for (i = 0; i < count; i = j)
+	{
+		for (j = i + 1; j < count && IN6_ARE_ADDR_EQUAL(&pairs[j].src, &pairs[i].src); j++);
+
+		oils = &groupn->oil_src[groupn->oil_srccount];
+		oils->ints = malloc(sizeof(*oils->ints) * (j - i));
+		if (!oils->ints) return false;
+
+		memcpy(&oils->src, &pairs[i].src, sizeof(oils->src));
+		memcpy(&oils->mca, &groupn->mca, sizeof(oils->mca));
+		oils->groupn = groupn;
+		for (; i < j; i++) oils->ints[oils->count++] = pairs[i].intn;
+
+		groupn->oil_srccount++;
+
+		/*
+		 * SSM channels are found on (S,G) without the group,
+		 * when that fails the sorted array is searched instead
+		 */
+		if (IN6_IS_ADDR_MC_SSM(&groupn->mca) && !hash_add(g_conf->channels, oils))
+		{
+			dolog(LOG_WARNING, "Couldn't add a channel to the channel table\n");
+		}
+	}
+
+	/* Many sources? Then the forwarding path finds them through a hash */
+	if (!IN6_IS_ADDR_MC_SSM(&groupn->mca) && groupn->oil_srccount > GROUP_OIL_HASHMIN)
+	{
+		groupn->oil_srchash = hash_new(offsetof(struct oilsrc, src), sizeof(struct in6_addr));
+
+		for (i = 0; groupn->oil_srchash && i < groupn->oil_srccount; i++)
+		{
+			if (!hash_add(groupn->oil_srchash, &groupn->oil_src[i]))
+			{
+				/* Not fatal, the sorted array is searched instead */
+				hash_free(groupn->oil_srchash);
+				groupn->oil_srchash = NULL;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Compile the outgoing interface list of a group
+ *
+ * An interface forwards a packet from source S when one of
+ * it's subscriptions includes :: (any source) or S.
+ * The ASM list holds the interfaces including any source,
+ * the per source lists hold the remaining interfaces.
+ */
+void group_oil_build(struct groupnode *groupn)
+{
+	struct grpintnode	*grpintn;
+	struct subscrnode	*subscrn;
+	struct intnode		*intn;
+	struct oilpair		*pairs = NULL, *p;
+	struct listnode		*ln, *sn;
+	uint64_t		i, count = 0, size = 0;
+	bool			any;
+
+	group_oil_free(groupn);
+	groupn->oil_dirty = false;
+
+	/* The interfaces that want everything */
+	LIST_LOOP(&groupn->interfaces, grpintn, ln)
+	{
+		/* Destroyed, it's memberships are purged by int_purge() */
+		intn = grpintn->interface;
+		if (intn->mtu == 0) continue;
+
+		any = false;
+		LIST_LOOP(&grpintn->subscriptions, subscrn, sn)
+		{
+			if (	subscrn->mode == MLD2_MODE_IS_INCLUDE &&
+				IN6_IS_ADDR_UNSPECIFIED(&subscrn->ipv6))
+			{
+				any = true;
+				break;
+			}
+		}
+
+		if (any && !group_oil_add(&groupn->oil, &groupn->oil_count, intn))
+		{
+			dolog(LOG_ERR, "Couldn't allocate memory for outgoing interface list\n");
+			return;
+		}
+	}
+
+	/* The sources wanted by the interfaces that don't want everything */
+	LIST_LOOP(&groupn->interfaces, grpintn, ln)
+	{
+		intn = grpintn->interface;
+		if (intn->mtu == 0) continue;
+
+		/* Already receives everything? */
+		for (i = 0; i < groupn->oil_count; i++)
+		{
+			if (groupn->oil[i] == intn) break;
+		}
+		if (i < groupn->oil_count) continue;
+
+		LIST_LOOP(&grpintn->subscriptions, subscrn, sn)
+		{
+			if (	subscrn->mode != MLD2_MODE_IS_INCLUDE ||
+				IN6_IS_ADDR_UNSPECIFIED(&subscrn->ipv6))
+			{
+				continue;
+			}
+
+			if (count == size)
+			{
+				size = size ? size * 2 : 16;
+				p = realloc(pairs, sizeof(*pairs) * size);
+				if (!p)
+				{
+					dolog(LOG_ERR, "Couldn't allocate memory for outgoing interface list\n");
+					free(pairs);
+					return;
+				}
+				pairs = p;
+			}
+
+			memcpy(&pairs[count].src, &subscrn->ipv6, sizeof(pairs[count].src));
+			pairs[count++].intn = intn;
+		}
+	}
+
+	if (count > 0 && !group_oil_sources(groupn, pairs, count))
+	{
+		dolog(LOG_ERR, "Couldn't allocate memory for outgoing interface list\n");
+	}
+
+	free(pairs);
+
+	/* The kernel forwards with it too */
+	mrt_group_update(groupn);
+	tcfwd_group_add(groupn);
+}
+
+/* The interfaces that want packets of a specific source, NULL when none */
+struct oilsrc *group_oil_find(const struct groupnode *groupn, const struct in6_addr *src)
+{
+	uint64_t	lo = 0, hi = groupn->oil_srccount, mid;
+	int		c;
+
+	if (groupn->oil_srchash) return (struct oilsrc *)hash_find(groupn->oil_srchash, src);
+
+	/* A handful of them, they are sorted */
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		c = memcmp(src, &groupn->oil_src[mid].src, sizeof(*src));
+		if (c == 0) return &groupn->oil_src[mid];
+		if (c < 0) hi = mid;
+		else lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * The interfaces that want a SSM channel, NULL when none
+ * sg = the source followed by the group, as in the IPv6 header
+ */
+struct oilsrc *channel_find(const struct in6_addr *sg)
+{
+	return (struct oilsrc *)hash_find(g_conf->channels, sg);
+}
+
+/* Rebuild the outgoing interface list if the membership changed */
+void group_oil_update(struct groupnode *groupn)
+{
+	if (groupn->oil_dirty) group_oil_build(groupn);
+}
+
@@ -3,17 +3,63 @@
  by Jeroen Massar <jeroen@massar.ch>
 **************************************/
 
+/*
+ * Outgoing interfaces for packets of one specific source (SSM)
+ * Interfaces that are in the ASM list of the group are not repeated here
+ *
+ * The source and group follow each other just like in the IPv6
+ * header, the sources of SSM groups (ff3x::/96) are put in the
+ * channel table on the pair, see channel_find().
+ */
+struct oilsrc
+{
+	struct in6_addr	src;		/* The source address */
+	struct in6_addr	mca;		/* The group */
+	struct groupnode *groupn;	/* The group this source belongs to */
+	uint64_t	count;		/* Number of interfaces in ints */
+	struct intnode	**ints;		/* The interfaces that want this source */
+};
+
+/* Source Specific Multicast range, ff3x::/96 (RFC4607), bytes 2 till 11 are zero */
+#define IN6_IS_ADDR_MC_SSM(a) \
+	(((const uint8_t *)(a))[0] == 0xff && (((const uint8_t *)(a))[1] & 0xf0) == 0x30 && \
+	 ((const uint16_t *)(a))[1] == 0 && ((const uint32_t *)(a))[1] == 0 && ((const uint32_t *)(a))[2] == 0)
+
+/* With more sources than this the per source lists are also hashed */
+#define GROUP_OIL_HASHMIN	8
+
+/* Per group statistics, slots of groupnode.counters */
+#define GROUP_CNT_BYTES		0	/* Number of received bytes */
+#define GROUP_CNT_PACKETS	1	/* Number of received packets */
+
 /* The node used to hold the groups we joined */
 struct groupnode
 {
 	struct in6_addr	mca;		/* The Multicast IPv6 address (group) */
-	struct list	*interfaces;	/* The list of grpint nodes (interfaces) that */
+	struct list	interfaces;	/* The list of grpint nodes (interfaces) that */
 					/* are interrested in this node */
 	time_t		lastforward;	/* The last time we forwarded a report for this group */
-	uint64_t	bytes;		/* Number of received bytes */
-	uint64_t	packets;	/* Number of received packets */
+	uint64_t	counters;	/* Counter block, GROUP_CNT_* */
+
+	/*
+	 * Outgoing interface list (OIL), compiled from the
+	 * subscriptions whenever the membership changes
+	 */
+	struct intnode	**oil;		/* Interfaces that want any source (ASM) */
+	uint64_t	oil_count;	/* Number of interfaces in oil */
+	struct oilsrc	*oil_src;	/* Interfaces per specific source (SSM), sorted on src */
+	uint64_t	oil_srccount;	/* Number of sources in oil_src */
+	struct hashtable *oil_srchash;	/* oil_src by source, NULL when only a few or SSM */
+	bool		oil_dirty;	/* Membership changed, oil needs a rebuild */
+	struct list	routes;		/* The routes installed in the kernel, see mrt.h */
 };
 
 void group_destroy(struct groupnode *groupn);
 struct groupnode *group_find(const struct in6_addr *mca);
 struct grpintnode *groupint_get(const struct in6_addr *mca, struct intnode *interface, bool *isnew);
+void group_oil_build(struct groupnode *groupn);
+struct oilsrc *group_oil_find(const struct groupnode *groupn, const struct in6_addr *src);
+struct oilsrc *channel_find(const struct in6_addr *sg);
+void group_oil_update(struct groupnode *groupn);
+bool groupint_delete(struct grpintnode *grpintn);
+void groupint_expire(struct grpintnode *grpintn);
@@ -5,18 +5,43 @@
 
 #include "ecmh.h"
 
-struct grpintnode *grpint_create(const struct intnode *interface)
+/* Nobody listened anymore, remove it when it is still empty */
+static void grpint_expire(void *data);
+static void grpint_expire(void *data)
 {
-	struct grpintnode *grpintn = calloc(1, sizeof(*grpintn));
+	groupint_expire((struct grpintnode *)data);
+}
+
+/* A subscription wasn't refreshed in time */
+static void grpint_subscr_expire(void *data);
+static void grpint_subscr_expire(void *data)
+{
+	struct subscrnode	*subscrn = (struct subscrnode *)data;
+	struct grpintnode	*grpintn = subscrn->grpintn;
+
+	/* Dead too long -> delete it */
+	subscr_del(grpintn, subscrn);
+
+	/* Membership changed */
+	grpintn->groupn->oil_dirty = true;
+
+	groupint_expire(grpintn);
+}
+
+struct grpintnode *grpint_create(struct intnode *interface)
+{
+	struct grpintnode *grpintn = pool_alloc(&g_conf->pool_grpint);
 
 	if (!grpintn) return NULL;
 
 	/* Fill her in */
-	grpintn->ifindex = interface->ifindex;
+	grpintn->interface = interface;
+
+	/* Setup the list, the subscriptions carry their own node */
+	grpintn->subscriptions.del = (void(*)(void *))subscr_destroy;
+	grpintn->subscriptions.embedded = true;
 
-	/* Setup the list */
-	grpintn->subscriptions = list_new();
-	grpintn->subscriptions->del = (void(*)(void *))subscr_destroy;
+	timer_init(&grpintn->timer, grpint_expire, grpintn);
 
 	/* All okay */
 	return grpintn;
@@ -26,11 +51,17 @@ void grpint_destroy(struct grpintnode *grpintn)
 {
 	if (!grpintn) return;
 
+	timer_del(&grpintn->timer);
+
+	/* Not joined on the interface anymore */
+	list_delete_node(&grpintn->interface->info.groups, &grpintn->ifnode);
+
 	/* Empty the subscriber list */
-	list_delete_all_node(grpintn->subscriptions);
+	hash_free(grpintn->subscrhash);
+	list_delete_all_node(&grpintn->subscriptions);
 
 	/* Free the node */
-	free(grpintn);
+	pool_free(&g_conf->pool_grpint, grpintn);
 }
 
 struct grpintnode *grpint_find(const struct list *list, const struct intnode *interface)
@@ -40,7 +71,7 @@ struct grpintnode *grpint_find(const struct list *list, const struct intnode *in
 
 	LIST_LOOP(list, grpintn, ln)
 	{
-		if (grpintn->ifindex == interface->ifindex) return grpintn;
+		if (grpintn->interface == interface) return grpintn;
 	}
 	return NULL;
 }
@@ -56,7 +87,7 @@ bool grpint_refresh(struct grpintnode *grpintn, const struct in6_addr *ipv6, uns
 	struct subscrnode *subscrn;
 
 	/* Find our beloved group */
-	subscrn = subscr_find(grpintn->subscriptions, ipv6);
+	subscrn = subscr_find(grpintn, ipv6);
 
 	/* Exclude all ? -> Unsubscribe */
 	if (	mode == MLD2_MODE_IS_EXCLUDE &&
@@ -78,7 +109,11 @@ bool grpint_refresh(struct grpintnode *grpintn, const struct in6_addr *ipv6, uns
 		/* Add the group to the list */
 		if (subscrn)
 		{
-			listnode_add(grpintn->subscriptions, (void *)subscrn);
+			subscr_add(grpintn, subscrn);
+			timer_init(&subscrn->timer, grpint_subscr_expire, subscrn);
+
+			/* Membership changed */
+			grpintn->groupn->oil_dirty = true;
 		}
 	}
 
@@ -89,12 +124,25 @@ bool grpint_refresh(struct grpintnode *grpintn, const struct in6_addr *ipv6, uns
 	{
 		dolog(LOG_DEBUG, "grpint_refresh() - Mode changed from %" PRIu64 " to %u\n", subscrn->mode, mode);
 		subscrn->mode = mode;
+
+		/* Membership changed */
+		grpintn->groupn->oil_dirty = true;
 	}
 
 	/* Refresh it */
-	subscrn->refreshtime = time(NULL);
+	subscrn->refreshtime = getmonotimes();
+	timer_set(&subscrn->timer, subscrn->refreshtime + (ECMH_SUBSCRIPTION_TIMEOUT * ECMH_ROBUSTNESS_FACTOR) + 1);
 
 	/* All Okay */
 	return true;
 }
 
+/*
+ * The last listener left (MLDv1 Done), the node is removed
+ * when nobody answered the query by the time the timer fires
+ */
+void grpint_leave(struct grpintnode *grpintn)
+{
+	timer_set(&grpintn->timer, getmonotimes() + ECMH_SUBSCRIPTION_TIMEOUT);
+}
+
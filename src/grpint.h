@@ -3,15 +3,27 @@
  by Jeroen Massar <jeroen@massar.ch>
 **************************************/
 
+/*
+ * Once an interface has this many subscriptions for a group
+ * they are also kept in a hash on their source address
+ */
+#define GRPINT_SUBSCR_HASHMIN	8
+
 /* The node used to hold the interfaces which a group joined */
 struct grpintnode
 {
-	uint64_t		ifindex;		/* The interface */
-	struct list		*subscriptions;		/* Subscriber list */
+	struct intnode		*interface;		/* The interface */
+	struct list		subscriptions;		/* Subscriber list (embedded nodes) */
+	struct hashtable	*subscrhash;		/* The subscriptions by source, NULL when only a few */
+	struct groupnode	*groupn;		/* The group this node belongs to */
+	struct listnode		node;			/* Our node in groupn->interfaces */
+	struct listnode		ifnode;			/* Our node in interface->info.groups */
+	struct timer		timer;			/* Reaps the node after the last listener left */
 };
 
-struct grpintnode *grpint_create(const struct intnode *interface);
+struct grpintnode *grpint_create(struct intnode *interface);
 void grpint_destroy(struct grpintnode *grpintn);
 struct grpintnode *grpint_find(const struct list *list, const struct intnode *interface);
 bool grpint_refresh(struct grpintnode *grpintn, const struct in6_addr *ipv6, unsigned int mode);
+void grpint_leave(struct grpintnode *grpintn);
 
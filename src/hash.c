@@ -0,0 +1,270 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+/* Initial number of slots, must be a power of 2 */
+#define HASH_MINSIZE	64
+
+/* Number of old slots that are moved over on every add */
+#define HASH_MIGRATE	16
+
+/* Marker for a slot of which the element got removed */
+static char hash_deleted;
+#define HASH_DELETED	((void *)&hash_deleted)
+
+/* Hash the key, folding it 32 bits at a time */
+static uint32_t hash_key(const struct hashtable *hash, const void *key);
+static uint32_t hash_key(const struct hashtable *hash, const void *key)
+{
+	const uint8_t	*k = (const uint8_t *)key;
+	uint32_t	h = 0x9e3779b9, w;
+	uint64_t	i;
+
+	for (i = 0; i < hash->keylen; i += sizeof(w))
+	{
+		memcpy(&w, &k[i], sizeof(w));
+
+		w *= 0xcc9e2d51;
+		w  = (w << 15) | (w >> 17);
+		w *= 0x1b873593;
+
+		h ^= w;
+		h  = (h << 13) | (h >> 19);
+		h  = (h * 5) + 0xe6546b64;
+	}
+
+	/* Final avalanche */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static bool hash_match(const struct hashtable *hash, const void *val, const void *key);
+static bool hash_match(const struct hashtable *hash, const void *val, const void *key)
+{
+	return (memcmp(((const uint8_t *)val) + hash->keyoff, key, hash->keylen) == 0);
+}
+
+/* Find the slot holding key in one table, NULL when it is not there */
+static void **hash_lookup(const struct hashtable *hash, void **slots, uint64_t size, const void *key, uint32_t h);
+static void **hash_lookup(const struct hashtable *hash, void **slots, uint64_t size, const void *key, uint32_t h)
+{
+	uint64_t	i, n;
+
+	for (n = 0, i = h & (size - 1); n < size; n++, i = (i + 1) & (size - 1))
+	{
+		if (slots[i] == NULL) break;
+		if (slots[i] == HASH_DELETED) continue;
+		if (hash_match(hash, slots[i], key)) return &slots[i];
+	}
+
+	return NULL;
+}
+
+/* Put an element in the current table, there must be room for it */
+static void hash_place(struct hashtable *hash, void *val, uint32_t h);
+static void hash_place(struct hashtable *hash, void *val, uint32_t h)
+{
+	uint64_t	i;
+
+	for (i = h & (hash->size - 1); ; i = (i + 1) & (hash->size - 1))
+	{
+		if (hash->slots[i] == NULL)
+		{
+			hash->used++;
+			break;
+		}
+
+		/* Reuse deleted slots */
+		if (hash->slots[i] == HASH_DELETED) break;
+	}
+
+	hash->slots[i] = val;
+}
+
+/* Move up to 'max' slots of the old table into the current one */
+static void hash_migrate(struct hashtable *hash, uint64_t max);
+static void hash_migrate(struct hashtable *hash, uint64_t max)
+{
+	void		*val;
+
+	while (hash->old && max > 0)
+	{
+		if (hash->oldpos >= hash->oldsize)
+		{
+			/* Migration finished */
+			free(hash->old);
+			hash->old = NULL;
+			hash->oldsize = 0;
+			hash->oldpos = 0;
+			break;
+		}
+
+		val = hash->old[hash->oldpos];
+		max--;
+
+		/* Gone from the old table, deleted as later slots might probe past it */
+		if (val != NULL) hash->old[hash->oldpos] = HASH_DELETED;
+		hash->oldpos++;
+
+		if (val == NULL || val == HASH_DELETED) continue;
+
+		hash_place(hash, val, hash_key(hash, ((uint8_t *)val) + hash->keyoff));
+	}
+}
+
+/* Start moving everything over to a new table */
+static bool hash_grow(struct hashtable *hash);
+static bool hash_grow(struct hashtable *hash)
+{
+	void		**slots;
+	uint64_t	size = hash->size;
+
+	/* Finish any migration that is still going on */
+	hash_migrate(hash, hash->oldsize + 1);
+
+	/* Mostly deleted slots? Then only clean up, otherwise double */
+	if ((uint64_t)(hash->count * 4) >= size) size *= 2;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots) return false;
+
+	hash->old	= hash->slots;
+	hash->oldsize	= hash->size;
+	hash->oldpos	= 0;
+
+	hash->slots	= slots;
+	hash->size	= size;
+	hash->used	= 0;
+
+	return true;
+}
+
+/* Allocate a new hash table */
+struct hashtable *hash_new(uint64_t keyoff, uint64_t keylen)
+{
+	struct hashtable *hash;
+
+	assert(keylen > 0 && (keylen % sizeof(uint32_t)) == 0);
+
+	hash = calloc(1, sizeof(*hash));
+	if (!hash) return NULL;
+
+	hash->slots = calloc(HASH_MINSIZE, sizeof(*hash->slots));
+	if (!hash->slots)
+	{
+		free(hash);
+		return NULL;
+	}
+
+	hash->size	= HASH_MINSIZE;
+	hash->keyoff	= keyoff;
+	hash->keylen	= keylen;
+
+	return hash;
+}
+
+/* Free the hash table, the elements should be gone already */
+void hash_free(struct hashtable *hash)
+{
+	if (!hash) return;
+
+	free(hash->old);
+	free(hash->slots);
+	free(hash);
+}
+
+/* Delete all the elements from the table */
+void hash_delete_all(struct hashtable *hash)
+{
+	void		*val;
+	uint64_t	i;
+
+	HASH_LOOP(hash, val, i)
+	{
+		if (hash->del) (*hash->del)(val);
+	}
+
+	free(hash->old);
+	hash->old = NULL;
+	hash->oldsize = 0;
+	hash->oldpos = 0;
+
+	memzero(hash->slots, hash->size * sizeof(*hash->slots));
+	hash->used = 0;
+	hash->count = 0;
+}
+
+void *hash_find(const struct hashtable *hash, const void *key)
+{
+	void		**slot;
+	uint32_t	h = hash_key(hash, key);
+
+	slot = hash_lookup(hash, hash->slots, hash->size, key, h);
+	if (!slot && hash->old) slot = hash_lookup(hash, hash->old, hash->oldsize, key, h);
+
+	return slot ? *slot : NULL;
+}
+
+/* Add an element, the caller makes sure the key is not present yet */
+bool hash_add(struct hashtable *hash, void *val)
+{
+	/* Keep a running migration going */
+	hash_migrate(hash, HASH_MIGRATE);
+
+	/* Keep the load factor below 1/2 */
+	if ((hash->used + 1) * 2 > hash->size)
+	{
+		/* Can't grow but still room? Just be slower */
+		if (!hash_grow(hash) && hash->used + 1 >= hash->size) return false;
+	}
+
+	hash_place(hash, val, hash_key(hash, ((uint8_t *)val) + hash->keyoff));
+	hash->count++;
+
+	return true;
+}
+
+/* Remove an element from the table, it is not freed */
+bool hash_remove(struct hashtable *hash, const void *val)
+{
+	void		**slot;
+	const void	*key = ((const uint8_t *)val) + hash->keyoff;
+	uint32_t	h = hash_key(hash, key);
+
+	slot = hash_lookup(hash, hash->slots, hash->size, key, h);
+	if ((!slot || *slot != val) && hash->old) slot = hash_lookup(hash, hash->old, hash->oldsize, key, h);
+	if (!slot || *slot != val) return false;
+
+	*slot = HASH_DELETED;
+	hash->count--;
+
+	return true;
+}
+
+/*
+ * Return the element at or after *iter and move *iter past it
+ * The current table is walked first, then the old one
+ */
+void *hash_next(const struct hashtable *hash, uint64_t *iter)
+{
+	void		*val;
+
+	while (*iter < hash->size + hash->oldsize)
+	{
+		val = (*iter < hash->size) ? hash->slots[*iter] : hash->old[*iter - hash->size];
+		(*iter)++;
+
+		if (val != NULL && val != HASH_DELETED) return val;
+	}
+
+	return NULL;
+}
+
@@ -0,0 +1,55 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Open addressing hash table
+ *
+ * The table only holds pointers to the elements, the key lives
+ * inside the element at 'keyoff' and is 'keylen' bytes long.
+ *
+ * When the table gets too full a new table is allocated and every
+ * following add moves a few slots of the old table over, this way
+ * a resize never has to rehash everything at once.
+ * Lookups check both tables while such a migration is running.
+ */
+
+#ifndef __HASH_H
+#define __HASH_H
+
+struct hashtable
+{
+	void		**slots;	/* The current table */
+	uint64_t	size;		/* Number of slots in the table (power of 2) */
+	uint64_t	used;		/* Slots in use (live + deleted) */
+	void		**old;		/* The table we are migrating away from */
+	uint64_t	oldsize;	/* Number of slots in the old table */
+	uint64_t	oldpos;		/* How far the migration got */
+	int64_t		count;		/* Number of elements in the table */
+	uint64_t	keyoff;		/* Offset of the key inside the element */
+	uint64_t	keylen;		/* Length of the key (multiple of 4) */
+	void		(*del)(void *val);
+};
+
+#define hashcount(X)	((X)->count)
+
+/* Prototypes. */
+struct hashtable	*hash_new(uint64_t keyoff, uint64_t keylen);
+void			hash_free(struct hashtable *);
+void			hash_delete_all(struct hashtable *);
+void			*hash_find(const struct hashtable *, const void *key);
+bool			hash_add(struct hashtable *, void *val);
+bool			hash_remove(struct hashtable *, const void *val);
+void			*hash_next(const struct hashtable *, uint64_t *iter);
+
+/*
+ * Hash iteration macro.
+ * The current element may be removed while looping,
+ * but nothing may be added to the table.
+ */
+#define HASH_LOOP(H,V,I) \
+  for ((I) = 0; ((V) = hash_next((H), &(I))) != NULL;)
+
+#endif /* __HASH_H */
+
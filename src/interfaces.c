@@ -6,6 +6,87 @@
 #include "ecmh.h"
 
 #ifdef ECMH_BPF
+/*
+ * Only let IPv6 with a multicast destination through the BPF,
+ * and in tunnel mode also proto-41 carrying such a packet.
+ * The link header is either Ethernet (EtherType tells what follows)
+ * or Null (host order address family, thus check the IP version).
+ */
+#define BPF_ETH(x)	(sizeof(struct ether_header) + (x))
+#define BPF_NULL(x)	(sizeof(uint32_t) + (x))
+#define BPF_V6DST	offsetof(struct ip6_hdr, ip6_dst)
+#define BPF_V4PROTO	offsetof(struct ip, ip_p)
+
+static struct bpf_insn int_filter_eth[] =
+{
+	BPF_STMT(BPF_LD  + BPF_H   + BPF_ABS, 12),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETHERTYPE_IPV6, 0, 2),
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, BPF_ETH(BPF_V6DST)),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xff, 6, 7),
+	/* Replaced by a drop when not in tunnel mode */
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETHERTYPE_IP, 0, 6),
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, BPF_ETH(BPF_V4PROTO)),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_IPV6, 0, 4),
+	BPF_STMT(BPF_LDX + BPF_B   + BPF_MSH, BPF_ETH(0)),
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_IND, BPF_ETH(BPF_V6DST)),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xff, 0, 1),
+	BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+#define INT_FILTER_ETH_V4	4
+
+static struct bpf_insn int_filter_null[] =
+{
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, BPF_NULL(0)),
+	BPF_STMT(BPF_ALU + BPF_RSH + BPF_K, 4),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 6, 0, 2),
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, BPF_NULL(BPF_V6DST)),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xff, 6, 7),
+	/* Replaced by a drop when not in tunnel mode */
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 4, 0, 6),
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, BPF_NULL(BPF_V4PROTO)),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_IPV6, 0, 4),
+	BPF_STMT(BPF_LDX + BPF_B   + BPF_MSH, BPF_NULL(0)),
+	BPF_STMT(BPF_LD  + BPF_B   + BPF_IND, BPF_NULL(BPF_V6DST)),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xff, 0, 1),
+	BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+#define INT_FILTER_NULL_V4	5
+
+static bool int_filter_bpf(struct intnode *intn);
+static bool int_filter_bpf(struct intnode *intn)
+{
+	struct bpf_program	prog;
+	struct bpf_insn		insns[sizeof(int_filter_null)/sizeof(int_filter_null[0])]; /* The longest */
+	struct bpf_insn		drop = BPF_STMT(BPF_RET + BPF_K, 0);
+
+	memzero(&prog, sizeof(prog));
+
+	if (intn->info.dlt == DLT_EN10MB)
+	{
+		memcpy(insns, int_filter_eth, sizeof(int_filter_eth));
+		prog.bf_len = sizeof(int_filter_eth)/sizeof(int_filter_eth[0]);
+		if (!g_conf->tunnelmode) insns[INT_FILTER_ETH_V4] = drop;
+	}
+	else
+	{
+		memcpy(insns, int_filter_null, sizeof(int_filter_null));
+		prog.bf_len = sizeof(int_filter_null)/sizeof(int_filter_null[0]);
+		if (!g_conf->tunnelmode) insns[INT_FILTER_NULL_V4] = drop;
+	}
+
+	prog.bf_insns = insns;
+
+	if (ioctl(intn->socket, BIOCSETF, &prog))
+	{
+		dolog(LOG_WARNING, "Could not set a BPF filter on %s: %s (%d)\n", intn->info.name, strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
 static bool int_create_bpf(struct intnode *intn, bool tunnel);
 static bool int_create_bpf(struct intnode *intn, bool tunnel)
 {
@@ -33,71 +114,74 @@ static bool int_create_bpf(struct intnode *intn, bool tunnel)
 		}
 		if (intn->socket < 0)
 		{
-			dolog(LOG_ERR, "Couldn't open a new BPF device for %s\n", intn->name);
+			dolog(LOG_ERR, "Couldn't open a new BPF device for %s\n", intn->info.name);
 			return false;
 		}
 
-		dolog(LOG_INFO, "Opened %s as a BPF device for %s\n", devname, intn->name);
+		dolog(LOG_INFO, "Opened %s as a BPF device for %s\n", devname, intn->info.name);
 
 		/* Bind it to the interface */
 		memzero(&ifr, sizeof(ifr));
-		strncpy(ifr.ifr_name, intn->name, sizeof(ifr.ifr_name));
+		strncpy(ifr.ifr_name, intn->info.name, sizeof(ifr.ifr_name));
 
 		if (ioctl(intn->socket, BIOCSETIF, &ifr))
 		{
-			dolog(LOG_ERR, "Could not bind BPF to %s: %s (%d)\n", intn->name, strerror(errno), errno);
+			dolog(LOG_ERR, "Could not bind BPF to %s: %s (%d)\n", intn->info.name, strerror(errno), errno);
 			return false;
 		}
-		dolog(LOG_INFO, "Bound BPF %s to %s\n", devname, intn->name);
+		dolog(LOG_INFO, "Bound BPF %s to %s\n", devname, intn->info.name);
 
 		if (g_conf->promisc)
 		{
 			if (ioctl(intn->socket, BIOCPROMISC))
 			{
-			 	dolog(LOG_ERR, "Could not set %s to promisc: %s (%d)\n", intn->name, strerror(errno), errno);
+			 	dolog(LOG_ERR, "Could not set %s to promisc: %s (%d)\n", intn->info.name, strerror(errno), errno);
 				return false;
 			}
-			dolog(LOG_INFO, "BPF interface for %s is now promiscious\n", intn->name);
+			dolog(LOG_INFO, "BPF interface for %s is now promiscious\n", intn->info.name);
 		}
 
 		if (fcntl(intn->socket, F_SETFL, O_NONBLOCK) < 0)
 		{
-			dolog(LOG_ERR, "Could not set %s to non_blocking: %s (%d)\n", intn->name, strerror(errno), errno);
+			dolog(LOG_ERR, "Could not set %s to non_blocking: %s (%d)\n", intn->info.name, strerror(errno), errno);
 			return false;
 		}
 
 		i = 1;
 		if (ioctl(intn->socket, BIOCIMMEDIATE, &i))
 		{
-			dolog(LOG_ERR, "Could not set %s to immediate: %s (%d)\n", intn->name, strerror(errno), errno);
+			dolog(LOG_ERR, "Could not set %s to immediate: %s (%d)\n", intn->info.name, strerror(errno), errno);
 			return false;
 		}
 
-		if (ioctl(intn->socket, BIOCGDLT, &intn->dlt))
+		if (ioctl(intn->socket, BIOCGDLT, &intn->info.dlt))
 		{
-			dolog(LOG_ERR, "Could not get %s's DLT: %s (%d)\n", intn->name, strerror(errno), errno);
+			dolog(LOG_ERR, "Could not get %s's DLT: %s (%d)\n", intn->info.name, strerror(errno), errno);
 			return false;
 		}
-		if (intn->dlt != DLT_NULL && intn->dlt != DLT_EN10MB)
+		if (intn->info.dlt != DLT_NULL && intn->info.dlt != DLT_EN10MB)
 		{
-		 	dolog(LOG_ERR, "Only NULL and EN10MB (Ethernet) DLT are supported as DLTs, this DLT is %" PRIu64 "\n", intn->dlt);
+		 	dolog(LOG_ERR, "Only NULL and EN10MB (Ethernet) DLT are supported as DLTs, this DLT is %" PRIu64 "\n", intn->info.dlt);
 			return false;
 		}
-		dolog(LOG_INFO, "BPF's DLT is %s\n", intn->dlt == DLT_EN10MB ? "Ethernet" : (intn->dlt == DLT_NULL ? "Null" : "??"));
+		dolog(LOG_INFO, "BPF's DLT is %s\n", intn->info.dlt == DLT_EN10MB ? "Ethernet" : (intn->info.dlt == DLT_NULL ? "Null" : "??"));
 
-		if (ioctl(intn->socket, BIOCGBLEN, &intn->bufferlen))
+		/* Not fatal, everything is checked again when received */
+		int_filter_bpf(intn);
+
+		if (ioctl(intn->socket, BIOCGBLEN, &intn->info.bufferlen))
 		{
-			dolog(LOG_ERR, "Could not get %s's BufferLen: %s (%d)\n", intn->name, strerror(errno), errno);
+			dolog(LOG_ERR, "Could not get %s's BufferLen: %s (%d)\n", intn->info.name, strerror(errno), errno);
 			return false;
 		}
 
-		dolog(LOG_INFO, "BPF's bufferLength is %" PRIu64 "\n", intn->bufferlen);
+		dolog(LOG_INFO, "BPF's bufferLength is %" PRIu64 "\n", intn->info.bufferlen);
 
 		/* Is this buffer bigger than what we have allocated? -> Upgrade */
-		if (intn->bufferlen > g_conf->bufferlen)
+		if (intn->info.bufferlen > g_conf->bufferlen)
 		{
 			free(g_conf->buffer);
-			g_conf->bufferlen = intn->bufferlen;
+			g_conf->bufferlen = intn->info.bufferlen;
 			g_conf->buffer = calloc(1, g_conf->bufferlen);
 			if (!g_conf->buffer)
 			{
@@ -128,7 +212,7 @@ static bool int_create_bpf(struct intnode *intn, bool tunnel)
 		}
 
 		memzero(&iflr, sizeof(iflr));
-		strncpy(iflr.iflr_name, intn->name, sizeof(iflr.iflr_name));
+		strncpy(iflr.iflr_name, intn->info.name, sizeof(iflr.iflr_name));
  
 		/*
 		 * This a tunnel, find out based on it's src ip
@@ -137,7 +221,7 @@ static bool int_create_bpf(struct intnode *intn, bool tunnel)
 		if (ioctl(sock, SIOCGLIFPHYADDR, &iflr))
 		{
 			dolog(LOG_ERR, "Could not get GIF Addresses of tunnel %s: %s (%d)\n",
-				intn->name, strerror(errno), errno);
+				intn->info.name, strerror(errno), errno);
 			close(sock);
 			return false;
 		}
@@ -149,7 +233,7 @@ static bool int_create_bpf(struct intnode *intn, bool tunnel)
 		{
 			char buf[1024];
 			inet_ntop(AF_INET, &((struct sockaddr_in *)&iflr.addr)->sin_addr, (char *)&buf, sizeof(buf));
-			dolog(LOG_ERR, "Couldn't find the master device for %s (%s)\n", intn->name, buf);
+			dolog(LOG_ERR, "Couldn't find the master device for %s (%s)\n", intn->info.name, buf);
 			return false;
 		}
 
@@ -161,6 +245,38 @@ static bool int_create_bpf(struct intnode *intn, bool tunnel)
 }
 #endif /* ECMH_BPF */
 
+#ifdef ECMH_SUPPORT_MLD2
+/* No MLDv1 seen for a while, allow upgrades again */
+static void int_mld_expire(void *data);
+static void int_mld_expire(void *data)
+{
+	struct intnode *intn = (struct intnode *)data;
+
+	dolog(LOG_DEBUG, "MLDv1 has not been seen for %u seconds on %s, allowing upgrades\n",
+		ECMH_SUBSCRIPTION_TIMEOUT, intn->info.name);
+
+	/* Reset the version */
+	intn->info.mld_version = 0;
+	intn->info.mld_last_v1 = 0;
+}
+#endif
+
+/* (Re-)arm the MLD version timer, if there is something to time out */
+static void int_mld_timer(struct intnode *intn);
+static void int_mld_timer(struct intnode *intn)
+{
+#ifdef ECMH_SUPPORT_MLD2
+	timer_init(&intn->info.mld_timer, int_mld_expire, intn);
+
+	if (intn->info.mld_last_v1 != 0)
+	{
+		timer_set(&intn->info.mld_timer, intn->info.mld_last_v1 + ECMH_SUBSCRIPTION_TIMEOUT + 1);
+	}
+#else
+	timer_init(&intn->info.mld_timer, NULL, intn);
+#endif
+}
+
 #ifndef ECMH_BPF
 struct intnode *int_create(unsigned int ifindex)
 #else
@@ -170,26 +286,58 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 	struct intnode	*intn = NULL;
 	struct ifreq	ifreq;
 	int		sock;
+	uint64_t	page, i;
+
+	/* Make room in the map for this ifindex */
+	page = ifindex >> INT_MAP_BITS;
+	if (page >= g_conf->intmap_pages)
+	{
+		g_conf->intmap = (struct intnode ***)realloc(g_conf->intmap, sizeof(*g_conf->intmap)*(page+1));
+		if (!g_conf->intmap)
+		{
+			dolog(LOG_ERR, "Couldn't init() - no memory for interface map.\n");
+			exit(-1);
+		}
 
-	/* Resize the interface array if needed */
-	if ((ifindex+1) > g_conf->maxinterfaces)
+		for (i = g_conf->intmap_pages; i <= page; i++) g_conf->intmap[i] = NULL;
+		g_conf->intmap_pages = page+1;
+	}
+
+	if (!g_conf->intmap[page])
 	{
-		g_conf->ints = (struct intnode *)realloc(g_conf->ints, sizeof(struct intnode)*(ifindex+1));
+		g_conf->intmap[page] = (struct intnode **)calloc(INT_MAP_SIZE, sizeof(**g_conf->intmap));
+		if (!g_conf->intmap[page])
+		{
+			dolog(LOG_ERR, "Couldn't init() - no memory for interface map.\n");
+			exit(-1);
+		}
+	}
 
+	/* Make room in the active list */
+	if (g_conf->intcount == g_conf->intsize)
+	{
+		g_conf->intsize = g_conf->intsize ? g_conf->intsize*2 : 16;
+		g_conf->ints = (struct intnode **)realloc(g_conf->ints, sizeof(*g_conf->ints)*g_conf->intsize);
 		if (!g_conf->ints)
 		{
 			dolog(LOG_ERR, "Couldn't init() - no memory for interface array.\n");
 			exit(-1);
 		}
+	}
 
-		/* Clear out the new memory */
-		memzero(&g_conf->ints[g_conf->maxinterfaces], sizeof(struct intnode)*((ifindex+1)-g_conf->maxinterfaces));
-
-		/* Configure the new maximum */
-		g_conf->maxinterfaces = (ifindex+1);
+	/* The node never moves, the outgoing interface lists point to it */
+	intn = (struct intnode *)pool_alloc(&g_conf->pool_int);
+	if (!intn)
+	{
+		dolog(LOG_ERR, "Couldn't allocate interface %u\n", ifindex);
+		return NULL;
 	}
 
-	intn = &g_conf->ints[ifindex];
+	if (!counter_alloc(&intn->info.counters))
+	{
+		pool_free(&g_conf->pool_int, intn);
+		return NULL;
+	}
 
 #ifndef ECMH_BPF
 	dolog(LOG_DEBUG, "Creating new interface %u\n", ifindex);
@@ -201,15 +349,19 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 	if (sock < 0)
 	{
 		dolog(LOG_ERR, "Couldn't create tempory socket for ioctl's\n");
+		counter_free(intn->info.counters);
+		pool_free(&g_conf->pool_int, intn);
 		return NULL;
 	}
 
-	memzero(intn, sizeof(*intn));
-
 	intn->ifindex = ifindex;
 
+	/* The grpints carry their own node */
+	intn->info.groups.embedded = true;
+
 	/* Default to 0, we discover this after the queries has been sent */
-	intn->mld_version = 0;
+	intn->info.mld_version = 0;
+	int_mld_timer(intn);
 
 #ifdef ECMH_BPF
 	intn->socket = -1;
@@ -223,7 +375,7 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 	ifreq.ifr_ifindex = ifindex;
 	if (ioctl(sock, SIOCGIFNAME, &ifreq) != 0)
 #else
-	if (if_indextoname(ifindex, intn->name) == NULL)
+	if (if_indextoname(ifindex, intn->info.name) == NULL)
 #endif
 	{
 		dolog(LOG_ERR, "Couldn't determine interfacename of link %" PRIu64 " : %s\n", intn->ifindex, strerror(errno));
@@ -234,17 +386,17 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 
 #ifdef SIOCGIFNAME
 	/* We just requested the name, use it */
-	memcpy(&intn->name, &ifreq.ifr_name, sizeof(intn->name));
+	memcpy(&intn->info.name, &ifreq.ifr_name, sizeof(intn->info.name));
 #else
 	/* Put the name in the request */
-	memcpy(&ifreq.ifr_name, &intn->name, sizeof(ifreq.ifr_name));
+	memcpy(&ifreq.ifr_name, &intn->info.name, sizeof(ifreq.ifr_name));
 #endif
 
 	/* Get the MTU size of this interface */
 	/* We will use that for fragmentation */
 	if (ioctl(sock, SIOCGIFMTU, &ifreq) != 0)
 	{
-		dolog(LOG_ERR, "Couldn't determine MTU size for %s, link %" PRIu64 " : %s\n", intn->name, intn->ifindex, strerror(errno));
+		dolog(LOG_ERR, "Couldn't determine MTU size for %s, link %" PRIu64 " : %s\n", intn->info.name, intn->ifindex, strerror(errno));
 		int_destroy(intn);
 		close(sock);
 		return NULL;
@@ -252,7 +404,7 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 
 	if (ifreq.ifr_mtu < 1280)
 	{
-		dolog(LOG_ERR, "MTU size for %s is %u which is less than the IPv6 minimum of 1280\n", intn->name, ifreq.ifr_mtu);
+		dolog(LOG_ERR, "MTU size for %s is %u which is less than the IPv6 minimum of 1280\n", intn->info.name, ifreq.ifr_mtu);
 		int_destroy(intn);
 		close(sock);
 		return NULL;
@@ -265,17 +417,31 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 	/* Get hardware address + type */
 	if (ioctl(sock, SIOCGIFHWADDR, &ifreq) != 0)
 	{
-		dolog(LOG_ERR, "Couldn't determine hardware address for %s, link %" PRIu64 " : %s\n", intn->name, intn->ifindex, strerror(errno));
+		dolog(LOG_ERR, "Couldn't determine hardware address for %s, link %" PRIu64 " : %s\n", intn->info.name, intn->ifindex, strerror(errno));
 		int_destroy(intn);
 		close(sock);
 		return NULL;
 	}
-	memcpy(&intn->hwaddr, &ifreq.ifr_hwaddr, sizeof(intn->hwaddr));
+	memcpy(&intn->info.hwaddr, &ifreq.ifr_hwaddr, sizeof(intn->info.hwaddr));
+
+	/*
+	 * Prebuild the destination used for sending, only
+	 * the last 4 bytes of the MAC depend on the packet
+	 * (33:33 + the low 32 bits of the group, RFC2464)
+	 */
+	intn->txaddr.sll_family		= AF_PACKET;
+	intn->txaddr.sll_protocol	= htons(ETH_P_IPV6);
+	intn->txaddr.sll_ifindex	= intn->ifindex;
+	intn->txaddr.sll_hatype		= intn->info.hwaddr.sa_family;
+	intn->txaddr.sll_pkttype	= 0;
+	intn->txaddr.sll_halen		= 6;
+	intn->txaddr.sll_addr[0]	= 0x33;
+	intn->txaddr.sll_addr[1]	= 0x33;
 #endif
 
 #ifndef ECMH_BPF
 	/* Ignore Loopback devices */
-	if (intn->hwaddr.sa_family == ARPHRD_LOOPBACK)
+	if (intn->info.hwaddr.sa_family == ARPHRD_LOOPBACK)
 	{
 		int_destroy(intn);
 		close(sock);
@@ -298,12 +464,12 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 		int err;
 
 		memzero(&ifr, sizeof(ifr));
-		strncpy(ifr.ifr_name, intn->name, sizeof(ifr.ifr_name));
+		strncpy(ifr.ifr_name, intn->info.name, sizeof(ifr.ifr_name));
 		err = ioctl(sock, SIOCGIFFLAGS, &ifr);
 		if (err != 0)
 		{
 			dolog(LOG_WARNING, "Couldn't get interface flags of %s/%" PRIu64 ": %s\n",
-				intn->name, intn->ifindex, strerror(errno));
+				intn->info.name, intn->ifindex, strerror(errno));
 		}
 		else
 		{
@@ -313,12 +479,12 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 			if (err != 0)
 			{
 				dolog(LOG_WARNING, "Couldn't get interface flags of %s/%" PRIu64 ": %s\n",
-					intn->name, intn->ifindex, strerror(errno));
+					intn->info.name, intn->ifindex, strerror(errno));
 			}
 			else
 			{
 				dolog(LOG_DEBUG, "Interface %s/%" PRIu64 " is now promiscuous\n",
-					intn->name, intn->ifindex);
+					intn->info.name, intn->ifindex);
 			}
 		}
 	}
@@ -328,20 +494,33 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel)
 	close(sock);
 
 	if (	g_conf->upstream &&
-		strcasecmp(intn->name, g_conf->upstream) == 0)
+		strcasecmp(intn->info.name, g_conf->upstream) == 0)
 	{
 		intn->upstream = true;
 		g_conf->upstream_id = intn->ifindex;
 	}
 	else intn->upstream = false;
 
-	/* All okay */
+	/* All okay, make it findable */
+	g_conf->intmap[page][ifindex & (INT_MAP_SIZE - 1)] = intn;
+	g_conf->ints[g_conf->intcount++] = intn;
+	intn->info.active = g_conf->intcount;
+
+#ifndef ECMH_BPF
+	/* Let the kernel forward from and to it */
+	mrt_int_add(intn);
+	tcfwd_int_add(intn);
+#endif
+
+	/* The backend might want to receive on it in it's own way */
+	if (g_conf->io->attach) g_conf->io->attach(intn);
+
 	return intn;
 }
 
 void int_destroy(struct intnode *intn)
 {
-D(	dolog(LOG_DEBUG, "Destroying interface %s\n", intn->name);)
+D(	dolog(LOG_DEBUG, "Destroying interface %s\n", intn->info.name);)
 
 #ifdef ECMH_BPF
 	if (intn->socket != -1)
@@ -351,14 +530,89 @@ D(	dolog(LOG_DEBUG, "Destroying interface %s\n", intn->name);)
 	}
 #endif
 
+	timer_del(&intn->info.mld_timer);
+
+	/* Never made it into the lists? -> Nothing can point to it */
+	if (intn->info.active == 0)
+	{
+		counter_free(intn->info.counters);
+		pool_free(&g_conf->pool_int, intn);
+		return;
+	}
+
+	/* Not findable anymore */
+	g_conf->intmap[intn->ifindex >> INT_MAP_BITS][intn->ifindex & (INT_MAP_SIZE - 1)] = NULL;
+
+	/* Move the last active interface in it's place */
+	g_conf->intcount--;
+	g_conf->ints[intn->info.active - 1] = g_conf->ints[g_conf->intcount];
+	g_conf->ints[intn->info.active - 1]->info.active = intn->info.active;
+	intn->info.active = 0;
+
 	/* Resetting the MTU to zero disabled the interface */
 	intn->mtu = 0;
+
+#ifndef ECMH_BPF
+	/* And the kernel stops forwarding for it */
+	mrt_int_del(intn);
+	tcfwd_int_del(intn);
+#endif
+
+	if (g_conf->io->detach) g_conf->io->detach(intn);
+
+	/*
+	 * Outgoing interface lists and groups might still point
+	 * to it, we might be in the middle of walking one, thus
+	 * let the mainloop purge and rebuild them and free it after.
+	 * Till then the interface is skipped as it has no MTU.
+	 */
+	g_conf->intgone = true;
+	intn->info.nextdead = g_conf->intdead;
+	g_conf->intdead = intn;
+}
+
+/* Leave the groups the destroyed interfaces were joined to */
+void int_purge(void)
+{
+	struct intnode		*intn;
+	struct grpintnode	*grpintn;
+	struct groupnode	*groupn;
+
+	g_conf->intgone = false;
+
+	for (intn = g_conf->intdead; intn; intn = intn->info.nextdead)
+	{
+		while (intn->info.groups.head)
+		{
+			grpintn = (struct grpintnode *)getdata(intn->info.groups.head);
+			groupn = grpintn->groupn;
+
+			/* Only the groups it was in can have it in their OIL */
+			if (groupint_delete(grpintn)) group_oil_update(groupn);
+		}
+	}
+}
+
+/* Free the destroyed interfaces, nothing may point to them anymore */
+void int_reap(void)
+{
+	struct intnode *intn;
+
+	while (g_conf->intdead)
+	{
+		intn = g_conf->intdead;
+		g_conf->intdead = intn->info.nextdead;
+		counter_free(intn->info.counters);
+		pool_free(&g_conf->pool_int, intn);
+	}
 }
 
 struct intnode *int_find(unsigned int ifindex)
 {
-	if (ifindex >= g_conf->maxinterfaces || g_conf->ints[ifindex].mtu == 0) return NULL;
-	return &g_conf->ints[ifindex];
+	uint64_t page = ifindex >> INT_MAP_BITS;
+
+	if (page >= g_conf->intmap_pages || !g_conf->intmap[page]) return NULL;
+	return g_conf->intmap[page][ifindex & (INT_MAP_SIZE - 1)];
 }
 
 #ifdef ECMH_BPF
@@ -366,17 +620,10 @@ struct intnode *int_find_ipv4(bool local, struct in_addr *ipv4)
 {
 	struct intnode	*intn;
 	int		num = 0;
-	unsigned int	i;
+	uint64_t	i;
 
-	for (i = 0; i < g_conf->maxinterfaces; i++)
+	INT_LOOP(intn, i)
 	{
-		intn = &g_conf->ints[i];
-		/* Skip uninitialized interfaces */
-		if (intn->mtu == 0)
-		{
-			continue;
-		}
-
 		for (num = 0; num < INTNODE_MAXIPV4; num++)
 		{
 			if (memcmp(local ? &intn->ipv4_local[num] : &intn->ipv4_remote, ipv4, sizeof(*ipv4)) == 0)
@@ -419,38 +666,27 @@ void int_set_mld_version(struct intnode *intn, unsigned int newversion)
 		 * Only reset the version number
 		 * if it wasn't set and not v1 yet
 		 */
-		if (	intn->mld_version == 0 &&
-			intn->mld_version != 1)
+		if (	intn->info.mld_version == 0 &&
+			intn->info.mld_version != 1)
 		{
-			if (intn->mld_version > 1)
+			if (intn->info.mld_version > 1)
 			{
-				dolog(LOG_DEBUG, "MLDv1 Query detected on %s, downgrading from MLDv%" PRIu64 " to MLDv1\n", intn->name, intn->mld_version);
+				dolog(LOG_DEBUG, "MLDv1 Query detected on %s, downgrading from MLDv%" PRIu64 " to MLDv1\n", intn->info.name, intn->info.mld_version);
 			}
 			else
 			{
-				dolog(LOG_DEBUG, "MLDv1 detected on %s, setting it to MLDv1\n", intn->name);
+				dolog(LOG_DEBUG, "MLDv1 detected on %s, setting it to MLDv1\n", intn->info.name);
 			}
 
-			intn->mld_version = 1;
-			intn->mld_last_v1 = gettimes();
+			intn->info.mld_version = 1;
+			intn->info.mld_last_v1 = getmonotimes();
+			int_mld_timer(intn);
 		}
 	}
 #ifdef ECMH_SUPPORT_MLD2
 	else
 	{
-		/*
-		 * Current version = 1 and haven't seen a v1 for a while?
-		 * Reset the counter
-		 */
-		if (	intn->mld_last_v1 != 0 &&
-			(gettimes() > (intn->mld_last_v1 + ECMH_SUBSCRIPTION_TIMEOUT)))
-		{
-			dolog(LOG_DEBUG, "MLDv1 has not been seen for %" PRIu64 " seconds on %s, allowing upgrades\n", 
-				(intn->mld_last_v1 + ECMH_SUBSCRIPTION_TIMEOUT), intn->name);
-			/* Reset the version */
-			intn->mld_version = 0;
-			intn->mld_last_v1 = 0;
-		}
+		/* The upgrade after not seeing a v1 for a while is done by int_mld_expire() */
 
 		if (g_conf->mld1only)
 		{
@@ -463,20 +699,20 @@ void int_set_mld_version(struct intnode *intn, unsigned int newversion)
 		 * Only reset the version number
 		 * if it wasn't set and not v1 yet and not v2 yet
 		 */
-		if (	intn->mld_version == 0 &&
-			intn->mld_version != 1 &&
-			intn->mld_version != 2)
+		if (	intn->info.mld_version == 0 &&
+			intn->info.mld_version != 1 &&
+			intn->info.mld_version != 2)
 		{
 			dolog(LOG_DEBUG, "MLDv%u detected on %s/%" PRIu64 ", setting it to MLDv%u\n",
-				newversion, intn->name, intn->ifindex, newversion);
-			intn->mld_version = newversion;
+				newversion, intn->info.name, intn->ifindex, newversion);
+			intn->info.mld_version = newversion;
 		}
 	}
 #else /* ECMH_SUPPORT_MLD2 */
 	else
 	{
 		dolog(LOG_DEBUG, "MLDv%u detected on %s/%u while that version is not supported\n",
-			newversion, intn->name);
+			newversion, intn->info.name);
 	}
 #endif /* ECMH_SUPPORT_MLD2 */
 }
@@ -517,7 +753,7 @@ void local_update(struct intnode *intn)
 		/* Fill it in */
 		localn->intn = intn;
 
-		dolog(LOG_DEBUG, "Adding %s to local tunnel-intercepting-interfaces\n", intn->name);
+		dolog(LOG_DEBUG, "Adding %s to local tunnel-intercepting-interfaces\n", intn->info.name);
 
 		/* Add it to the list */
 		listnode_add(g_conf->locals, localn);
@@ -6,49 +6,82 @@
 #define INTNODE_MAXIPV4 4			/* Maximum number of IPv4 aliases */
 
 /*
- * The list of interfaces we do multicast on
- * These are discovered on the fly, very handy ;)
+ * Interfaces are found by ifindex through a two-level map, the pages
+ * of INT_MAP_SIZE pointers are only allocated for the ranges in use.
+ * The interfaces that are active are also kept in a dense array for
+ * walking over them, see INT_LOOP().
  */
-struct intnode
+#define INT_MAP_BITS	10
+#define INT_MAP_SIZE	(1 << INT_MAP_BITS)
+
+/* Per interface statistics, slots of intinfo.counters */
+#define INT_CNT_PACKETS_RECEIVED	0	/* Number of packets received */
+#define INT_CNT_PACKETS_SENT		1	/* Number of packets sent */
+#define INT_CNT_BYTES_RECEIVED		2	/* Number of bytes received */
+#define INT_CNT_BYTES_SENT		3	/* Number of bytes sent */
+#define INT_CNT_ICMP_RECEIVED		4	/* Number of ICMP's received */
+#define INT_CNT_ICMP_SENT		5	/* Number of ICMP's sent */
+
+/*
+ * The cold part of an interface: what describes it, the MLD
+ * state and the statistics, only the control context and the
+ * receive path look at these.
+ */
+struct intinfo
 {
-	uint64_t	ifindex;		/* The ifindex */
 	char		name[IFNAMSIZ];		/* Name of the interface */
-	uint64_t	groupcount;		/* Number of groups this interface joined */
-	uint64_t	mtu;			/* The MTU of this interface (mtu = 0 -> invalid interface) */
+	struct list	groups;			/* The grpints of the groups this interface joined */
+	uint64_t	active;			/* Position in g_conf->ints + 1, 0 when not active */
+	struct intnode	*nextdead;		/* Destroyed interfaces waiting to be freed */
 
 	uint64_t	mld_version;		/* The MLD version this interface supports */
 	uint64_t	mld_last_v1;		/* The last v1 we have seen -> allows upgrade to v2 */
+	struct timer	mld_timer;		/* Allows the upgrade again when no v1 was seen for a while */
 
 #ifndef ECMH_BPF
 	struct sockaddr	hwaddr;			/* Hardware bytes */
+	uint64_t	mif;			/* MIF + 1 when the kernel forwards for it, 0 when not */
+	uint64_t	tclink;			/* Link of the tc forwarding program + 1, 0 when none */
 #else
-	int		socket;			/* (BPF|Raw)Socket, when this is an ethernet interface */
-	int		__padding;
-
 	uint64_t	dlt;			/* DLT of the interface (DLT_EN10MB or DLT_NULL)*/
 	uint64_t	bufferlen;		/* The buffer length this interface expects */
-	struct intnode	*master;		/* Master interface, when this is a proto-41 tunnel */
-	struct in_addr	ipv4_local[INTNODE_MAXIPV4]; /* Local IPv4 address */
-	struct in_addr	ipv4_remote;		/* Remote IPv4 address */
 #endif
 
 	struct in6_addr	linklocal;		/* Link local address */
 	struct in6_addr	global;			/* Global unicast address */
 
-#ifdef ECMH_BPF
-	uint8_t		__padding2[4];
+	uint64_t	counters;		/* Counter block of the statistics, INT_CNT_* */
+};
+
+/*
+ * The list of interfaces we do multicast on
+ * These are discovered on the fly, very handy ;)
+ *
+ * The first cache line holds what forwarding to the interface
+ * needs, which is checked below, the rest is in info.
+ */
+struct intnode
+{
+	uint64_t	ifindex;		/* The ifindex */
+	uint64_t	mtu;			/* The MTU of this interface (mtu = 0 -> invalid interface) */
+	bool		upstream;		/* This interface is an upstream */
+
+#ifndef ECMH_BPF
+	struct sockaddr_ll txaddr;		/* Destination template for sending, see int_create() */
+	struct afxdp_sock *xsk;			/* The AF_XDP socket, NULL when sending with the PACKET socket */
+#else
+	int		socket;			/* (BPF|Raw)Socket, when this is an ethernet interface */
+	int		__padding;
+	struct intnode	*master;		/* Master interface, when this is a proto-41 tunnel */
+	struct in_addr	ipv4_local[INTNODE_MAXIPV4]; /* Local IPv4 address */
+	struct in_addr	ipv4_remote;		/* Remote IPv4 address */
 #endif
 
-	/* Per interface statistics */
-	uint64_t	stat_packets_received;	/* Number of packets received */
-	uint64_t	stat_packets_sent;	/* Number of packets sent */
-	uint64_t	stat_bytes_received;	/* Number of bytes received */
-	uint64_t	stat_bytes_sent;	/* Number of bytes sent */
-	uint64_t	stat_icmp_received;	/* Number of ICMP's received */
-	uint64_t	stat_icmp_sent;		/* Number of ICMP's sent */
+	struct intinfo	info CACHE_ALIGNED;	/* Starts on the next cache line */
+} CACHE_ALIGNED;
 
-	bool		upstream;		/* This interface is an upstream */
-};
+/* The forwarding part has to fit in one cache line */
+BUILD_CHECK(intnode_hot, offsetof(struct intnode, info) <= ECMH_CACHELINE);
 
 /* Node functions */
 #ifndef ECMH_BPF
@@ -58,12 +91,23 @@ struct intnode *int_create(unsigned int ifindex, bool tunnel);
 #endif
 void int_destroy(struct intnode *intn);
 
+void int_purge(void);
+void int_reap(void);
+
 /* List functions */
 struct intnode *int_find(unsigned int ifindex);
 #ifdef ECMH_BPF
 struct intnode *int_find_ipv4(bool local, struct in_addr *ipv4);
 #endif
 
+/*
+ * Walk the active interfaces, backwards as destroying
+ * the current interface moves the last one in it's place
+ */
+#define INT_LOOP(V,I) \
+  for ((I) = g_conf->intcount; (I) > 0; (I)--) \
+    if ((I) <= g_conf->intcount && ((V) = g_conf->ints[(I) - 1]) != NULL)
+
 /* Control function */
 void int_set_mld_version(struct intnode *intn, unsigned int newversion);
 
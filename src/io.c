@@ -0,0 +1,799 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+/* The backends --io can choose from, the first one is the default */
+static const struct iobackend *io_backends[] =
+{
+#ifndef ECMH_BPF
+	&io_packet,
+	&io_uring,
+	&io_afxdp,
+#else
+	&io_bpf,
+#endif
+	NULL
+};
+
+/* The backend called name, NULL when there is none */
+const struct iobackend *io_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; io_backends[i]; i++)
+	{
+		if (strcmp(io_backends[i]->name, name) == 0) return io_backends[i];
+	}
+
+	return NULL;
+}
+
+#ifndef ECMH_BPF
+/**************************************
+  PACKET socket (Linux)
+**************************************/
+
+/* Packet sockets never block, we wait for them with poll/epoll */
+static bool packet_nonblock(int sock);
+static bool packet_nonblock(int sock)
+{
+	int flags = fcntl(sock, F_GETFL, 0);
+
+	if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+	{
+		dolog(LOG_ERR, "Couldn't make socket non-blocking: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Turn the RAW socket into a TPACKET_V3 receive ring
+ * The kernel then fills blocks of frames which we walk
+ * in place, instead of one recvfrom() per packet
+ */
+static bool packet_rxring(struct worker *w);
+static bool packet_rxring(struct worker *w)
+{
+	struct tpacket_req3	req;
+	int			version = TPACKET_V3;
+
+	if (setsockopt(w->socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't select TPACKET_V3 for the RAW socket: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	memzero(&req, sizeof(req));
+	req.tp_block_size	= g_conf->rxring_blocksize;
+	req.tp_block_nr		= g_conf->rxring_blocks;
+	req.tp_frame_size	= ECMH_RXRING_FRAMESIZE;
+	req.tp_frame_nr		= (g_conf->rxring_blocksize / ECMH_RXRING_FRAMESIZE) * g_conf->rxring_blocks;
+	req.tp_retire_blk_tov	= ECMH_RXRING_TIMEOUT;
+
+	if (setsockopt(w->socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't setup a receive ring of %" PRIu64 " blocks of %" PRIu64 " bytes: %s (%d)\n",
+			g_conf->rxring_blocks, g_conf->rxring_blocksize, strerror(errno), errno);
+		return false;
+	}
+
+	w->rxring_map = mmap(NULL, g_conf->rxring_blocks * g_conf->rxring_blocksize,
+				  PROT_READ | PROT_WRITE, MAP_SHARED, w->socket, 0);
+	if (w->rxring_map == MAP_FAILED)
+	{
+		dolog(LOG_WARNING, "Couldn't map the receive ring: %s (%d)\n", strerror(errno), errno);
+		w->rxring_map = NULL;
+
+		/* Release the ring again */
+		memzero(&req, sizeof(req));
+		setsockopt(w->socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		return false;
+	}
+
+	w->rxring_block = 0;
+	w->rxring_next = NULL;
+	w->rxring_left = 0;
+
+	dolog(LOG_INFO, "Receiving through a TPACKET_V3 ring of %" PRIu64 " blocks of %" PRIu64 " bytes\n",
+		g_conf->rxring_blocks, g_conf->rxring_blocksize);
+
+	return true;
+}
+
+/*
+ * Open the PACKET socket of a receive context. The control context
+ * gets MLD and, when it forwards itself, the multicast. A worker only
+ * gets the multicast and joins the fanout group, the kernel then
+ * spreads the packets over the workers, keeping packets of the same
+ * flow (hash) or CPU on the same worker.
+ */
+bool packet_open(struct worker *w)
+{
+	int	fanout;
+	bool	control = (w == &g_conf->control);
+
+	w->socket = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL));
+	if (w->socket < 0)
+	{
+		dolog(LOG_ERR, "Couldn't allocate a RAW socket\n");
+		return false;
+	}
+
+	/* Only receive what we need, with workers or the kernel forwarding control only handles MLD */
+	if (!control)
+	{
+		filter_init(w->socket, FILTER_DATA);
+	}
+	else if (!filter_init(w->socket, (g_conf->workers || g_conf->mroute || g_conf->tcbpf) ? FILTER_CONTROL : FILTER_ALL))
+	{
+		dolog(LOG_WARNING, "Receiving all packets, filtering in userspace\n");
+	}
+
+	/* With workers only they get a receive ring */
+	if (g_conf->rxring && (!control || !g_conf->workers) && !packet_rxring(w))
+	{
+		dolog(LOG_WARNING, "Falling back to receiving with recvfrom()\n");
+	}
+
+	if (!w->rxring_map)
+	{
+		w->buffer = calloc(1, g_conf->bufferlen);
+		if (!w->buffer)
+		{
+			dolog(LOG_ERR, "Couldn't allocate memory for the receive buffer\n");
+			return false;
+		}
+	}
+
+	if (!packet_nonblock(w->socket))
+	{
+		return false;
+	}
+
+	if (control)
+	{
+		return true;
+	}
+
+	fanout = (getpid() & 0xffff) | (g_conf->fanout << 16);
+	if (setsockopt(w->socket, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0)
+	{
+		dolog(LOG_ERR, "Couldn't join the PACKET_FANOUT group: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/* Close the PACKET socket of a receive context, also when it was opened halfway */
+void packet_close(struct worker *w)
+{
+	if (w->rxring_map)
+	{
+		munmap(w->rxring_map, g_conf->rxring_blocks * g_conf->rxring_blocksize);
+		w->rxring_map = NULL;
+	}
+
+	if (w->socket >= 0) close(w->socket);
+	w->socket = -1;
+
+	free(w->buffer);
+	w->buffer = NULL;
+}
+
+/*
+ * Fill in a packet received on a PACKET socket, false for
+ * what is ignored: loopback traffic and the packets that
+ * originate from this host
+ */
+bool packet_fill(struct iopacket *pkt, const struct sockaddr_ll *sa, void *packet, uint32_t len)
+{
+	if (	sa->sll_hatype == ARPHRD_LOOPBACK ||
+		sa->sll_pkttype == PACKET_OUTGOING)
+	{
+		return false;
+	}
+
+	pkt->intn	= NULL;
+	pkt->packet	= packet;
+	pkt->len	= len;
+	pkt->ifindex	= sa->sll_ifindex;
+	pkt->ether_type	= ntohs(sa->sll_protocol);
+
+	return true;
+}
+
+/*
+ * Build the messages for sendmmsg() in the running context
+ * Per RFC2464 the Ethernet MAC address is constructed from the
+ * IPv6 destination multicast address, the rest of the address
+ * comes from the per interface prebuilt one.
+ */
+void packet_msgs(struct iotx *tx, unsigned int count)
+{
+	struct txmsgs	*m = &g_worker->msgs;
+	unsigned int	i;
+
+	for (i = 0; i < count; i++)
+	{
+		memcpy(&m->addrs[i], &tx[i].intn->txaddr, sizeof(m->addrs[i]));
+		memcpy(&m->addrs[i].sll_addr[2], &tx[i].iph->ip6_dst.s6_addr[12], 4);
+
+		m->iovs[i].iov_base		= (void *)tx[i].iph;
+		m->iovs[i].iov_len		= tx[i].len;
+
+		memzero(&m->msgs[i], sizeof(m->msgs[i]));
+		m->msgs[i].msg_hdr.msg_name	= &m->addrs[i];
+		m->msgs[i].msg_hdr.msg_namelen	= sizeof(m->addrs[i]);
+		m->msgs[i].msg_hdr.msg_iov	= &m->iovs[i];
+		m->msgs[i].msg_hdr.msg_iovlen	= 1;
+	}
+}
+
+/* Hand the block of the receive ring back to the kernel and wait for the next one */
+static void packet_ring_next(struct worker *w);
+static void packet_ring_next(struct worker *w)
+{
+	struct tpacket_block_desc *bd;
+
+	bd = (struct tpacket_block_desc *)(w->rxring_map + (w->rxring_block * g_conf->rxring_blocksize));
+
+	__sync_synchronize();
+	bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+	w->rxring_block = (w->rxring_block + 1) % g_conf->rxring_blocks;
+	w->rxring_next = NULL;
+}
+
+/* The next packets of the receive ring, walked in place, the block goes back once all are released */
+static int packet_ring_receive(struct worker *w, struct iopacket *pkts, unsigned int max);
+static int packet_ring_receive(struct worker *w, struct iopacket *pkts, unsigned int max)
+{
+	struct tpacket_block_desc	*bd;
+	struct tpacket3_hdr		*hdr;
+	unsigned int			n = 0;
+
+	while (n == 0)
+	{
+		if (!w->rxring_next)
+		{
+			bd = (struct tpacket_block_desc *)(w->rxring_map + (w->rxring_block * g_conf->rxring_blocksize));
+
+			/* Block still owned by the kernel? */
+			if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+			{
+				return 0;
+			}
+
+			w->rxring_next = (struct tpacket3_hdr *)(((uint8_t *)bd) + bd->hdr.bh1.offset_to_first_pkt);
+			w->rxring_left = bd->hdr.bh1.num_pkts;
+		}
+
+		while (w->rxring_left > 0 && n < max)
+		{
+			hdr = w->rxring_next;
+
+			if (packet_fill(&pkts[n], (const struct sockaddr_ll *)(((uint8_t *)hdr) + TPACKET_ALIGN(sizeof(*hdr))),
+					((uint8_t *)hdr) + hdr->tp_net, hdr->tp_snaplen))
+			{
+				n++;
+			}
+
+			w->rxring_next = (struct tpacket3_hdr *)(((uint8_t *)hdr) + hdr->tp_next_offset);
+			w->rxring_left--;
+		}
+
+		/* Nothing of use in the block */
+		if (n == 0) packet_ring_next(w);
+	}
+
+	return n;
+}
+
+/* Receive a packet with recvfrom(), a burst of one */
+static int packet_recvfrom(struct worker *w, struct iopacket *pkts);
+static int packet_recvfrom(struct worker *w, struct iopacket *pkts)
+{
+	struct sockaddr_ll	sa;
+	socklen_t		salen;
+	int			len;
+
+	do
+	{
+		salen = sizeof(sa);
+		memzero(&sa, sizeof(sa));
+		len = recvfrom(w->socket, w->buffer, g_conf->bufferlen, 0, (struct sockaddr *)&sa, &salen);
+
+		if (len == -1)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+				return 0;
+			}
+
+			dolog(LOG_ERR, "Couldn't Read from RAW Socket\n");
+			return -1;
+		}
+	} while (!packet_fill(pkts, &sa, w->buffer, len));
+
+	return 1;
+}
+
+static bool io_packet_open(void);
+static bool io_packet_open(void)
+{
+	return packet_open(&g_conf->control);
+}
+
+static void io_packet_close(void);
+static void io_packet_close(void)
+{
+	packet_close(&g_conf->control);
+}
+
+/* Every context receives on it's own socket, the socket is non-blocking */
+static int io_packet_receive(int UNUSED fd, struct iopacket *pkts, unsigned int max);
+static int io_packet_receive(int UNUSED fd, struct iopacket *pkts, unsigned int max)
+{
+	if (g_worker->rxring_map)
+	{
+		return packet_ring_receive(g_worker, pkts, max);
+	}
+
+	return packet_recvfrom(g_worker, pkts);
+}
+
+static void io_packet_release(void);
+static void io_packet_release(void)
+{
+	struct worker *w = g_worker;
+
+	/* Done with all the packets of the block? */
+	if (w->rxring_next && w->rxring_left == 0) packet_ring_next(w);
+}
+
+/* Send with as few sendmmsg() calls as possible, a message that fails is skipped */
+static void io_packet_transmit(struct iotx *tx, unsigned int count);
+static void io_packet_transmit(struct iotx *tx, unsigned int count)
+{
+	struct txmsgs	*m = &g_worker->msgs;
+	unsigned int	done = 0, i;
+	int		sent;
+
+	packet_msgs(tx, count);
+
+	while (done < count)
+	{
+		errno = 0;
+		sent = sendmmsg(g_worker->socket, &m->msgs[done], count - done, 0);
+
+		/* The first message failed */
+		if (sent <= 0)
+		{
+			tx[done++].result = -errno;
+			continue;
+		}
+
+		for (i = done; i < done + sent; i++)
+		{
+			tx[i].result = m->msgs[i].msg_len;
+		}
+
+		done += sent;
+	}
+}
+
+static void io_packet_stats(FILE *out);
+static void io_packet_stats(FILE *out)
+{
+	if (g_conf->rxring)
+	{
+		fprintf(out, "Receive ring         : %" PRIu64 " blocks of %" PRIu64 " bytes\n", g_conf->rxring_blocks, g_conf->rxring_blocksize);
+	}
+	else
+	{
+		fprintf(out, "Receive ring         : Disabled\n");
+	}
+}
+
+const struct iobackend io_packet =
+{
+	"packet",
+	true,
+	io_packet_open,
+	io_packet_close,
+	NULL,			/* attach */
+	NULL,			/* detach */
+	NULL,			/* wait, the sockets are in the epoll set */
+	NULL,			/* ready */
+	io_packet_receive,
+	io_packet_release,
+	io_packet_transmit,
+	io_packet_stats
+};
+
+#else /* !ECMH_BPF */
+/**************************************
+  BPF devices (BSD)
+**************************************/
+
+/* The devices the last select() found readable and that were not read yet */
+static fd_set bpf_ready;
+static bool bpf_readable = false;
+
+/* What is left of the last read and the interface it was read from */
+static uint8_t *bpf_buffer = NULL, *bpf_pos = NULL, *bpf_end = NULL;
+static uint64_t bpf_ifindex = 0;
+
+/* Wait for one of the devices, select() wakes us up every few seconds for the timers */
+static bool io_bpf_wait(void);
+static bool io_bpf_wait(void)
+{
+	struct timeval	timeout;
+	int		i;
+
+	/* Still something left from the last time? Then don't wait */
+	if (bpf_pos < bpf_end || bpf_readable)
+	{
+		return true;
+	}
+
+	memcpy(&bpf_ready, &g_conf->selectset, sizeof(bpf_ready));
+
+	memzero(&timeout, sizeof(timeout));
+	timeout.tv_sec = 5;
+
+	i = select(g_conf->hifd+1, &bpf_ready, NULL, NULL, &timeout);
+	if (i < 0)
+	{
+		if (errno == EINTR)
+		{
+			return true;
+		}
+
+		dolog(LOG_ERR, "Select failed\n");
+		return false;
+	}
+
+	bpf_readable = (i > 0);
+
+	return true;
+}
+
+/* The next packets of the last read, reading the next readable device when there are none */
+static int io_bpf_receive(int UNUSED fd, struct iopacket *pkts, unsigned int max);
+static int io_bpf_receive(int UNUSED fd, struct iopacket *pkts, unsigned int max)
+{
+	struct intnode		*intn;
+	struct bpf_hdr		*bhp;
+	struct ether_header	*eth;
+	uint64_t		i;
+	unsigned int		n = 0;
+	int			len;
+
+	/* The interface might be gone, or a new one needed a larger buffer */
+	intn = int_find(bpf_ifindex);
+	if (!intn || bpf_buffer != g_conf->buffer)
+	{
+		bpf_pos = bpf_end = NULL;
+	}
+
+	while (n < max)
+	{
+		if (bpf_pos >= bpf_end)
+		{
+			intn = NULL;
+			if (bpf_readable)
+			{
+				INT_LOOP(intn, i)
+				{
+					if (intn->socket != -1 && FD_ISSET(intn->socket, &bpf_ready)) break;
+					intn = NULL;
+				}
+			}
+
+			/* All of them are read */
+			if (!intn)
+			{
+				bpf_readable = false;
+				break;
+			}
+
+			FD_CLR(intn->socket, &bpf_ready);
+
+			len = read(intn->socket, g_conf->buffer, intn->info.bufferlen);
+			if (len < 0)
+			{
+				dolog(LOG_ERR, "Couldn't read from BPF device: %s (%d)\n", strerror(errno), errno);
+				return -1;
+			}
+
+			bpf_buffer	= g_conf->buffer;
+			bpf_pos		= bpf_buffer;
+			bpf_end		= bpf_buffer + len;
+			bpf_ifindex	= intn->ifindex;
+			continue;
+		}
+
+		bhp = (struct bpf_hdr *)bpf_pos;
+		eth = (struct ether_header *)(bpf_pos + bhp->bh_hdrlen);
+		bpf_pos += BPF_WORDALIGN(bhp->bh_caplen + bhp->bh_hdrlen);
+
+		/* Layer 2 packet */
+		if (bhp->bh_caplen < sizeof(*eth)) continue;
+
+		pkts[n].intn		= intn;
+		pkts[n].packet		= eth + 1;
+		pkts[n].len		= bhp->bh_caplen - sizeof(*eth);
+		pkts[n].ifindex		= intn->ifindex;
+		pkts[n].ether_type	= ntohs(eth->ether_type);
+		n++;
+	}
+
+	return n;
+}
+
+/* Write a packet to the BPF device, tunnels get it encapsulated in proto-41 */
+static int bpf_send(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len);
+static int bpf_send(struct intnode *intn, const struct ip6_hdr *iph, const uint16_t len)
+{
+	register uint32_t	chksum = 0;
+	struct ether_header	hdr_eth;
+	struct ip		hdr_ip;
+	struct iovec		vector[3];
+
+	/* There is always ethernet to send out */
+	vector[0].iov_base	= &hdr_eth;
+	vector[0].iov_len 	= sizeof(hdr_eth);
+
+	/*
+	 * Construct a Ethernet MAC address from the IPv6 destination multicast address.
+	 * Per RFC2464
+	 */
+	memzero(&hdr_eth, sizeof(hdr_eth));
+	hdr_eth.ether_dhost[0] = 0x33;
+	hdr_eth.ether_dhost[1] = 0x33;
+	hdr_eth.ether_dhost[2] = iph->ip6_dst.s6_addr[12];
+	hdr_eth.ether_dhost[3] = iph->ip6_dst.s6_addr[13];
+	hdr_eth.ether_dhost[4] = iph->ip6_dst.s6_addr[14];
+	hdr_eth.ether_dhost[5] = iph->ip6_dst.s6_addr[15];
+
+	/*
+	 * Handle non-tunneledmode & native ethernet
+	 */
+	if (!g_conf->tunnelmode || !intn->master)
+	{
+		/* Send a Native IPv6 packet */
+		hdr_eth.ether_type	= htons(ETH_P_IPV6);
+		vector[1].iov_base	= (void *)iph;
+		vector[1].iov_len 	= len;
+
+		dolog(LOG_DEBUG, "Sending Native IPv6 packet over %s/%" PRIu64 "\n", intn->info.name, intn->ifindex);
+		return writev(intn->socket, vector, 2);
+	}
+
+	/*
+	 * When this interface is a tunnel, send it over it's parent socket
+	 * After having it encapsulated in proto-41
+	 */
+
+	/* Construct the proto-41 packet */
+	memzero(&hdr_ip, sizeof(hdr_ip));
+	hdr_ip.ip_v 	= 4;
+	hdr_ip.ip_hl	= 5;
+	hdr_ip.ip_tos	= 0;
+	hdr_ip.ip_len	= htons(len + sizeof(hdr_ip));
+	hdr_ip.ip_id	= htons(42);
+	hdr_ip.ip_off	= 0;
+	hdr_ip.ip_ttl	= 100;
+	hdr_ip.ip_p	= IPPROTO_IPV6;
+	hdr_ip.ip_sum	= 0;
+
+	/* The first ipv4_local is the interface, the rest should be empty for PtP interfaces */
+	memcpy(&hdr_ip.ip_src, &intn->ipv4_local[0], sizeof(hdr_ip.ip_src));
+	memcpy(&hdr_ip.ip_dst, &intn->ipv4_remote, sizeof(hdr_ip.ip_dst));
+
+	/* Calculate the checksum */
+	chksum = inchksum(&hdr_ip, sizeof(hdr_ip));
+
+	/* Wrap in the carries to reduce chksum to 16 bits. */
+	chksum  = (chksum >> 16) + (chksum & 0xffff);
+	chksum += (chksum >> 16);
+
+	/* Take ones-complement and replace 0 with 0xFFFF. */
+	chksum = (uint16_t) ~chksum;
+	if (chksum == 0UL) chksum = 0xffffUL;
+
+	/* Fill in the Checksum */
+	hdr_ip.ip_sum = (uint16_t)chksum;
+
+	/* Send a IPv4 proto-41 packet over the master's socket */
+	hdr_eth.ether_type	= htons(ETH_P_IP);
+	vector[1].iov_base 	= &hdr_ip;
+	vector[1].iov_len 	= sizeof(hdr_ip);
+	vector[2].iov_base	= (void *)iph;
+	vector[2].iov_len 	= len;
+
+	dolog(LOG_DEBUG, "Sending proto-41 IPv6 packet for %s/%" PRIu64 " over %s/%" PRIu64 "\n",
+		intn->info.name, intn->ifindex, intn->master->info.name, intn->master->ifindex);
+	return writev(intn->master->socket, vector, 3);
+}
+
+/* The BPF devices are opened with their interfaces, see int_create() */
+static bool io_bpf_open(void);
+static bool io_bpf_open(void)
+{
+	return true;
+}
+
+/* BPF devices are written one packet at a time */
+static void io_bpf_transmit(struct iotx *tx, unsigned int count);
+static void io_bpf_transmit(struct iotx *tx, unsigned int count)
+{
+	unsigned int	i;
+	int		sent;
+
+	for (i = 0; i < count; i++)
+	{
+		errno = 0;
+		sent = bpf_send(tx[i].intn, tx[i].iph, tx[i].len);
+		tx[i].result = sent < 0 ? -errno : sent;
+	}
+}
+
+const struct iobackend io_bpf =
+{
+	"bpf",
+	false,
+	io_bpf_open,
+	NULL,			/* close, the devices go with their interfaces */
+	NULL,			/* attach */
+	NULL,			/* detach */
+	io_bpf_wait,
+	NULL,			/* ready, there is no epoll */
+	io_bpf_receive,
+	NULL,			/* release, the buffer is only reused by the next read */
+	io_bpf_transmit,
+	NULL			/* stats */
+};
+#endif /* !ECMH_BPF */
+
+/**************************************
+  Memory (tests and benchmarks)
+**************************************/
+
+/* What was injected, what receive handed out of it, and what was sent */
+static struct iomemory io_memory_rx[IO_MEMORY_PACKETS];
+static unsigned int io_memory_rxcount = 0, io_memory_rxpos = 0, io_memory_rxheld = 0;
+static struct iomemory io_memory_tx[IO_MEMORY_PACKETS];
+static unsigned int io_memory_txcount = 0;
+static uint64_t io_memory_received = 0, io_memory_transmitted = 0, io_memory_dropped = 0;
+
+/* Queue a packet for the next receive, false when the queue is full or it is too large */
+bool io_memory_inject(uint32_t ifindex, uint16_t ether_type, const void *packet, uint32_t len)
+{
+	struct iomemory *m;
+
+	if (io_memory_rxcount >= IO_MEMORY_PACKETS || len > sizeof(m->packet)) return false;
+
+	m = &io_memory_rx[io_memory_rxcount++];
+	m->ifindex	= ifindex;
+	m->ether_type	= ether_type;
+	m->len		= len;
+	memcpy(m->packet, packet, len);
+
+	return true;
+}
+
+/* The packets sent since the last io_memory_clear(), in order */
+const struct iomemory *io_memory_sent(unsigned int *count)
+{
+	*count = io_memory_txcount;
+	return io_memory_tx;
+}
+
+/* Forget what was sent */
+void io_memory_clear(void)
+{
+	io_memory_txcount = 0;
+}
+
+static bool io_memory_open(void);
+static bool io_memory_open(void)
+{
+	io_memory_rxcount	= 0;
+	io_memory_rxpos		= 0;
+	io_memory_rxheld	= 0;
+	io_memory_txcount	= 0;
+
+	return true;
+}
+
+/* The injected packets, fd is not used */
+static int io_memory_receive(int UNUSED fd, struct iopacket *pkts, unsigned int max);
+static int io_memory_receive(int UNUSED fd, struct iopacket *pkts, unsigned int max)
+{
+	struct iomemory	*m;
+	unsigned int	n;
+
+	for (n = 0; n < max && io_memory_rxpos < io_memory_rxcount; n++)
+	{
+		m = &io_memory_rx[io_memory_rxpos++];
+
+		pkts[n].intn		= NULL;
+		pkts[n].packet		= m->packet;
+		pkts[n].len		= m->len;
+		pkts[n].ifindex		= m->ifindex;
+		pkts[n].ether_type	= m->ether_type;
+	}
+
+	io_memory_rxheld	= io_memory_rxpos;
+	io_memory_received	+= n;
+
+	return n;
+}
+
+/* Once all are handled the queue starts over */
+static void io_memory_release(void);
+static void io_memory_release(void)
+{
+	if (io_memory_rxheld < io_memory_rxcount) return;
+
+	io_memory_rxcount	= 0;
+	io_memory_rxpos		= 0;
+	io_memory_rxheld	= 0;
+}
+
+/* Keep a copy of every packet, as long as there is room */
+static void io_memory_transmit(struct iotx *tx, unsigned int count);
+static void io_memory_transmit(struct iotx *tx, unsigned int count)
+{
+	struct iomemory	*m;
+	unsigned int	i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (io_memory_txcount >= IO_MEMORY_PACKETS)
+		{
+			tx[i].result = -ENOBUFS;
+			io_memory_dropped++;
+			continue;
+		}
+
+		m = &io_memory_tx[io_memory_txcount++];
+		m->ifindex	= tx[i].intn->ifindex;
+		m->ether_type	= ETH_P_IPV6;
+		m->len		= tx[i].len;
+		memcpy(m->packet, tx[i].iph, tx[i].len);
+
+		tx[i].result = tx[i].len;
+		io_memory_transmitted++;
+	}
+}
+
+static void io_memory_stats(FILE *out);
+static void io_memory_stats(FILE *out)
+{
+	fprintf(out, "Memory packets       : %" PRIu64 " received, %" PRIu64 " sent, %" PRIu64 " dropped\n", io_memory_received, io_memory_transmitted, io_memory_dropped);
+}
+
+const struct iobackend io_memory =
+{
+	"memory",
+	false,			/* workers, there is only one queue */
+	io_memory_open,
+	NULL,			/* close */
+	NULL,			/* attach */
+	NULL,			/* detach */
+	NULL,			/* wait, handlereceive() is called directly */
+	NULL,			/* ready */
+	io_memory_receive,
+	io_memory_release,
+	io_memory_transmit,
+	io_memory_stats
+};
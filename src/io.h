@@ -0,0 +1,112 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * The I/O backends, how packets are received and sent
+ *
+ * The protocol code does not know where packets come from or how
+ * they go out, it asks the backend chosen with --io for bursts of
+ * received packets and hands it bursts of packets to send. A backend
+ * either puts it's file descriptors in the epoll set of the main
+ * thread and is asked to receive when one is readable, or waits
+ * itself (wait) and then tells when the epoll set has something
+ * (ready). What is received stays in the backend's buffers till
+ * release. On Linux there is the PACKET socket (recvfrom() or the
+ * TPACKET_V3 ring, sendmmsg()), io_uring and AF_XDP, the latter two
+ * use the PACKET socket for what they don't handle themselves.
+ * On BSD every interface has a BPF device.
+ * The memory backend is not one --io can choose, the tests inject
+ * packets into it and look at what it sent instead.
+ */
+
+#ifndef __IO_H
+#define __IO_H
+
+struct worker;
+
+/* A received packet */
+struct iopacket
+{
+	struct intnode		*intn;		/* Interface it came in on, NULL when only ifindex is known */
+	void			*packet;	/* The packet, starting with the network header */
+	uint32_t		len;		/* Length of the packet */
+	uint32_t		ifindex;	/* Interface index it came in on */
+	uint16_t		ether_type;	/* The Ethernet type (host order) */
+	uint16_t		__padding[3];
+};
+
+/* A packet to send */
+struct iotx
+{
+	struct intnode		*intn;		/* Interface to send it on */
+	const struct ip6_hdr	*iph;		/* The packet */
+	uint16_t		len;		/* Length of the packet */
+	uint16_t		__padding;
+	int			result;		/* Set by the backend: bytes sent or -errno */
+};
+
+/* A packet of the memory backend, injected or sent */
+#define IO_MEMORY_PACKETS	64
+struct iomemory
+{
+	uint32_t		ifindex;	/* Interface it came in on, or went out of */
+	uint32_t		len;		/* Length of the packet */
+	uint16_t		ether_type;	/* The Ethernet type (host order) */
+	uint8_t			packet[2048];	/* The packet, starting with the network header */
+};
+
+/* A backend, the optional functions are NULL when not needed */
+struct iobackend
+{
+	const char		*name;		/* As given to --io */
+	bool			workers;	/* Can forwarding workers receive with it? */
+
+	/* Setup and cleanup (close is optional), when open fails the default backend is used */
+	bool			(*open)(void);
+	void			(*close)(void);
+
+	/* An interface was created or destroyed (optional) */
+	void			(*attach)(struct intnode *intn);
+	void			(*detach)(struct intnode *intn);
+
+	/* Wait for packets and events, false on a fatal error (optional, epoll is used otherwise) */
+	bool			(*wait)(void);
+
+	/* Has the epoll set something since the last wait? (only with wait) */
+	bool			(*ready)(void);
+
+	/* At most max received packets, fd is readable (-1 with wait), -1 on a fatal error */
+	int			(*receive)(int fd, struct iopacket *pkts, unsigned int max);
+
+	/* The packets of the last receive are handled, their buffers can be reused */
+	void			(*release)(void);
+
+	/* Send count packets, the result of every one is filled in */
+	void			(*transmit)(struct iotx *tx, unsigned int count);
+
+	/* Add what there is to know to the statistics dump (optional) */
+	void			(*stats)(FILE *out);
+};
+
+#ifndef ECMH_BPF
+extern const struct iobackend io_packet;
+extern const struct iobackend io_uring;
+extern const struct iobackend io_afxdp;
+
+/* Prototypes. */
+bool packet_open(struct worker *w);
+void packet_close(struct worker *w);
+bool packet_fill(struct iopacket *pkt, const struct sockaddr_ll *sa, void *packet, uint32_t len);
+void packet_msgs(struct iotx *tx, unsigned int count);
+#else
+extern const struct iobackend io_bpf;
+#endif
+extern const struct iobackend io_memory;
+const struct iobackend *io_find(const char *name);
+bool io_memory_inject(uint32_t ifindex, uint16_t ether_type, const void *packet, uint32_t len);
+const struct iomemory *io_memory_sent(unsigned int *count);
+void io_memory_clear(void);
+
+#endif /* __IO_H */
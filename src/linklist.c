@@ -3,7 +3,7 @@
  * modded for ecmh by Jeroen Massar
  */
 
-#include "linklist.h"
+#include "ecmh.h"
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
@@ -13,7 +13,7 @@ struct list *list_new()
 {
 	struct list *new;
 
-	new = calloc(1, sizeof(*new));
+	new = pool_alloc(&g_conf->pool_list);
 	if (!new) return NULL;
 	return new;
 }
@@ -21,7 +21,7 @@ struct list *list_new()
 /* Free list. */
 void list_free(struct list *l)
 {
-	if (l) free(l);
+	if (l) pool_free(&g_conf->pool_list, l);
 }
 
 /* Allocate new listnode */
@@ -30,7 +30,7 @@ static struct listnode *listnode_new(void)
 {
 	struct listnode *node;
 
-	node = calloc(1, sizeof(*node));
+	node = pool_alloc(&g_conf->pool_listnode);
 	if (!node) return NULL;
 	return node;
 }
@@ -39,7 +39,7 @@ static struct listnode *listnode_new(void)
 static void listnode_free(struct listnode *node);
 static void listnode_free(struct listnode *node)
 {
-	free(node);
+	pool_free(&g_conf->pool_listnode, node);
 }
 
 /* Add new data to the list. */
@@ -50,6 +50,17 @@ void listnode_add(struct list *list, void *val)
 	node = listnode_new();
 	if (!node) return;
 
+	listnode_link(list, node, val);
+}
+
+/*
+ * Add data to the list using a node that is embedded in it,
+ * the list has to be marked embedded, the nodes are then
+ * not freed when deleted from the list.
+ */
+void listnode_link(struct list *list, struct listnode *node, void *val)
+{
+	node->next = NULL;
 	node->prev = list->tail;
 	node->data = val;
 
@@ -71,7 +82,7 @@ void list_delete_all_node(struct list *list)
 	{
 		next = node->next;
 		if (list->del) (*list->del)(node->data);
-		listnode_free(node);
+		if (!list->embedded) listnode_free(node);
 	}
 	list->head = list->tail = NULL;
 	list->count = 0;
@@ -87,7 +98,7 @@ void list_delete(struct list *list)
 	{
 		next = node->next;
 		if (list->del) (*list->del)(node->data);
-		listnode_free(node);
+		if (!list->embedded) listnode_free(node);
 	}
 	list_free (list);
 }
@@ -100,6 +111,6 @@ void list_delete_node(struct list *list, struct listnode *node)
 	if (node->next) node->next->prev = node->prev;
 	else list->tail = node->prev;
 	list->count--;
-	listnode_free(node);
+	if (!list->embedded) listnode_free(node);
 }
 
@@ -22,6 +22,7 @@ struct list
 	struct listnode	*tail;
 	int64_t		count;
 	void		(*del)(void *val);
+	uint64_t	embedded;	/* The nodes are part of the elements, see listnode_link() */
 };
 
 #define nextnode(X)	((X) = (X)->next)
@@ -34,6 +35,7 @@ struct list
 struct list	*list_new(void);
 void		list_free(struct list *);
 void		listnode_add(struct list *, void *);
+void		listnode_link(struct list *, struct listnode *, void *);
 void		list_delete (struct list *);
 void		list_delete_all_node (struct list *);
 void		list_delete_node (struct list *, struct listnode *);
@@ -10,10 +10,14 @@
 /* Determine Endianness */
 #if BYTE_ORDER == LITTLE_ENDIAN
 	/* 1234 machines */
+#ifndef __LITTLE_ENDIAN_BITFIELD
 	#define __LITTLE_ENDIAN_BITFIELD 1
+#endif
 #elif BYTE_ORDER == BIG_ENDIAN
 	/* 4321 machines */
+#ifndef __BIG_ENDIAN_BITFIELD
 	#define __BIG_ENDIAN_BITFIELD 1
+#endif
 # define WORDS_BIGENDIAN 1
 #elif BYTE_ORDER == PDP_ENDIAN
 	/* 3412 machines */
@@ -0,0 +1,394 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+#ifndef ECMH_BPF
+
+/* MIF -> interface, NULL when the MIF is free */
+static struct intnode *mrt_mifs[MAXMIFS];
+
+/* The routes we installed, hashed on (S,G) */
+static struct hashtable *mrt_routes = NULL;
+
+/*
+ * Become the multicast router of this network namespace
+ * The upcalls arrive on a raw ICMPv6 socket, all other ICMPv6
+ * is filtered out as the PACKET socket already sees the MLD.
+ */
+bool mrt_init(void)
+{
+	struct icmp6_filter	filter;
+	int			on = 1;
+
+	mrt_routes = hash_new(offsetof(struct mrtroute, src), 2 * sizeof(struct in6_addr));
+	if (!mrt_routes)
+	{
+		dolog(LOG_ERR, "Couldn't allocate the kernel route table\n");
+		return false;
+	}
+
+	g_conf->mrtfd = socket(AF_INET6, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMPV6);
+	if (g_conf->mrtfd == -1)
+	{
+		dolog(LOG_ERR, "Couldn't create the mroute socket: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+	if (setsockopt(g_conf->mrtfd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't filter ICMPv6 on the mroute socket: %s (%d)\n", strerror(errno), errno);
+	}
+
+	/* Only one router per namespace, EADDRINUSE means there is another one */
+	if (setsockopt(g_conf->mrtfd, IPPROTO_IPV6, MRT6_INIT, &on, sizeof(on)) != 0)
+	{
+		dolog(LOG_ERR, "Couldn't enable IPv6 multicast routing: %s (%d)\n", strerror(errno), errno);
+		close(g_conf->mrtfd);
+		g_conf->mrtfd = -1;
+		return false;
+	}
+
+	/* Packets arriving on the wrong MIF are reported, see mrt_wrongmif() */
+	if (setsockopt(g_conf->mrtfd, IPPROTO_IPV6, MRT6_ASSERT, &on, sizeof(on)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't enable wrong MIF upcalls: %s (%d)\n", strerror(errno), errno);
+	}
+
+	dolog(LOG_INFO, "Forwarding with the kernel IPv6 multicast routing table\n");
+	return true;
+}
+
+/* Closing the socket makes the kernel drop all the MIFs and routes */
+void mrt_cleanup(void)
+{
+	if (g_conf->mrtfd != -1)
+	{
+		close(g_conf->mrtfd);
+		g_conf->mrtfd = -1;
+	}
+
+	/* The groups are gone, thus so are the routes */
+	hash_free(mrt_routes);
+	mrt_routes = NULL;
+}
+
+/* Make an interface a MIF so that the kernel forwards from and to it */
+void mrt_int_add(struct intnode *intn)
+{
+	struct mif6ctl	mc;
+	uint64_t	mif;
+
+	if (g_conf->mrtfd == -1) return;
+
+	/* The kernel only has 16 bits for the ifindex of a MIF */
+	if (intn->ifindex > 0xffff)
+	{
+		dolog(LOG_WARNING, "Index of %s is too high for a MIF, it won't be forwarded to or from\n", intn->info.name);
+		return;
+	}
+
+	for (mif = 0; mif < MAXMIFS && mrt_mifs[mif]; mif++);
+	if (mif == MAXMIFS)
+	{
+		dolog(LOG_WARNING, "No MIF left for %s, it won't be forwarded to or from\n", intn->info.name);
+		return;
+	}
+
+	memzero(&mc, sizeof(mc));
+	mc.mif6c_mifi		= mif;
+	mc.mif6c_pifi		= intn->ifindex;
+	mc.vifc_threshold	= 1;
+
+	if (setsockopt(g_conf->mrtfd, IPPROTO_IPV6, MRT6_ADD_MIF, &mc, sizeof(mc)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't add %s as MIF %" PRIu64 ": %s (%d)\n", intn->info.name, mif, strerror(errno), errno);
+		return;
+	}
+
+	mrt_mifs[mif]	= intn;
+	intn->info.mif	= mif + 1;
+}
+
+/* Remove a route from the kernel and forget it */
+static void mrt_route_del(struct mrtroute *route);
+static void mrt_route_del(struct mrtroute *route)
+{
+	struct mf6cctl	mc;
+
+	memzero(&mc, sizeof(mc));
+	mc.mf6cc_origin.sin6_family	= AF_INET6;
+	mc.mf6cc_mcastgrp.sin6_family	= AF_INET6;
+	memcpy(&mc.mf6cc_origin.sin6_addr, &route->src, sizeof(route->src));
+	memcpy(&mc.mf6cc_mcastgrp.sin6_addr, &route->mca, sizeof(route->mca));
+	mc.mf6cc_parent			= route->parent;
+
+	setsockopt(g_conf->mrtfd, IPPROTO_IPV6, MRT6_DEL_MFC, &mc, sizeof(mc));
+
+	timer_del(&route->timer);
+	list_delete_node(&route->groupn->routes, &route->node);
+	hash_remove(mrt_routes, route);
+	pool_free(&g_conf->pool_route, route);
+}
+
+/*
+ * Remove an interface from the kernel
+ * The routes accepting on it go too, the OILs it is in
+ * are rebuilt by int_purge(), which rewrites their routes.
+ */
+void mrt_int_del(struct intnode *intn)
+{
+	struct mrtroute	*route;
+	uint64_t	i;
+	mifi_t		mif;
+
+	if (intn->info.mif == 0) return;
+
+	mif = intn->info.mif - 1;
+
+	HASH_LOOP(mrt_routes, route, i)
+	{
+		if (route->parent == mif) mrt_route_del(route);
+	}
+
+	if (setsockopt(g_conf->mrtfd, IPPROTO_IPV6, MRT6_DEL_MIF, &mif, sizeof(mif)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't remove MIF %u of %s: %s (%d)\n", mif, intn->info.name, strerror(errno), errno);
+	}
+
+	mrt_mifs[mif]	= NULL;
+	intn->info.mif	= 0;
+}
+
+/* Add an interface to the outgoing set, unless it is where the packets come from */
+static void mrt_route_oif(struct mf6cctl *mc, const struct intnode *intn);
+static void mrt_route_oif(struct mf6cctl *mc, const struct intnode *intn)
+{
+	if (intn->mtu == 0 || intn->info.mif == 0) return;
+	if (intn->info.mif - 1 == mc->mf6cc_parent) return;
+
+	IF_SET(intn->info.mif - 1, &mc->mf6cc_ifset);
+}
+
+/*
+ * Install or rewrite a route, the outgoing interfaces are the ASM
+ * ones of the group plus the ones that want this specific source,
+ * just like l4_ipv6_replicate() does. An empty set makes the
+ * kernel drop the packets without asking us again.
+ */
+static void mrt_route_set(const struct mrtroute *route);
+static void mrt_route_set(const struct mrtroute *route)
+{
+	struct groupnode	*groupn = route->groupn;
+	struct oilsrc		*oils;
+	struct mf6cctl		mc;
+	uint64_t		i;
+
+	memzero(&mc, sizeof(mc));
+	mc.mf6cc_origin.sin6_family	= AF_INET6;
+	mc.mf6cc_mcastgrp.sin6_family	= AF_INET6;
+	memcpy(&mc.mf6cc_origin.sin6_addr, &route->src, sizeof(route->src));
+	memcpy(&mc.mf6cc_mcastgrp.sin6_addr, &route->mca, sizeof(route->mca));
+	mc.mf6cc_parent			= route->parent;
+
+	for (i = 0; i < groupn->oil_count; i++)
+	{
+		mrt_route_oif(&mc, groupn->oil[i]);
+	}
+
+	oils = group_oil_find(groupn, &route->src);
+	for (i = 0; oils && i < oils->count; i++)
+	{
+		mrt_route_oif(&mc, oils->ints[i]);
+	}
+
+	if (setsockopt(g_conf->mrtfd, IPPROTO_IPV6, MRT6_ADD_MFC, &mc, sizeof(mc)) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't install a route in the kernel: %s (%d)\n", strerror(errno), errno);
+	}
+}
+
+/*
+ * Remove a route that did not accept a packet since the last check
+ * Packets that arrived on another MIF are counted by the kernel too,
+ * but as wrong_if, they don't keep the route.
+ */
+static void mrt_route_expire(void *data);
+static void mrt_route_expire(void *data)
+{
+	struct mrtroute		*route = (struct mrtroute *)data;
+	struct sioc_sg_req6	sr;
+	uint64_t		packets;
+
+	memzero(&sr, sizeof(sr));
+	sr.src.sin6_family	= AF_INET6;
+	sr.grp.sin6_family	= AF_INET6;
+	memcpy(&sr.src.sin6_addr, &route->src, sizeof(route->src));
+	memcpy(&sr.grp.sin6_addr, &route->mca, sizeof(route->mca));
+
+	/* Gone from the kernel already? Then the next packet asks again */
+	if (ioctl(g_conf->mrtfd, SIOCGETSGCNT_IN6, &sr) != 0)
+	{
+		mrt_route_del(route);
+		return;
+	}
+
+	packets = sr.pktcnt - sr.wrong_if;
+	if (packets == route->packets)
+	{
+		mrt_route_del(route);
+		return;
+	}
+
+	route->packets = packets;
+	timer_set(&route->timer, getmonotimes() + MRT_IDLE_TIMEOUT);
+}
+
+/*
+ * The kernel has no route for a packet it received
+ * mif	= The MIF the packet came in on
+ * sg	= The source followed by the group, as in the IPv6 header
+ */
+static void mrt_nocache(uint64_t mif, const struct in6_addr *sg);
+static void mrt_nocache(uint64_t mif, const struct in6_addr *sg)
+{
+	const struct in6_addr	*src = &sg[0], *mca = &sg[1];
+	struct groupnode	*groupn;
+	struct mrtroute		*route;
+
+	if (mif >= MAXMIFS || !mrt_mifs[mif]) return;
+
+	/* Same as flow_resolve(), these are never routed */
+	if (	IN6_IS_ADDR_MULTICAST(src) ||
+		IN6_IS_ADDR_UNSPECIFIED(src) ||
+		IN6_IS_ADDR_LINKLOCAL(src) ||
+		IN6_IS_ADDR_MC_NODELOCAL(mca) ||
+		IN6_IS_ADDR_MC_LINKLOCAL(mca))
+	{
+		return;
+	}
+
+	/*
+	 * Nobody joined? Then the kernel drops the packets it queued
+	 * and asks again when the source keeps on sending
+	 */
+	groupn = group_find(mca);
+	if (!groupn) return;
+
+	route = (struct mrtroute *)hash_find(mrt_routes, sg);
+	if (!route)
+	{
+		route = pool_alloc(&g_conf->pool_route);
+		if (!route)
+		{
+			dolog(LOG_ERR, "Couldn't allocate a kernel route\n");
+			return;
+		}
+
+		memcpy(&route->src, src, sizeof(route->src));
+		memcpy(&route->mca, mca, sizeof(route->mca));
+		route->groupn	= groupn;
+		route->packets	= 0;
+		timer_init(&route->timer, mrt_route_expire, route);
+
+		if (!hash_add(mrt_routes, route))
+		{
+			dolog(LOG_ERR, "Couldn't add a kernel route to the table\n");
+			pool_free(&g_conf->pool_route, route);
+			return;
+		}
+
+		listnode_link(&groupn->routes, &route->node, route);
+		timer_set(&route->timer, getmonotimes() + MRT_IDLE_TIMEOUT);
+	}
+
+	/* The source moved to another interface? Then it is accepted there now */
+	route->parent = mif;
+	mrt_route_set(route);
+}
+
+/*
+ * A packet of a route arrived on another MIF than it accepts on
+ * The source moved there, thus the route now accepts on it. The
+ * kernel limits how often it tells us, it doesn't for every packet.
+ * mif	= The MIF the packet came in on
+ * sg	= The source followed by the group, as in the IPv6 header
+ */
+static void mrt_wrongmif(uint64_t mif, const struct in6_addr *sg);
+static void mrt_wrongmif(uint64_t mif, const struct in6_addr *sg)
+{
+	struct mrtroute	*route;
+
+	if (mif >= MAXMIFS || !mrt_mifs[mif]) return;
+
+	route = (struct mrtroute *)hash_find(mrt_routes, sg);
+	if (!route || route->parent == mif) return;
+
+	route->parent = mif;
+	mrt_route_set(route);
+}
+
+/* Handle the messages the kernel sent us */
+void mrt_upcalls(void)
+{
+	union
+	{
+		struct mrt6msg	msg;
+		uint8_t		buf[2048];
+	}			u;
+	struct in6_addr		sg[2];
+	ssize_t			len;
+
+	while ((len = read(g_conf->mrtfd, &u, sizeof(u))) >= (ssize_t)sizeof(u.msg))
+	{
+		/* Upcalls look like ICMPv6 type 0, which is never a real one */
+		if (u.msg.im6_mbz != 0) continue;
+
+		memcpy(&sg[0], &u.msg.im6_src, sizeof(sg[0]));
+		memcpy(&sg[1], &u.msg.im6_dst, sizeof(sg[1]));
+
+		if (u.msg.im6_msgtype == MRT6MSG_NOCACHE)	mrt_nocache(u.msg.im6_mif, sg);
+		else if (u.msg.im6_msgtype == MRT6MSG_WRONGMIF)	mrt_wrongmif(u.msg.im6_mif, sg);
+	}
+}
+
+/* The OIL of a group changed, rewrite it's routes */
+void mrt_group_update(struct groupnode *groupn)
+{
+	struct mrtroute	*route;
+	struct listnode	*ln;
+
+	LIST_LOOP(&groupn->routes, route, ln)
+	{
+		mrt_route_set(route);
+	}
+}
+
+/* The group goes away, and so do it's routes */
+void mrt_group_del(struct groupnode *groupn)
+{
+	struct mrtroute	*route;
+	struct listnode	*ln, *next;
+
+	LIST_LOOP2(&groupn->routes, route, ln, next)
+	{
+		mrt_route_del(route);
+	}
+	LIST_LOOP2_END
+}
+
+#else /* !ECMH_BPF */
+
+void mrt_group_update(struct groupnode UNUSED *groupn)
+{
+}
+
+void mrt_group_del(struct groupnode UNUSED *groupn)
+{
+}
+
+#endif /* !ECMH_BPF */
+
@@ -0,0 +1,57 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Forwarding by the kernel (Linux IPv6 multicast routing, MRT6)
+ *
+ * With --mroute ecmh only does MLD, every interface becomes a MIF
+ * and the kernel forwards using (S,G) MFC entries. When a source
+ * sends to a group the kernel has no entry for, it tells us with a
+ * NOCACHE upcall on the mroute socket, which we answer with an entry
+ * compiled from the OIL of the group. The entries of a group are kept
+ * on it, they are rewritten when the OIL is rebuilt and removed
+ * together with the group.
+ * A source that shows up on another interface that is forwarded to
+ * makes the kernel send a WRONGMIF upcall, the entry then accepts on
+ * that interface. Entries that did not accept a packet for
+ * MRT_IDLE_TIMEOUT seconds are removed, which also takes care of a
+ * source that moved elsewhere: the kernel asks again for it.
+ * The kernel has room for MAXMIFS interfaces, the others are not
+ * forwarded to. On BSD the group functions do nothing.
+ */
+
+#ifndef __MRT_H
+#define __MRT_H
+
+#ifndef ECMH_BPF
+#include <linux/mroute6.h>
+
+/* Seconds a route may go without packets, the Keepalive_Period of PIM-SM (RFC7761) */
+#define MRT_IDLE_TIMEOUT	210
+
+/* A (S,G) entry we installed in the kernel */
+struct mrtroute
+{
+	struct in6_addr		src;		/* The source */
+	struct in6_addr		mca;		/* The group, follows src like in the IPv6 header */
+	struct groupnode	*groupn;	/* The group it belongs to */
+	uint64_t		parent;		/* The MIF packets are accepted on */
+	uint64_t		packets;	/* Accepted packets at the last check */
+	struct timer		timer;		/* Checks whether the route is still used */
+	struct listnode		node;		/* In the routes of the group */
+};
+
+/* Prototypes. */
+bool mrt_init(void);
+void mrt_cleanup(void);
+void mrt_upcalls(void);
+void mrt_int_add(struct intnode *intn);
+void mrt_int_del(struct intnode *intn);
+#endif
+void mrt_group_update(struct groupnode *groupn);
+void mrt_group_del(struct groupnode *groupn);
+
+#endif /* __MRT_H */
+
@@ -0,0 +1,102 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+void pool_init(struct pool *pool, const char *name, uint64_t size)
+{
+	memzero(pool, sizeof(*pool));
+
+	/* Room for the free list link and keep the objects aligned */
+	if (size < sizeof(void *)) size = sizeof(void *);
+	size = (size + sizeof(uint64_t) - 1) & ~((uint64_t)sizeof(uint64_t) - 1);
+
+	/* Objects made of whole cache lines start on one */
+	pool->align	= (size % ECMH_CACHELINE) == 0 ? ECMH_CACHELINE : sizeof(uint64_t);
+	pool->offset	= (sizeof(struct poolslab) + pool->align - 1) & ~(pool->align - 1);
+
+	pool->name	= name;
+	pool->size	= size;
+	pool->perslab	= (POOL_SLABSIZE - pool->offset) / size;
+	if (pool->perslab == 0) pool->perslab = 1;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	struct poolslab *slab, *next;
+
+	for (slab = pool->slabs; slab; slab = next)
+	{
+		next = slab->next;
+		free(slab);
+	}
+
+	pool->slabs	= NULL;
+	pool->slabcount	= 0;
+	pool->free	= NULL;
+	pool->used	= 0;
+}
+
+/* Add a slab and put it's objects on the free list */
+static bool pool_grow(struct pool *pool);
+static bool pool_grow(struct pool *pool)
+{
+	struct poolslab	*slab;
+	void		*mem;
+	uint8_t		*obj;
+	uint64_t	i;
+
+	if (posix_memalign(&mem, pool->align, pool->offset + (pool->perslab * pool->size)) != 0)
+	{
+		dolog(LOG_ERR, "Couldn't allocate a slab for the %s pool\n", pool->name);
+		return false;
+	}
+
+	slab		= (struct poolslab *)mem;
+	slab->next	= pool->slabs;
+	pool->slabs	= slab;
+	pool->slabcount++;
+
+	obj = ((uint8_t *)mem) + pool->offset;
+	for (i = 0; i < pool->perslab; i++, obj += pool->size)
+	{
+		*(void **)obj	= pool->free;
+		pool->free	= obj;
+	}
+
+	return true;
+}
+
+/* Get a zeroed object, NULL when out of memory */
+void *pool_alloc(struct pool *pool)
+{
+	void *obj;
+
+	if (!pool->free && !pool_grow(pool)) return NULL;
+
+	obj		= pool->free;
+	pool->free	= *(void **)obj;
+	pool->used++;
+
+	memzero(obj, pool->size);
+
+	return obj;
+}
+
+void pool_free(struct pool *pool, void *obj)
+{
+	if (!obj) return;
+
+	*(void **)obj	= pool->free;
+	pool->free	= obj;
+	pool->used--;
+}
+
+void pool_dump(const struct pool *pool, FILE *out)
+{
+	fprintf(out, "Pool %-16s: %" PRIu64 " of %" PRIu64 " in use (%" PRIu64 " bytes each, %" PRIu64 " slabs)\n",
+		pool->name, pool->used, pool->slabcount * pool->perslab, pool->size, pool->slabcount);
+}
+
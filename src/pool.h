@@ -0,0 +1,50 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Fixed size object pools
+ *
+ * Objects are carved out of slabs of POOL_SLABSIZE bytes and kept
+ * on a free list when released, so join/leave churn doesn't go
+ * through malloc() for every node. Slabs are only returned when
+ * the pool is destroyed. Only the control context allocates.
+ * Objects that are a multiple of ECMH_CACHELINE in size are
+ * put on a cache line boundary.
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+/* Size of a slab, including it's header */
+#define POOL_SLABSIZE		4096
+
+struct poolslab
+{
+	struct poolslab		*next;		/* Next slab of this pool */
+	uint64_t		__padding;	/* Keeps the objects aligned */
+};
+
+struct pool
+{
+	const char		*name;		/* Name shown in the statistics */
+	uint64_t		size;		/* Size of an object */
+	uint64_t		align;		/* Alignment of the objects */
+	uint64_t		offset;		/* Where the objects start in a slab */
+	uint64_t		perslab;	/* Objects per slab */
+	void			*free;		/* Free list, linked through the objects */
+	struct poolslab		*slabs;		/* All the slabs */
+	uint64_t		slabcount;	/* Number of slabs */
+	uint64_t		used;		/* Objects handed out */
+};
+
+/* Prototypes. */
+void pool_init(struct pool *pool, const char *name, uint64_t size);
+void pool_destroy(struct pool *pool);
+void *pool_alloc(struct pool *pool);
+void pool_free(struct pool *pool, void *obj);
+void pool_dump(const struct pool *pool, FILE *out);
+
+#endif /* __POOL_H */
+
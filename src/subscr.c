@@ -8,14 +8,14 @@
 /* Subscription Node */
 struct subscrnode *subscr_create(const struct in6_addr *ipv6, int mode)
 {
-	struct subscrnode *subscrn = calloc(1, sizeof(*subscrn));
+	struct subscrnode *subscrn = pool_alloc(&g_conf->pool_subscr);
 
 	if (!subscrn) return NULL;
 
 	/* Fill her in */
 	memcpy(&subscrn->ipv6, ipv6, sizeof(*ipv6));
 	subscrn->mode = mode;
-	subscrn->refreshtime = gettimes();
+	subscrn->refreshtime = getmonotimes();
 
 D(
 	{
@@ -35,6 +35,8 @@ void subscr_destroy(struct subscrnode *subscrn)
 {
 	if (!subscrn) return;
 
+	timer_del(&subscrn->timer);
+
 D(
 	{
 		char addr[INET6_ADDRSTRLEN];
@@ -46,36 +48,82 @@ D(
 )
 
 	/* Free the node */
-	free(subscrn);
+	pool_free(&g_conf->pool_subscr, subscrn);
 }
 
-struct subscrnode *subscr_find(const struct list *list, const struct in6_addr *ipv6)
+/* Index all the subscriptions of a grpint in a new hash */
+static void subscr_hash(struct grpintnode *grpintn);
+static void subscr_hash(struct grpintnode *grpintn)
 {
 	struct subscrnode	*subscrn;
 	struct listnode		*ln;
 
-	LIST_LOOP(list, subscrn, ln)
+	grpintn->subscrhash = hash_new(offsetof(struct subscrnode, ipv6), sizeof(struct in6_addr));
+	if (!grpintn->subscrhash) return;
+
+	LIST_LOOP(&grpintn->subscriptions, subscrn, ln)
 	{
-		if (IN6_ARE_ADDR_EQUAL(ipv6, &subscrn->ipv6)) return subscrn;
+		if (!hash_add(grpintn->subscrhash, subscrn))
+		{
+			/* Not fatal, the list still has them all */
+			hash_free(grpintn->subscrhash);
+			grpintn->subscrhash = NULL;
+			return;
+		}
 	}
-	return NULL;
 }
 
-bool subscr_unsub(struct list *list, const struct in6_addr *ipv6)
+/* Add a subscription to a grpint, it's source is not there yet */
+void subscr_add(struct grpintnode *grpintn, struct subscrnode *subscrn)
 {
-	struct subscrnode	*subscrn;
-	struct listnode		*ln;
+	listnode_link(&grpintn->subscriptions, &subscrn->node, (void *)subscrn);
+	subscrn->grpintn = grpintn;
 
-	LIST_LOOP(list, subscrn, ln)
+	if (grpintn->subscrhash)
 	{
-		if (IN6_ARE_ADDR_EQUAL(ipv6, &subscrn->ipv6))
+		if (!hash_add(grpintn->subscrhash, subscrn))
 		{
-			/* Delete the entry from the list */
-			list_delete_node(list, ln);
-			/* Destroy the item itself */
-			subscr_destroy(subscrn);
-			return true;
+			hash_free(grpintn->subscrhash);
+			grpintn->subscrhash = NULL;
 		}
 	}
-	return false;
+	else if (grpintn->subscriptions.count >= GRPINT_SUBSCR_HASHMIN)
+	{
+		subscr_hash(grpintn);
+	}
+}
+
+/* Remove a subscription from it's grpint and destroy it */
+void subscr_del(struct grpintnode *grpintn, struct subscrnode *subscrn)
+{
+	if (grpintn->subscrhash) hash_remove(grpintn->subscrhash, subscrn);
+
+	/* Delete the entry from the list */
+	list_delete_node(&grpintn->subscriptions, &subscrn->node);
+	/* Destroy the item itself */
+	subscr_destroy(subscrn);
+}
+
+struct subscrnode *subscr_find(const struct grpintnode *grpintn, const struct in6_addr *ipv6)
+{
+	struct subscrnode	*subscrn;
+	struct listnode		*ln;
+
+	if (grpintn->subscrhash) return (struct subscrnode *)hash_find(grpintn->subscrhash, ipv6);
+
+	LIST_LOOP(&grpintn->subscriptions, subscrn, ln)
+	{
+		if (IN6_ARE_ADDR_EQUAL(ipv6, &subscrn->ipv6)) return subscrn;
+	}
+	return NULL;
+}
+
+bool subscr_unsub(struct grpintnode *grpintn, const struct in6_addr *ipv6)
+{
+	struct subscrnode *subscrn = subscr_find(grpintn, ipv6);
+
+	if (!subscrn) return false;
+
+	subscr_del(grpintn, subscrn);
+	return true;
 }
@@ -9,10 +9,15 @@ struct subscrnode
 	struct in6_addr	ipv6;		/* The address that wants packets matching this S<->G */
 	uint64_t	mode;		/* MLD2_* */
 	time_t		refreshtime;	/* The time we last received a join for this S<->G on this interface */
+	struct timer	timer;		/* Expires the subscription when it isn't refreshed */
+	struct grpintnode *grpintn;	/* The grpint this subscription belongs to */
+	struct listnode	node;		/* Our node in grpintn->subscriptions */
 };
 
 struct subscrnode *subscr_create(const struct in6_addr *ipv6, int mode);
 void subscr_destroy(struct subscrnode *subscrn);
-struct subscrnode *subscr_find(const struct list *list, const struct in6_addr *ipv6);
-bool subscr_unsub(struct list *list, const struct in6_addr *ipv6);
+void subscr_add(struct grpintnode *grpintn, struct subscrnode *subscrn);
+void subscr_del(struct grpintnode *grpintn, struct subscrnode *subscrn);
+struct subscrnode *subscr_find(const struct grpintnode *grpintn, const struct in6_addr *ipv6);
+bool subscr_unsub(struct grpintnode *grpintn, const struct in6_addr *ipv6);
 
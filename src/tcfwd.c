@@ -0,0 +1,437 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+#ifndef ECMH_BPF
+
+/* BPF_TCX_INGRESS (Linux 6.6), not in every linux/bpf.h yet */
+#define TCFWD_ATTACH_INGRESS	46
+
+/* Where the program keeps the packet headers on it's stack */
+#define TCFWD_L3		((int)sizeof(struct ether_header))
+#define TCFWD_HDRLEN		(TCFWD_L3 + (int)sizeof(struct ip6_hdr))
+#define TCFWD_STK_HDR		(-62)	/* Puts the addresses on 8 byte boundaries */
+#define TCFWD_STK_SMAC		(TCFWD_STK_HDR + 6)
+#define TCFWD_STK_HLIM		(TCFWD_STK_HDR + TCFWD_L3 + (int)offsetof(struct ip6_hdr, ip6_hlim))
+#define TCFWD_STK_SG		(TCFWD_STK_HDR + TCFWD_L3 + (int)offsetof(struct ip6_hdr, ip6_src))
+#define TCFWD_STK_ANY		(-96)	/* (::,G) */
+#define TCFWD_STK_NEWHLIM	(-104)	/* The decremented hop limit */
+
+/* Offset of an outgoing interface in the map value */
+#define TCFWD_OIF(i)		((int)(offsetof(struct tcfwd_oil, oifs) + (i) * sizeof(struct tcfwd_oif)))
+
+#define TCFWD_INSNS_MAX		(96 + (TCFWD_OIFS_MAX * 16))
+#define TCFWD_JUMPS_MAX		(16 + TCFWD_OIFS_MAX)
+
+/* The labels the program jumps to */
+#define TCFWD_FOUND		0	/* Found the outgoing interfaces */
+#define TCFWD_DONE		1	/* Replicated, restore the packet */
+#define TCFWD_PASS		2	/* Let the packet go on */
+#define TCFWD_LABELS		3
+
+/* The program while it is being put together */
+struct tcfwd_asm
+{
+	struct bpf_insn		insns[TCFWD_INSNS_MAX];
+	unsigned int		count;				/* Instructions so far */
+	unsigned int		jumps[TCFWD_JUMPS_MAX];		/* Jumps to a label */
+	unsigned int		jumplabel[TCFWD_JUMPS_MAX];	/* The label they jump to */
+	unsigned int		jumpcount;
+	unsigned int		labels[TCFWD_LABELS];		/* Where the labels are */
+};
+
+static int tcfwd_map = -1;
+static int tcfwd_prog = -1;
+
+static void tcfwd_emit(struct tcfwd_asm *a, uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm);
+static void tcfwd_emit(struct tcfwd_asm *a, uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn *insn = &a->insns[a->count++];
+
+	insn->code	= code;
+	insn->dst_reg	= dst;
+	insn->src_reg	= src;
+	insn->off	= off;
+	insn->imm	= imm;
+}
+
+/* A conditional jump to a label, resolved by tcfwd_link() */
+static void tcfwd_jump(struct tcfwd_asm *a, uint8_t op, uint8_t dst, int32_t imm, unsigned int label);
+static void tcfwd_jump(struct tcfwd_asm *a, uint8_t op, uint8_t dst, int32_t imm, unsigned int label)
+{
+	a->jumps[a->jumpcount]		= a->count;
+	a->jumplabel[a->jumpcount]	= label;
+	a->jumpcount++;
+
+	tcfwd_emit(a, BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+}
+
+static void tcfwd_link(struct tcfwd_asm *a);
+static void tcfwd_link(struct tcfwd_asm *a)
+{
+	unsigned int i;
+
+	for (i = 0; i < a->jumpcount; i++)
+	{
+		a->insns[a->jumps[i]].off = a->labels[a->jumplabel[i]] - a->jumps[i] - 1;
+	}
+}
+
+/* skb_store_bytes(skb, off, fp + stk or r8 + val, len), keeping skb->csum right */
+static void tcfwd_store(struct tcfwd_asm *a, int32_t off, uint8_t from, int32_t fromoff, int32_t len);
+static void tcfwd_store(struct tcfwd_asm *a, int32_t off, uint8_t from, int32_t fromoff, int32_t len)
+{
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, off);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, from, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_3, 0, 0, fromoff);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, len);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_5, 0, 0, BPF_F_RECOMPUTE_CSUM);
+	tcfwd_emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_skb_store_bytes);
+}
+
+/* r0 = map_lookup_elem(map, fp + stk) */
+static void tcfwd_lookup(struct tcfwd_asm *a, int32_t stk);
+static void tcfwd_lookup(struct tcfwd_asm *a, int32_t stk)
+{
+	tcfwd_emit(a, BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, tcfwd_map);
+	tcfwd_emit(a, 0, 0, 0, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, stk);
+	tcfwd_emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+}
+
+/*
+ * Put the program together, the loop over the outgoing
+ * interfaces is unrolled as the verifier wants to see the end.
+ * r6 = skb, r7 = hop limit, r8 = the entry, r9 = ingress ifindex
+ */
+static void tcfwd_assemble(struct tcfwd_asm *a);
+static void tcfwd_assemble(struct tcfwd_asm *a)
+{
+	unsigned int	i, skip;
+
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_9, BPF_REG_6, offsetof(struct __sk_buff, ingress_ifindex), 0);
+
+	/* IPv6? Then copy the Ethernet and IPv6 header to the stack */
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_6, offsetof(struct __sk_buff, protocol), 0);
+	tcfwd_jump(a, BPF_JNE, BPF_REG_0, htons(ETH_P_IPV6), TCFWD_PASS);
+
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, BPF_REG_10, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_3, 0, 0, TCFWD_STK_HDR);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, TCFWD_HDRLEN);
+	tcfwd_emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_skb_load_bytes);
+	tcfwd_jump(a, BPF_JNE, BPF_REG_0, 0, TCFWD_PASS);
+
+	/* Hop limit would become 0? */
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_7, BPF_REG_10, TCFWD_STK_HLIM, 0);
+	tcfwd_jump(a, BPF_JLE, BPF_REG_7, 1, TCFWD_PASS);
+
+	/* Not multicast, or node or link local multicast? */
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_0, BPF_REG_10, TCFWD_STK_SG + 16, 0);
+	tcfwd_jump(a, BPF_JNE, BPF_REG_0, 0xff, TCFWD_PASS);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_0, BPF_REG_10, TCFWD_STK_SG + 17, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0x0f);
+	tcfwd_jump(a, BPF_JLE, BPF_REG_0, 2, TCFWD_PASS);
+
+	/* Source multicast, link local or unspecified? */
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_0, BPF_REG_10, TCFWD_STK_SG, 0);
+	tcfwd_jump(a, BPF_JEQ, BPF_REG_0, 0xff, TCFWD_PASS);
+	tcfwd_emit(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 3, 0xfe);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_0, BPF_REG_10, TCFWD_STK_SG + 1, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0xc0);
+	tcfwd_jump(a, BPF_JEQ, BPF_REG_0, 0x80, TCFWD_PASS);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_0, BPF_REG_10, TCFWD_STK_SG, 0);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_10, TCFWD_STK_SG + 8, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_OR | BPF_X, BPF_REG_0, BPF_REG_1, 0, 0);
+	tcfwd_jump(a, BPF_JEQ, BPF_REG_0, 0, TCFWD_PASS);
+
+	/* The interfaces for this source, otherwise the ones for any source */
+	tcfwd_lookup(a, TCFWD_STK_SG);
+	tcfwd_jump(a, BPF_JNE, BPF_REG_0, 0, TCFWD_FOUND);
+
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 0);
+	tcfwd_emit(a, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_1, TCFWD_STK_ANY, 0);
+	tcfwd_emit(a, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_1, TCFWD_STK_ANY + 8, 0);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_10, TCFWD_STK_SG + 16, 0);
+	tcfwd_emit(a, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_1, TCFWD_STK_ANY + 16, 0);
+	tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_10, TCFWD_STK_SG + 24, 0);
+	tcfwd_emit(a, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_1, TCFWD_STK_ANY + 24, 0);
+	tcfwd_lookup(a, TCFWD_STK_ANY);
+	tcfwd_jump(a, BPF_JEQ, BPF_REG_0, 0, TCFWD_PASS);
+
+	/* Decrement the hop limit of what we send */
+	a->labels[TCFWD_FOUND] = a->count;
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_8, BPF_REG_0, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_7, 0, 0);
+	tcfwd_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_1, 0, 0, -1);
+	tcfwd_emit(a, BPF_STX | BPF_MEM | BPF_B, BPF_REG_10, BPF_REG_1, TCFWD_STK_NEWHLIM, 0);
+	tcfwd_store(a, TCFWD_L3 + offsetof(struct ip6_hdr, ip6_hlim), BPF_REG_10, TCFWD_STK_NEWHLIM, 1);
+
+	/* A replica for every interface, except the one it came from */
+	for (i = 0; i < TCFWD_OIFS_MAX; i++)
+	{
+		tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_8, offsetof(struct tcfwd_oil, count), 0);
+		tcfwd_jump(a, BPF_JLE, BPF_REG_1, i, TCFWD_DONE);
+		tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_8, TCFWD_OIF(i), 0);
+
+		skip = a->count;
+		tcfwd_emit(a, BPF_JMP | BPF_JEQ | BPF_X, BPF_REG_2, BPF_REG_9, 0, 0);
+
+		tcfwd_store(a, offsetof(struct ether_header, ether_shost), BPF_REG_8, TCFWD_OIF(i) + offsetof(struct tcfwd_oif, mac), 6);
+		tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);
+		tcfwd_emit(a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_8, TCFWD_OIF(i), 0);
+		tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, 0);
+		tcfwd_emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_clone_redirect);
+
+		a->insns[skip].off = a->count - skip - 1;
+	}
+
+	/* The original goes on to the local stack as it was */
+	a->labels[TCFWD_DONE] = a->count;
+	tcfwd_store(a, TCFWD_L3 + offsetof(struct ip6_hdr, ip6_hlim), BPF_REG_10, TCFWD_STK_HLIM, 1);
+	tcfwd_store(a, offsetof(struct ether_header, ether_shost), BPF_REG_10, TCFWD_STK_SMAC, 6);
+
+	a->labels[TCFWD_PASS] = a->count;
+	tcfwd_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, TC_ACT_OK);
+	tcfwd_emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	tcfwd_link(a);
+}
+
+/* Attach the program to the ingress of an interface, returns the link or -1 */
+static int tcfwd_attach(unsigned int ifindex);
+static int tcfwd_attach(unsigned int ifindex)
+{
+	union bpf_attr attr;
+
+	memzero(&attr, sizeof(attr));
+	attr.link_create.prog_fd	= tcfwd_prog;
+	attr.link_create.target_ifindex	= ifindex;
+	attr.link_create.attach_type	= TCFWD_ATTACH_INGRESS;
+
+	return filter_bpf(BPF_LINK_CREATE, &attr);
+}
+
+/*
+ * Load the program and it's map, and see if the kernel can attach it
+ * Failing is not fatal, we then forward in userspace.
+ */
+bool tcfwd_init(void)
+{
+	struct tcfwd_asm	*a;
+	union bpf_attr		attr;
+	int			link;
+
+	memzero(&attr, sizeof(attr));
+	attr.map_type		= BPF_MAP_TYPE_HASH;
+	attr.key_size		= 2 * sizeof(struct in6_addr);
+	attr.value_size		= sizeof(struct tcfwd_oil);
+	attr.max_entries	= TCFWD_ROUTES_MAX;
+
+	tcfwd_map = filter_bpf(BPF_MAP_CREATE, &attr);
+	if (tcfwd_map < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't create the tc forwarding map: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+	{
+		dolog(LOG_ERR, "Couldn't allocate memory for the tc forwarding program\n");
+		tcfwd_cleanup();
+		return false;
+	}
+
+	tcfwd_assemble(a);
+
+	memzero(&attr, sizeof(attr));
+	attr.prog_type		= BPF_PROG_TYPE_SCHED_CLS;
+	attr.insn_cnt		= a->count;
+	attr.insns		= (uint64_t)(unsigned long)a->insns;
+	attr.license		= (uint64_t)(unsigned long)"GPL";
+
+	tcfwd_prog = filter_bpf(BPF_PROG_LOAD, &attr);
+	free(a);
+
+	if (tcfwd_prog < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't load the tc forwarding program: %s (%d)\n", strerror(errno), errno);
+		tcfwd_cleanup();
+		return false;
+	}
+
+	/* Try it on the loopback, it's never forwarded anyway */
+	link = tcfwd_attach(1);
+	if (link < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't attach a tc program: %s (%d)\n", strerror(errno), errno);
+		tcfwd_cleanup();
+		return false;
+	}
+	close(link);
+
+	dolog(LOG_INFO, "Forwarding with a tc eBPF program\n");
+	return true;
+}
+
+/* Closing the links detached the program already */
+void tcfwd_cleanup(void)
+{
+	if (tcfwd_prog >= 0) close(tcfwd_prog);
+	if (tcfwd_map >= 0) close(tcfwd_map);
+
+	tcfwd_prog = -1;
+	tcfwd_map = -1;
+}
+
+/* Forward what arrives on an interface, only Ethernet is understood */
+void tcfwd_int_add(struct intnode *intn)
+{
+	int link;
+
+	if (tcfwd_prog < 0 || intn->info.hwaddr.sa_family != ARPHRD_ETHER) return;
+
+	link = tcfwd_attach(intn->ifindex);
+	if (link < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't attach the tc program to %s: %s (%d)\n", intn->info.name, strerror(errno), errno);
+		return;
+	}
+
+	intn->info.tclink = link + 1;
+}
+
+void tcfwd_int_del(struct intnode *intn)
+{
+	if (intn->info.tclink == 0) return;
+
+	close(intn->info.tclink - 1);
+	intn->info.tclink = 0;
+}
+
+/* Add an interface to the value of an entry, once */
+static void tcfwd_oil_add(struct tcfwd_oil *oil, const struct intnode *intn);
+static void tcfwd_oil_add(struct tcfwd_oil *oil, const struct intnode *intn)
+{
+	uint32_t i;
+
+	if (intn->mtu == 0 || intn->info.hwaddr.sa_family != ARPHRD_ETHER) return;
+
+	for (i = 0; i < oil->count; i++)
+	{
+		if (oil->oifs[i].ifindex == intn->ifindex) return;
+	}
+
+	if (oil->count == TCFWD_OIFS_MAX)
+	{
+		dolog(LOG_WARNING, "More than %u interfaces for a group, %s isn't forwarded to\n", TCFWD_OIFS_MAX, intn->info.name);
+		return;
+	}
+
+	oil->oifs[oil->count].ifindex = intn->ifindex;
+	memcpy(oil->oifs[oil->count].mac, intn->info.hwaddr.sa_data, sizeof(oil->oifs[oil->count].mac));
+	oil->count++;
+}
+
+static void tcfwd_update(const struct in6_addr *sg, const struct tcfwd_oil *oil);
+static void tcfwd_update(const struct in6_addr *sg, const struct tcfwd_oil *oil)
+{
+	union bpf_attr attr;
+
+	memzero(&attr, sizeof(attr));
+	attr.map_fd	= tcfwd_map;
+	attr.key	= (uint64_t)(unsigned long)sg;
+	attr.value	= (uint64_t)(unsigned long)oil;
+	attr.flags	= BPF_ANY;
+
+	if (filter_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't add a group to the tc forwarding map: %s (%d)\n", strerror(errno), errno);
+	}
+}
+
+static void tcfwd_delete(const struct in6_addr *sg);
+static void tcfwd_delete(const struct in6_addr *sg)
+{
+	union bpf_attr attr;
+
+	memzero(&attr, sizeof(attr));
+	attr.map_fd	= tcfwd_map;
+	attr.key	= (uint64_t)(unsigned long)sg;
+
+	filter_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+/*
+ * Put the compiled OIL of a group in the map
+ * The per source entries include the ASM interfaces, just
+ * like l4_ipv6_replicate() sends to both.
+ */
+void tcfwd_group_add(const struct groupnode *groupn)
+{
+	struct tcfwd_oil	oil, asm_oil;
+	struct in6_addr		sg[2];
+	uint64_t		i, j;
+
+	if (tcfwd_map < 0) return;
+
+	memzero(&asm_oil, sizeof(asm_oil));
+	for (i = 0; i < groupn->oil_count; i++)
+	{
+		tcfwd_oil_add(&asm_oil, groupn->oil[i]);
+	}
+
+	memzero(&sg[0], sizeof(sg[0]));
+	memcpy(&sg[1], &groupn->mca, sizeof(sg[1]));
+	if (asm_oil.count > 0) tcfwd_update(sg, &asm_oil);
+
+	for (i = 0; i < groupn->oil_srccount; i++)
+	{
+		memcpy(&oil, &asm_oil, sizeof(oil));
+		for (j = 0; j < groupn->oil_src[i].count; j++)
+		{
+			tcfwd_oil_add(&oil, groupn->oil_src[i].ints[j]);
+		}
+
+		tcfwd_update(&groupn->oil_src[i].src, &oil);
+	}
+}
+
+/* Take the OIL of a group out of the map */
+void tcfwd_group_del(const struct groupnode *groupn)
+{
+	struct in6_addr	sg[2];
+	uint64_t	i;
+
+	if (tcfwd_map < 0) return;
+
+	memzero(&sg[0], sizeof(sg[0]));
+	memcpy(&sg[1], &groupn->mca, sizeof(sg[1]));
+	tcfwd_delete(sg);
+
+	for (i = 0; i < groupn->oil_srccount; i++)
+	{
+		tcfwd_delete(&groupn->oil_src[i].src);
+	}
+}
+
+#else /* !ECMH_BPF */
+
+void tcfwd_group_add(const struct groupnode UNUSED *groupn)
+{
+}
+
+void tcfwd_group_del(const struct groupnode UNUSED *groupn)
+{
+}
+
+#endif /* !ECMH_BPF */
+
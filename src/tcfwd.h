@@ -0,0 +1,58 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Forwarding by a tc eBPF program (Linux)
+ *
+ * With --tcbpf an eBPF program on the tc ingress of every Ethernet
+ * interface replicates the multicast with bpf_clone_redirect(), ecmh
+ * only does MLD. The program finds the outgoing interfaces in a BPF
+ * hash map on (S,G), the ASM ones of a group are under (::,G) and
+ * used when the source has no entry of it's own. The map is kept in
+ * sync with the OILs by tcfwd_group_add/del(). Like l3_ipv6() the hop
+ * limit is decremented and link and node local traffic is left alone,
+ * the replicas get the MAC address of the interface they leave on.
+ * On BSD the group functions do nothing.
+ */
+
+#ifndef __TCFWD_H
+#define __TCFWD_H
+
+/* Number of (S,G) and (::,G) entries that fit in the map */
+#define TCFWD_ROUTES_MAX	8192
+
+/* Outgoing interfaces per entry, the program is unrolled this often */
+#define TCFWD_OIFS_MAX		32
+
+#ifndef ECMH_BPF
+#include <linux/pkt_cls.h>
+
+/* An outgoing interface, as the program sees it */
+struct tcfwd_oif
+{
+	uint32_t		ifindex;	/* Where to send the replica */
+	uint8_t			mac[6];		/* The source MAC address to use */
+	uint16_t		__padding;
+};
+
+/* The value of an entry */
+struct tcfwd_oil
+{
+	uint32_t		count;		/* Number of interfaces in oifs */
+	uint32_t		__padding;
+	struct tcfwd_oif	oifs[TCFWD_OIFS_MAX];
+};
+
+/* Prototypes. */
+bool tcfwd_init(void);
+void tcfwd_cleanup(void);
+void tcfwd_int_add(struct intnode *intn);
+void tcfwd_int_del(struct intnode *intn);
+#endif
+void tcfwd_group_add(const struct groupnode *groupn);
+void tcfwd_group_del(const struct groupnode *groupn);
+
+#endif /* __TCFWD_H */
+
@@ -0,0 +1,198 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+/* The slots are circular lists, the heads are never fired */
+static struct timer	timer_l0[TIMER_L0_SLOTS];
+static struct timer	timer_l1[TIMER_L1_SLOTS];
+static uint64_t		timer_now;	/* Last second that was handled */
+static uint64_t		timer_count;	/* Number of pending timers */
+
+static void timer_link(struct timer *head, struct timer *t);
+static void timer_link(struct timer *head, struct timer *t)
+{
+	t->next		= head;
+	t->prev		= head->prev;
+	head->prev->next = t;
+	head->prev	= t;
+}
+
+static void timer_unlink(struct timer *t);
+static void timer_unlink(struct timer *t)
+{
+	t->prev->next	= t->next;
+	t->next->prev	= t->prev;
+	t->next		= NULL;
+	t->prev		= NULL;
+}
+
+/* Put a timer in the slot matching it's expiry */
+static void timer_add(struct timer *t);
+static void timer_add(struct timer *t)
+{
+	uint64_t expires = t->expires;
+
+	/* Already expired? -> Fire it on the next tick */
+	if (expires <= timer_now) expires = timer_now + 1;
+
+	if ((expires - timer_now) < TIMER_L0_SLOTS)
+	{
+		timer_link(&timer_l0[expires & (TIMER_L0_SLOTS - 1)], t);
+		return;
+	}
+
+	/* Too far away, park it in the last slot, it gets re-added */
+	if ((expires - timer_now) >= TIMER_SPAN)
+	{
+		expires = timer_now + (TIMER_SPAN - TIMER_L0_SLOTS);
+	}
+
+	timer_link(&timer_l1[(expires >> TIMER_L0_BITS) & (TIMER_L1_SLOTS - 1)], t);
+}
+
+void timers_init(uint64_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < TIMER_L0_SLOTS; i++)
+	{
+		timer_l0[i].next = timer_l0[i].prev = &timer_l0[i];
+	}
+
+	for (i = 0; i < TIMER_L1_SLOTS; i++)
+	{
+		timer_l1[i].next = timer_l1[i].prev = &timer_l1[i];
+	}
+
+	timer_now	= now;
+	timer_count	= 0;
+}
+
+/* Move all pending timers from a slot list to another */
+static void timer_move(struct timer *from, struct timer *to);
+static void timer_move(struct timer *from, struct timer *to)
+{
+	struct timer *t;
+
+	while (from->next != from)
+	{
+		t = from->next;
+		timer_unlink(t);
+		timer_link(to, t);
+	}
+}
+
+/*
+ * The clock went further than the wheel covers (suspend, a stalled
+ * loop), stepping there second by second could take ages. Put the
+ * overdue timers in the slot of now and sort the others in again.
+ */
+static void timer_rebase(uint64_t now);
+static void timer_rebase(uint64_t now)
+{
+	struct timer	*t, all;
+	unsigned int	i;
+
+	all.next = all.prev = &all;
+	for (i = 0; i < TIMER_L0_SLOTS; i++) timer_move(&timer_l0[i], &all);
+	for (i = 0; i < TIMER_L1_SLOTS; i++) timer_move(&timer_l1[i], &all);
+
+	/* timers_run() handles the slot of now next */
+	timer_now = now - 1;
+
+	while (all.next != &all)
+	{
+		t = all.next;
+		timer_unlink(t);
+
+		if (t->expires <= now)	timer_link(&timer_l0[now & (TIMER_L0_SLOTS - 1)], t);
+		else			timer_add(t);
+	}
+}
+
+/* Fire everything that expired up to and including now */
+void timers_run(uint64_t now)
+{
+	struct timer	*head, *t, cascade;
+
+	if (now > timer_now && (now - timer_now) > TIMER_SPAN)
+	{
+		timer_rebase(now);
+	}
+
+	while (timer_now < now)
+	{
+		timer_now++;
+
+		/* The first level wrapped, spread out the next second level slot */
+		if ((timer_now & (TIMER_L0_SLOTS - 1)) == 0)
+		{
+			head = &timer_l1[(timer_now >> TIMER_L0_BITS) & (TIMER_L1_SLOTS - 1)];
+
+			/* Move them out first, parked ones might go back to the same slot */
+			cascade.next = cascade.prev = &cascade;
+			timer_move(head, &cascade);
+
+			while (cascade.next != &cascade)
+			{
+				t = cascade.next;
+				timer_unlink(t);
+
+				/* Due now? -> The slot handled below */
+				if (t->expires <= timer_now)	timer_link(&timer_l0[timer_now & (TIMER_L0_SLOTS - 1)], t);
+				else				timer_add(t);
+			}
+		}
+
+		head = &timer_l0[timer_now & (TIMER_L0_SLOTS - 1)];
+		while (head->next != head)
+		{
+			t = head->next;
+			timer_unlink(t);
+			timer_count--;
+
+			/* The callback might free the node or re-arm the timer */
+			t->func(t->data);
+		}
+	}
+}
+
+uint64_t timers_pending(void)
+{
+	return timer_count;
+}
+
+void timer_init(struct timer *t, void (*func)(void *data), void *data)
+{
+	t->next		= NULL;
+	t->prev		= NULL;
+	t->expires	= 0;
+	t->func		= func;
+	t->data		= data;
+}
+
+/* (Re-)arm a timer */
+void timer_set(struct timer *t, uint64_t expires)
+{
+	if (timer_is_pending(t))
+	{
+		timer_unlink(t);
+		timer_count--;
+	}
+
+	t->expires = expires;
+	timer_add(t);
+	timer_count++;
+}
+
+void timer_del(struct timer *t)
+{
+	if (!timer_is_pending(t)) return;
+
+	timer_unlink(t);
+	timer_count--;
+}
+
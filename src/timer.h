@@ -0,0 +1,54 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * Hierarchical timer wheel with a resolution of one second
+ *
+ * The first level has a slot per second for the next TIMER_L0_SLOTS
+ * seconds, the second level a slot per TIMER_L0_SLOTS seconds. When
+ * the first level wraps, the next slot of the second level is spread
+ * out over the first one. Timers further away than the second level
+ * covers are parked in its last slot and re-added when it comes by.
+ *
+ * Arming, re-arming and deleting a timer is O(1), timers_run() only
+ * touches the timers that expire (and once the ones cascading down).
+ * The timers are embedded in the nodes they belong to and run on the
+ * monotonic clock, should it still jump further than the wheel covers
+ * all timers are sorted in again instead of stepping every second.
+ */
+
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#define TIMER_L0_BITS	8
+#define TIMER_L0_SLOTS	(1 << TIMER_L0_BITS)
+#define TIMER_L1_BITS	6
+#define TIMER_L1_SLOTS	(1 << TIMER_L1_BITS)
+
+/* Seconds the wheel covers, a bigger step of the clock re-sorts all timers */
+#define TIMER_SPAN	((uint64_t)TIMER_L0_SLOTS * TIMER_L1_SLOTS)
+
+struct timer
+{
+	struct timer	*next;			/* Slot list, NULL when not pending */
+	struct timer	*prev;
+	uint64_t	expires;		/* When to fire (getmonotimes()) */
+	void		(*func)(void *data);	/* What to call */
+	void		*data;			/* Passed to func */
+};
+
+/* Prototypes. */
+void timers_init(uint64_t now);
+void timers_run(uint64_t now);
+uint64_t timers_pending(void);
+
+void timer_init(struct timer *t, void (*func)(void *data), void *data);
+void timer_set(struct timer *t, uint64_t expires);
+void timer_del(struct timer *t);
+
+#define timer_is_pending(t)	((t)->next != NULL)
+
+#endif /* __TIMER_H */
+
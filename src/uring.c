@@ -0,0 +1,645 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+
+#ifndef ECMH_BPF
+
+/* What a completion is for, the upper half of user_data */
+#define URING_RECV		1	/* The multishot recvmsg */
+#define URING_POLL		2	/* The poll on the epoll set */
+#define URING_SEND		3	/* A sendmsg, the lower half is it's index */
+#define URING_PROBE		4	/* See uring_probe() */
+#define URING_CANCEL		5
+
+#define URING_DATA(tag, i)	(((uint64_t)(tag) << 32) | (i))
+#define URING_TAG(data)		((uint32_t)((data) >> 32))
+#define URING_INDEX(data)	((uint32_t)(data))
+
+/* Buffer group of the provided buffers */
+#define URING_BGID		0
+
+/* A completion, what we look at of it */
+struct uring_done
+{
+	uint64_t		user_data;
+	int32_t			res;
+	uint32_t		flags;
+};
+
+static int uring_fd = -1;
+static int uring_sock = -1;
+
+/* The submission queue */
+static void *uring_sqmap = NULL;
+static uint64_t uring_sqmaplen;
+static struct io_uring_sqe *uring_sqes = NULL;
+static uint64_t uring_sqeslen;
+static volatile uint32_t *uring_sqhead, *uring_sqtail;
+static uint32_t *uring_sqarray;
+static uint32_t uring_sqmask, uring_sqentries, uring_sqnext;
+
+/* The completion queue */
+static void *uring_cqmap = NULL;
+static uint64_t uring_cqmaplen;
+static struct io_uring_cqe *uring_cqes;
+static volatile uint32_t *uring_cqhead, *uring_cqtail;
+static uint32_t uring_cqmask;
+
+/* The provided buffers, their ring and the ones we are still using */
+static uint8_t *uring_bufs = NULL;
+static struct io_uring_buf_ring *uring_br = NULL;
+static uint16_t uring_brtail;
+static uint16_t uring_held[URING_CQ];
+static unsigned int uring_heldcount;
+
+/* What the multishot recvmsg is to return besides the packet */
+static struct msghdr uring_msg;
+
+/* Are the recvmsg and poll armed? Did the recvmsg fail for good? Did the poll complete? */
+static bool uring_recving, uring_polling, uring_broken, uring_events;
+
+/* Completions that came in while waiting for sends */
+static struct uring_done uring_backlog[URING_CQ];
+static unsigned int uring_backlogcount, uring_backlogpos;
+
+/* The io_uring system calls, glibc has no wrappers */
+static int uring_enter(unsigned int submit, unsigned int wait);
+static int uring_enter(unsigned int submit, unsigned int wait)
+{
+	return syscall(__NR_io_uring_enter, uring_fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/* Give a buffer back to the kernel, visible after uring_buf_publish() */
+static void uring_buf_add(uint16_t bid);
+static void uring_buf_add(uint16_t bid)
+{
+	struct io_uring_buf *buf = &uring_br->bufs[uring_brtail++ & (URING_BUFS - 1)];
+
+	buf->addr	= (uint64_t)(unsigned long)(uring_bufs + (bid * URING_BUFSIZE));
+	buf->len	= URING_BUFSIZE;
+	buf->bid	= bid;
+}
+
+static void uring_buf_publish(void);
+static void uring_buf_publish(void)
+{
+	__sync_synchronize();
+	uring_br->tail = uring_brtail;
+}
+
+/* The next free submission entry, cleared, NULL when the queue is full */
+static struct io_uring_sqe *uring_sqe(void);
+static struct io_uring_sqe *uring_sqe(void)
+{
+	struct io_uring_sqe	*sqe;
+	uint32_t		i;
+
+	if (uring_sqnext - *uring_sqhead >= uring_sqentries) return NULL;
+
+	i = uring_sqnext++ & uring_sqmask;
+	uring_sqarray[i] = i;
+
+	sqe = &uring_sqes[i];
+	memzero(sqe, sizeof(*sqe));
+
+	return sqe;
+}
+
+/* Make the new entries visible, returns how many there are to submit */
+static unsigned int uring_sq_publish(void);
+static unsigned int uring_sq_publish(void)
+{
+	__sync_synchronize();
+	*uring_sqtail = uring_sqnext;
+
+	return uring_sqnext - *uring_sqhead;
+}
+
+/* Take the next completion, the ones that were put aside first */
+static bool uring_cqe(struct uring_done *cqe, bool backlog);
+static bool uring_cqe(struct uring_done *cqe, bool backlog)
+{
+	struct io_uring_cqe	*ring;
+	uint32_t		head = *uring_cqhead;
+
+	if (backlog && uring_backlogpos < uring_backlogcount)
+	{
+		memcpy(cqe, &uring_backlog[uring_backlogpos++], sizeof(*cqe));
+		if (uring_backlogpos == uring_backlogcount) uring_backlogpos = uring_backlogcount = 0;
+		return true;
+	}
+
+	if (head == *uring_cqtail) return false;
+	__sync_synchronize();
+
+	ring = &uring_cqes[head & uring_cqmask];
+	cqe->user_data	= ring->user_data;
+	cqe->res	= ring->res;
+	cqe->flags	= ring->flags;
+
+	__sync_synchronize();
+	*uring_cqhead = head + 1;
+
+	return true;
+}
+
+/* (Re)arm the recvmsg and the poll, they are submitted with the next enter */
+static void uring_arm(void);
+static void uring_arm(void)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!uring_recving && (sqe = uring_sqe()) != NULL)
+	{
+		sqe->opcode	= IORING_OP_RECVMSG;
+		sqe->fd		= uring_sock;
+		sqe->addr	= (uint64_t)(unsigned long)&uring_msg;
+		sqe->len	= 1;
+		sqe->ioprio	= IORING_RECV_MULTISHOT;
+		sqe->flags	= IOSQE_BUFFER_SELECT;
+		sqe->buf_group	= URING_BGID;
+		sqe->user_data	= URING_DATA(URING_RECV, 0);
+		uring_recving	= true;
+	}
+
+	/* Oneshot, rearmed after epoll was looked at, as it is level triggered */
+	if (!uring_polling && (sqe = uring_sqe()) != NULL)
+	{
+		sqe->opcode		= IORING_OP_POLL_ADD;
+		sqe->fd			= g_conf->epoll;
+#if __BYTE_ORDER == __BIG_ENDIAN
+		/* The kernel reads it as two swapped halves */
+		sqe->poll32_events	= (POLLIN << 16) | (POLLIN >> 16);
+#else
+		sqe->poll32_events	= POLLIN;
+#endif
+		sqe->user_data		= URING_DATA(URING_POLL, 0);
+		uring_polling		= true;
+	}
+}
+
+/* Closing the ring cancels what is still outstanding */
+static void uring_cleanup(void);
+static void uring_cleanup(void)
+{
+	if (uring_fd >= 0) close(uring_fd);
+	uring_fd = -1;
+
+	if (uring_sqmap && uring_sqmap != MAP_FAILED) munmap(uring_sqmap, uring_sqmaplen);
+	if (uring_cqmap && uring_cqmap != MAP_FAILED) munmap(uring_cqmap, uring_cqmaplen);
+	if (uring_sqes && (void *)uring_sqes != MAP_FAILED) munmap(uring_sqes, uring_sqeslen);
+	if (uring_bufs && uring_bufs != MAP_FAILED) munmap(uring_bufs, URING_BUFS * URING_BUFSIZE);
+	if (uring_br && (void *)uring_br != MAP_FAILED) munmap(uring_br, URING_BUFS * sizeof(struct io_uring_buf));
+
+	uring_sqmap	= NULL;
+	uring_cqmap	= NULL;
+	uring_sqes	= NULL;
+	uring_bufs	= NULL;
+	uring_br	= NULL;
+}
+
+/*
+ * Can the kernel do a multishot recvmsg? It came with Linux 6.0,
+ * a year after the provided buffer rings. Older ones fail it
+ * with EINVAL right away, newer ones wait on the socket, for
+ * which a datagram socket that never gets anything is used.
+ */
+static bool uring_probe(void);
+static bool uring_probe(void)
+{
+	struct io_uring_sqe	*sqe;
+	struct uring_done	cqe;
+	int			sv[2];
+	bool			ret = false;
+	unsigned int		done = 0;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't create a socket pair: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	sqe = uring_sqe();
+	sqe->opcode	= IORING_OP_RECVMSG;
+	sqe->fd		= sv[0];
+	sqe->addr	= (uint64_t)(unsigned long)&uring_msg;
+	sqe->len	= 1;
+	sqe->ioprio	= IORING_RECV_MULTISHOT;
+	sqe->flags	= IOSQE_BUFFER_SELECT;
+	sqe->buf_group	= URING_BGID;
+	sqe->user_data	= URING_DATA(URING_PROBE, 0);
+
+	sqe = uring_sqe();
+	sqe->opcode	= IORING_OP_ASYNC_CANCEL;
+	sqe->addr	= URING_DATA(URING_PROBE, 0);
+	sqe->user_data	= URING_DATA(URING_CANCEL, 0);
+
+	/* Both complete, the recvmsg with EINVAL or, when it waited, as cancelled */
+	while (done < 2)
+	{
+		if (uring_enter(uring_sq_publish(), 1) < 0 && errno != EINTR)
+		{
+			dolog(LOG_WARNING, "Couldn't wait for io_uring: %s (%d)\n", strerror(errno), errno);
+			break;
+		}
+
+		while (uring_cqe(&cqe, false))
+		{
+			done++;
+			if (URING_TAG(cqe.user_data) == URING_PROBE) ret = (cqe.res == -ECANCELED);
+		}
+	}
+
+	close(sv[0]);
+	close(sv[1]);
+
+	return ret;
+}
+
+/*
+ * Setup the ring and the provided buffers
+ * Failing is not fatal, we then use epoll and recvfrom().
+ */
+static bool uring_init(void);
+static bool uring_init(void)
+{
+	struct io_uring_params	p;
+	struct io_uring_buf_reg	reg;
+	uint16_t		bid;
+
+	memzero(&p, sizeof(p));
+	p.flags		= IORING_SETUP_CQSIZE;
+	p.cq_entries	= URING_CQ;
+
+	uring_fd = syscall(__NR_io_uring_setup, URING_SQ, &p);
+	if (uring_fd < 0)
+	{
+		dolog(LOG_WARNING, "Couldn't setup io_uring: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	uring_sqmaplen	= p.sq_off.array + (p.sq_entries * sizeof(uint32_t));
+	uring_cqmaplen	= p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+	uring_sqeslen	= p.sq_entries * sizeof(struct io_uring_sqe);
+
+	uring_sqmap	= mmap(NULL, uring_sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQ_RING);
+	uring_cqmap	= mmap(NULL, uring_cqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_CQ_RING);
+	uring_sqes	= mmap(NULL, uring_sqeslen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQES);
+	uring_bufs	= mmap(NULL, URING_BUFS * URING_BUFSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	uring_br	= mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (	uring_sqmap == MAP_FAILED || uring_cqmap == MAP_FAILED || (void *)uring_sqes == MAP_FAILED ||
+		uring_bufs == MAP_FAILED || (void *)uring_br == MAP_FAILED)
+	{
+		dolog(LOG_WARNING, "Couldn't map the io_uring: %s (%d)\n", strerror(errno), errno);
+		uring_cleanup();
+		return false;
+	}
+
+	uring_sqhead	= (uint32_t *)((uint8_t *)uring_sqmap + p.sq_off.head);
+	uring_sqtail	= (uint32_t *)((uint8_t *)uring_sqmap + p.sq_off.tail);
+	uring_sqarray	= (uint32_t *)((uint8_t *)uring_sqmap + p.sq_off.array);
+	uring_sqmask	= *(uint32_t *)((uint8_t *)uring_sqmap + p.sq_off.ring_mask);
+	uring_sqentries	= p.sq_entries;
+	uring_sqnext	= *uring_sqtail;
+
+	uring_cqhead	= (uint32_t *)((uint8_t *)uring_cqmap + p.cq_off.head);
+	uring_cqtail	= (uint32_t *)((uint8_t *)uring_cqmap + p.cq_off.tail);
+	uring_cqes	= (struct io_uring_cqe *)((uint8_t *)uring_cqmap + p.cq_off.cqes);
+	uring_cqmask	= *(uint32_t *)((uint8_t *)uring_cqmap + p.cq_off.ring_mask);
+
+	/* Provided buffer rings came with Linux 5.19 */
+	memzero(&reg, sizeof(reg));
+	reg.ring_addr		= (uint64_t)(unsigned long)uring_br;
+	reg.ring_entries	= URING_BUFS;
+	reg.bgid		= URING_BGID;
+
+	if (syscall(__NR_io_uring_register, uring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+	{
+		dolog(LOG_WARNING, "Couldn't register the io_uring buffers: %s (%d)\n", strerror(errno), errno);
+		uring_cleanup();
+		return false;
+	}
+
+	uring_brtail = 0;
+	for (bid = 0; bid < URING_BUFS; bid++)
+	{
+		uring_buf_add(bid);
+	}
+	uring_buf_publish();
+
+	/* Every packet comes with where it came from */
+	memzero(&uring_msg, sizeof(uring_msg));
+	uring_msg.msg_namelen	= sizeof(struct sockaddr_ll);
+
+	uring_recving		= false;
+	uring_polling		= false;
+	uring_broken		= false;
+	uring_events		= false;
+	uring_heldcount		= 0;
+	uring_backlogcount	= 0;
+	uring_backlogpos	= 0;
+
+	if (!uring_probe())
+	{
+		dolog(LOG_WARNING, "io_uring can't do a multishot recvmsg, that needs Linux 6.0\n");
+		uring_cleanup();
+		return false;
+	}
+
+	dolog(LOG_INFO, "Receiving and sending through io_uring\n");
+	return true;
+}
+
+/* Submit what is queued and wait till something completed */
+static bool uring_wait(void);
+static bool uring_wait(void)
+{
+	if (uring_broken) return false;
+
+	uring_arm();
+
+	/* Something left from the last time? Then don't wait */
+	if (uring_enter(uring_sq_publish(), (uring_backlogcount || *uring_cqhead != *uring_cqtail) ? 0 : 1) < 0 && errno != EINTR)
+	{
+		dolog(LOG_ERR, "Couldn't wait for io_uring: %s (%d)\n", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * The packets that were received, at most max, they stay in their
+ * buffers till uring_release(). uring_events is set when the epoll
+ * set has something to handle.
+ */
+static unsigned int uring_receive(struct iopacket *pkts, unsigned int max);
+static unsigned int uring_receive(struct iopacket *pkts, unsigned int max)
+{
+	struct io_uring_recvmsg_out	*out;
+	struct uring_done		cqe;
+	unsigned int			n = 0;
+	uint16_t			bid;
+
+	while (n < max && uring_cqe(&cqe, true))
+	{
+		if (URING_TAG(cqe.user_data) == URING_POLL)
+		{
+			uring_polling	= false;
+			uring_events	= true;
+			continue;
+		}
+
+		if (URING_TAG(cqe.user_data) != URING_RECV) continue;
+
+		/* Stopped, because it ran out of buffers for instance */
+		if (!(cqe.flags & IORING_CQE_F_MORE)) uring_recving = false;
+
+		/* Out of buffers is solved by releasing them, anything else by giving up */
+		if (cqe.res < 0)
+		{
+			if (cqe.res != -ENOBUFS && !uring_recving)
+			{
+				dolog(LOG_ERR, "Couldn't receive with io_uring: %s (%d)\n", strerror(-cqe.res), -cqe.res);
+				uring_broken = true;
+			}
+			continue;
+		}
+
+		if (!(cqe.flags & IORING_CQE_F_BUFFER)) continue;
+
+		bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+		uring_held[uring_heldcount++] = bid;
+
+		/* The buffer starts with what recvmsg returned, then the address and the packet */
+		out = (struct io_uring_recvmsg_out *)(uring_bufs + (bid * URING_BUFSIZE));
+		if (out->flags & MSG_TRUNC) continue;
+
+		if (packet_fill(&pkts[n], (struct sockaddr_ll *)(out + 1),
+				(uint8_t *)(out + 1) + uring_msg.msg_namelen + uring_msg.msg_controllen,
+				out->payloadlen))
+		{
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/* The packets of the last uring_receive() are forwarded, their buffers can be reused */
+static void uring_release(void);
+static void uring_release(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < uring_heldcount; i++)
+	{
+		uring_buf_add(uring_held[i]);
+	}
+	uring_heldcount = 0;
+
+	uring_buf_publish();
+}
+
+/*
+ * Keep a completion for uring_receive(), while waiting for sends.
+ * What no longer fits is undone: the buffer goes back to the ring
+ * and a stopped receive or poll is armed again.
+ */
+static void uring_keep(struct uring_done *cqe);
+static void uring_keep(struct uring_done *cqe)
+{
+	/* Move what is left to the front when the end is reached */
+	if (uring_backlogcount == URING_CQ && uring_backlogpos > 0)
+	{
+		uring_backlogcount -= uring_backlogpos;
+		memmove(&uring_backlog[0], &uring_backlog[uring_backlogpos], uring_backlogcount * sizeof(*cqe));
+		uring_backlogpos = 0;
+	}
+
+	if (uring_backlogcount < URING_CQ)
+	{
+		memcpy(&uring_backlog[uring_backlogcount++], cqe, sizeof(*cqe));
+		return;
+	}
+
+	switch (URING_TAG(cqe->user_data))
+	{
+	case URING_POLL:
+		uring_polling	= false;
+		uring_events	= true;
+		break;
+
+	case URING_RECV:
+		if (!(cqe->flags & IORING_CQE_F_MORE)) uring_recving = false;
+		if (!(cqe->flags & IORING_CQE_F_BUFFER)) break;
+
+		uring_buf_add(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		uring_buf_publish();
+		dolog(LOG_WARNING, "io_uring backlog full, dropped a received packet\n");
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ * Send a batch of packets as hardlinked sendmsg's, in order, and
+ * without the failure of one cancelling the rest. Waits till all
+ * of them completed, as the packets live in the receive buffers.
+ * Their result is what sendmsg() would have returned, or -errno.
+ */
+static void uring_sendmsgs(struct iotx *tx, unsigned int count);
+static void uring_sendmsgs(struct iotx *tx, unsigned int count)
+{
+	struct mmsghdr		*msgs = g_worker->msgs.msgs;
+	struct io_uring_sqe	*sqe, *last = NULL;
+	struct uring_done	cqe;
+	unsigned int		i, pending = 0;
+
+	packet_msgs(tx, count);
+
+	for (i = 0; i < count; i++)
+	{
+		tx[i].result = -ENOBUFS;
+
+		sqe = uring_sqe();
+		if (!sqe) continue;
+
+		sqe->opcode	= IORING_OP_SENDMSG;
+		sqe->fd		= uring_sock;
+		sqe->addr	= (uint64_t)(unsigned long)&msgs[i].msg_hdr;
+		sqe->len	= 1;
+		sqe->flags	= IOSQE_IO_HARDLINK;
+		sqe->user_data	= URING_DATA(URING_SEND, i);
+		last		= sqe;
+		pending++;
+	}
+
+	/* The chain ends with the last one */
+	if (last) last->flags = 0;
+
+	if (pending == 0) return;
+
+	if (uring_enter(uring_sq_publish(), pending) < 0 && errno != EINTR)
+	{
+		dolog(LOG_ERR, "Couldn't submit to io_uring: %s (%d)\n", strerror(errno), errno);
+	}
+
+	while (pending > 0)
+	{
+		if (!uring_cqe(&cqe, false))
+		{
+			if (uring_enter(0, 1) < 0 && errno != EINTR) break;
+			continue;
+		}
+
+		/* Receives and polls are handled later on */
+		if (URING_TAG(cqe.user_data) != URING_SEND)
+		{
+			uring_keep(&cqe);
+			continue;
+		}
+
+		tx[URING_INDEX(cqe.user_data)].result = cqe.res;
+		pending--;
+	}
+}
+
+/*
+ * The PACKET socket of the main thread is read on the ring
+ * It's receive ring would be in the way, workers keep theirs.
+ */
+static bool io_uring_open(void);
+static bool io_uring_open(void)
+{
+	if (!uring_init()) return false;
+
+	if (g_conf->rxring && !g_conf->workers)
+	{
+		dolog(LOG_WARNING, "Not using the receive ring, io_uring receives\n");
+		g_conf->rxring = false;
+	}
+
+	if (!packet_open(&g_conf->control))
+	{
+		packet_close(&g_conf->control);
+		uring_cleanup();
+		return false;
+	}
+
+	uring_sock = g_conf->control.socket;
+
+	return true;
+}
+
+static void io_uring_close(void);
+static void io_uring_close(void)
+{
+	uring_cleanup();
+	packet_close(&g_conf->control);
+}
+
+/* Did the epoll set become readable? */
+static bool io_uring_ready(void);
+static bool io_uring_ready(void)
+{
+	bool ready = uring_events;
+
+	uring_events = false;
+
+	return ready;
+}
+
+/* The workers receive and send on their own socket */
+static int io_uring_receive(int fd, struct iopacket *pkts, unsigned int max);
+static int io_uring_receive(int fd, struct iopacket *pkts, unsigned int max)
+{
+	if (!IS_CONTROL()) return io_packet.receive(fd, pkts, max);
+
+	return uring_receive(pkts, max);
+}
+
+static void io_uring_release(void);
+static void io_uring_release(void)
+{
+	if (!IS_CONTROL()) io_packet.release();
+	else uring_release();
+}
+
+static void io_uring_transmit(struct iotx *tx, unsigned int count);
+static void io_uring_transmit(struct iotx *tx, unsigned int count)
+{
+	if (!IS_CONTROL()) io_packet.transmit(tx, count);
+	else uring_sendmsgs(tx, count);
+}
+
+static void io_uring_stats(FILE *out);
+static void io_uring_stats(FILE *out)
+{
+	fprintf(out, "io_uring             : %u submission and %u completion entries, %u buffers\n", uring_sqentries, URING_CQ, URING_BUFS);
+	io_packet.stats(out);
+}
+
+const struct iobackend io_uring =
+{
+	"uring",
+	true,
+	io_uring_open,
+	io_uring_close,
+	NULL,			/* attach */
+	NULL,			/* detach */
+	uring_wait,
+	io_uring_ready,
+	io_uring_receive,
+	io_uring_release,
+	io_uring_transmit,
+	io_uring_stats
+};
+
+#endif /* !ECMH_BPF */
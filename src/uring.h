@@ -0,0 +1,34 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * The event loop of the main thread on io_uring (Linux)
+ *
+ * With --io uring the PACKET socket of the main thread is read with a
+ * multishot recvmsg, the kernel picks a buffer from a provided buffer
+ * ring for every packet. What is forwarded goes out as a hardlinked
+ * batch of sendmsg's, one io_uring_enter() submits the batch and
+ * waits for it. The other file descriptors (timers, signals, upcalls)
+ * stay in the epoll set, which is polled on the ring as well, so the
+ * main thread only waits in io_uring_enter(). The workers have their
+ * own sockets and receive and send like the packet backend.
+ */
+
+#ifndef __URING_H
+#define __URING_H
+
+#ifndef ECMH_BPF
+#include <linux/io_uring.h>
+
+/* Entries of the submission and completion queues */
+#define URING_SQ		256
+#define URING_CQ		1024
+
+/* Provided buffers (power of 2) and their size, holding a packet with it's address */
+#define URING_BUFS		512
+#define URING_BUFSIZE		2048
+#endif
+
+#endif /* __URING_H */
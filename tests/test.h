@@ -0,0 +1,26 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * What the tests share
+ *
+ * A test is a program that returns 0 when everything checked out,
+ * CHECK() reports the first thing that didn't and exits.
+ */
+
+#ifndef __TEST_H
+#define __TEST_H
+
+#define CHECK(expr) \
+	do \
+	{ \
+		if (!(expr)) \
+		{ \
+			fprintf(stderr, "%s:%u: check failed: %s\n", __FILE__, __LINE__, #expr); \
+			exit(1); \
+		} \
+	} while (0)
+
+#endif /* __TEST_H */
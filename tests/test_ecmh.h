@@ -0,0 +1,107 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+/*
+ * What the tests that include ecmh.c share
+ *
+ * Those get at it's static functions that way, main() is renamed
+ * before including it. test_init() sets things up like main() does,
+ * but with the memory backend, and test_int() makes interfaces that
+ * only exist in the interface table.
+ */
+
+#ifndef __TEST_ECMH_H
+#define __TEST_ECMH_H
+
+static void test_init(void);
+static void test_init(void)
+{
+	void *mem;
+
+	init();
+	g_conf->daemonize	= false;
+	g_conf->verbose		= false;
+
+	/* A single context, the main thread */
+	counters_init(1);
+	CHECK(posix_memalign(&mem, ECMH_CACHELINE, sizeof(*g_conf->flows) * ECMH_FLOWCACHE) == 0);
+	g_conf->flows = (struct flowentry *)mem;
+	memzero(g_conf->flows, sizeof(*g_conf->flows) * ECMH_FLOWCACHE);
+	g_conf->oil_gen = 1;
+	g_flows = g_conf->flows;
+	CHECK(counter_alloc(&g_conf->counters));
+
+	g_conf->io = &io_memory;
+	CHECK(g_conf->io->open());
+}
+
+/* An Ethernet interface called test<ifindex>, in the first page of the interface map */
+static struct intnode *test_int(unsigned int ifindex);
+static struct intnode *test_int(unsigned int ifindex)
+{
+	struct intnode *intn;
+
+	CHECK(ifindex < INT_MAP_SIZE);
+
+	if (!g_conf->intmap)
+	{
+		g_conf->intmap = (struct intnode ***)calloc(1, sizeof(*g_conf->intmap));
+		CHECK(g_conf->intmap != NULL);
+		g_conf->intmap[0] = (struct intnode **)calloc(INT_MAP_SIZE, sizeof(**g_conf->intmap));
+		CHECK(g_conf->intmap[0] != NULL);
+		g_conf->intmap_pages = 1;
+	}
+
+	if (g_conf->intcount == g_conf->intsize)
+	{
+		g_conf->intsize = g_conf->intsize ? g_conf->intsize * 2 : 16;
+		g_conf->ints = (struct intnode **)realloc(g_conf->ints, sizeof(*g_conf->ints) * g_conf->intsize);
+		CHECK(g_conf->ints != NULL);
+	}
+
+	intn = (struct intnode *)pool_alloc(&g_conf->pool_int);
+	CHECK(intn != NULL);
+	CHECK(counter_alloc(&intn->info.counters));
+
+	intn->ifindex			= ifindex;
+	intn->mtu			= 1500;
+	intn->info.hwaddr.sa_family	= ARPHRD_ETHER;
+	intn->info.groups.embedded	= true;
+	snprintf(intn->info.name, sizeof(intn->info.name), "test%u", ifindex);
+
+	g_conf->intmap[0][ifindex] = intn;
+	g_conf->ints[g_conf->intcount++] = intn;
+	intn->info.active = g_conf->intcount;
+
+	return intn;
+}
+
+/* An address out of it's text form */
+static void test_addr(struct in6_addr *addr, const char *text);
+static void test_addr(struct in6_addr *addr, const char *text)
+{
+	CHECK(inet_pton(AF_INET6, text, addr) == 1);
+}
+
+/* Like an MLD report does: intn wants src (:: for any) of mca */
+static struct grpintnode *test_join(struct intnode *intn, const char *mca, const char *src);
+static struct grpintnode *test_join(struct intnode *intn, const char *mca, const char *src)
+{
+	struct in6_addr		group, source;
+	struct grpintnode	*grpintn;
+	bool			isnew;
+
+	test_addr(&group, mca);
+	test_addr(&source, src);
+
+	grpintn = groupint_get(&group, intn, &isnew);
+	CHECK(grpintn != NULL);
+	CHECK(grpint_refresh(grpintn, &source, MLD2_MODE_IS_INCLUDE));
+	group_oil_update(grpintn->groupn);
+
+	return grpintn;
+}
+
+#endif /* __TEST_ECMH_H */
@@ -0,0 +1,172 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#define main ecmh_main
+#include "../src/ecmh.c"
+#undef main
+
+#include "test.h"
+#include "test_ecmh.h"
+
+/* A UDP packet from the source to the group */
+struct udp6
+{
+	struct ip6_hdr	ip6;
+	struct udphdr	udp;
+	uint8_t		payload[64];
+};
+
+static struct udp6 packet;
+
+static void packet_init(const char *src, const char *mca);
+static void packet_init(const char *src, const char *mca)
+{
+	memzero(&packet, sizeof(packet));
+	packet.ip6.ip6_vfc	= 0x60;
+	packet.ip6.ip6_plen	= htons(sizeof(packet) - sizeof(packet.ip6));
+	packet.ip6.ip6_nxt	= IPPROTO_UDP;
+	packet.ip6.ip6_hlim	= 64;
+	test_addr(&packet.ip6.ip6_src, src);
+	test_addr(&packet.ip6.ip6_dst, mca);
+	packet.udp.uh_sport	= htons(4000);
+	packet.udp.uh_dport	= htons(5000);
+	packet.udp.uh_ulen	= packet.ip6.ip6_plen;
+}
+
+/* Receive the packet on intn, returns on how many interfaces it was sent */
+static unsigned int forward(struct intnode *intn);
+static unsigned int forward(struct intnode *intn)
+{
+	const struct iomemory	*sent;
+	unsigned int		count, i;
+
+	io_memory_clear();
+	CHECK(io_memory_inject(intn->ifindex, ETH_P_IPV6, &packet, sizeof(packet)));
+	CHECK(handlereceive(-1) == 1);
+
+	sent = io_memory_sent(&count);
+	for (i = 0; i < count; i++)
+	{
+		CHECK(sent[i].ifindex != intn->ifindex);
+		CHECK(sent[i].len == sizeof(packet));
+		CHECK(((const struct ip6_hdr *)sent[i].packet)->ip6_hlim == packet.ip6.ip6_hlim - 1);
+	}
+
+	return count;
+}
+
+/* Was the packet sent on intn by the last forward()? */
+static bool sent_on(const struct intnode *intn);
+static bool sent_on(const struct intnode *intn)
+{
+	const struct iomemory	*sent;
+	unsigned int		count, i;
+
+	sent = io_memory_sent(&count);
+	for (i = 0; i < count; i++)
+	{
+		if (sent[i].ifindex == intn->ifindex) return true;
+	}
+
+	return false;
+}
+
+/* Is the flow of the packet received on intn cached? */
+static struct flowentry *cached(struct intnode *intn);
+static struct flowentry *cached(struct intnode *intn)
+{
+	struct flowentry *flow = flow_slot(intn, &packet.ip6);
+
+	return flow_hit(flow, intn, &packet.ip6) ? flow : NULL;
+}
+
+/* Every change of the membership is seen by the next packet of a cached flow */
+static void test_invalidate(struct intnode **ints);
+static void test_invalidate(struct intnode **ints)
+{
+	struct grpintnode	*b, *c;
+	struct in6_addr		any, source;
+	struct flowentry	*flow;
+
+	test_addr(&any, "::");
+	test_addr(&source, "2001:db8::1");
+	packet_init("2001:db8::1", "ff0e::1234");
+
+	/* Nobody wants it, which is cached too */
+	CHECK(forward(ints[0]) == 0);
+	flow = cached(ints[0]);
+	CHECK(flow != NULL && flow->groupn == NULL);
+	CHECK(forward(ints[0]) == 0);
+
+	/* A new group */
+	b = test_join(ints[1], "ff0e::1234", "::");
+	CHECK(cached(ints[0]) == NULL);
+	CHECK(forward(ints[0]) == 1 && sent_on(ints[1]));
+
+	flow = cached(ints[0]);
+	CHECK(flow != NULL && flow->groupn == b->groupn && flow->oils == NULL);
+	CHECK(forward(ints[0]) == 1 && sent_on(ints[1]));
+
+	/* Another interface, for this source only */
+	c = test_join(ints[2], "ff0e::1234", "2001:db8::1");
+	CHECK(forward(ints[0]) == 2 && sent_on(ints[1]) && sent_on(ints[2]));
+	CHECK(cached(ints[0])->oils != NULL);
+
+	/* Not sent back to where it came from */
+	CHECK(forward(ints[2]) == 1 && sent_on(ints[1]));
+
+	/* Another source is not for the second interface */
+	packet_init("2001:db8::2", "ff0e::1234");
+	CHECK(forward(ints[0]) == 1 && sent_on(ints[1]));
+	packet_init("2001:db8::1", "ff0e::1234");
+
+	/* The first one leaves */
+	CHECK(subscr_unsub(b, &any));
+	group_oil_build(b->groupn);
+	CHECK(forward(ints[0]) == 1 && sent_on(ints[2]));
+
+	/* And the group goes away */
+	CHECK(groupint_delete(b));
+	CHECK(!groupint_delete(c));
+	CHECK(cached(ints[0]) == NULL);
+	CHECK(forward(ints[0]) == 0);
+}
+
+/* Packets that are never forwarded */
+static void test_scopes(struct intnode **ints);
+static void test_scopes(struct intnode **ints)
+{
+	test_join(ints[1], "ff02::1234", "::");
+	test_join(ints[1], "ff0e::1234", "::");
+
+	packet_init("2001:db8::1", "ff02::1234");
+	CHECK(forward(ints[0]) == 0);
+
+	packet_init("fe80::1", "ff0e::1234");
+	CHECK(forward(ints[0]) == 0);
+
+	/* Out of hops */
+	packet_init("2001:db8::1", "ff0e::1234");
+	packet.ip6.ip6_hlim = 1;
+	CHECK(forward(ints[0]) == 0);
+
+	packet.ip6.ip6_hlim = 2;
+	CHECK(forward(ints[0]) == 1);
+}
+
+int main(void)
+{
+	struct intnode	*ints[3];
+	unsigned int	i;
+
+	test_init();
+
+	for (i = 0; i < 3; i++) ints[i] = test_int(i + 1);
+
+	test_invalidate(ints);
+	test_scopes(ints);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#include "ecmh.h"
+#include "test.h"
+
+#define ELEMENTS	1000
+
+struct element
+{
+	uint32_t	key;
+	bool		present;	/* In the table according to the test */
+	bool		seen;		/* Visited by the current iteration */
+};
+
+static struct element elements[ELEMENTS];
+
+/* Every element in the table is visited exactly once, and nothing else */
+static void check_iterate(struct hashtable *hash);
+static void check_iterate(struct hashtable *hash)
+{
+	struct element	*e;
+	uint64_t	i, visits = 0, present = 0;
+
+	for (i = 0; i < ELEMENTS; i++) elements[i].seen = false;
+
+	HASH_LOOP(hash, e, i)
+	{
+		CHECK(e->present);
+		CHECK(!e->seen);
+		e->seen = true;
+		visits++;
+	}
+
+	for (i = 0; i < ELEMENTS; i++)
+	{
+		if (elements[i].present) present++;
+	}
+
+	CHECK(visits == present);
+	CHECK((uint64_t)hashcount(hash) == present);
+}
+
+/* Every element is found when it is there, and only then */
+static void check_find(struct hashtable *hash);
+static void check_find(struct hashtable *hash)
+{
+	uint64_t i;
+
+	for (i = 0; i < ELEMENTS; i++)
+	{
+		if (elements[i].present)	CHECK(hash_find(hash, &elements[i].key) == &elements[i]);
+		else				CHECK(hash_find(hash, &elements[i].key) == NULL);
+	}
+}
+
+/* Remove and look up elements while a resize is moving them over */
+static void test_migration(void);
+static void test_migration(void)
+{
+	struct hashtable	*hash = hash_new(offsetof(struct element, key), sizeof(uint32_t));
+	uint64_t		i, migrations = 0;
+
+	CHECK(hash != NULL);
+
+	for (i = 0; i < ELEMENTS; i++)
+	{
+		elements[i].key		= (uint32_t)(i * 2654435761U);
+		elements[i].present	= false;
+	}
+
+	for (i = 0; i < ELEMENTS; i++)
+	{
+		CHECK(hash_add(hash, &elements[i]));
+		elements[i].present = true;
+
+		if (!hash->old) continue;
+		migrations++;
+
+		/* The oldest element has been moved over by now, the next one maybe not */
+		if (i > 0 && elements[i / 2].present)
+		{
+			CHECK(hash_remove(hash, &elements[i / 2]));
+			elements[i / 2].present = false;
+		}
+
+		check_find(hash);
+		check_iterate(hash);
+	}
+
+	CHECK(migrations > 0);
+
+	/* And once everything settled */
+	for (i = 0; i < ELEMENTS; i += 3)
+	{
+		if (!elements[i].present) continue;
+
+		CHECK(hash_remove(hash, &elements[i]));
+		CHECK(!hash_remove(hash, &elements[i]));
+		elements[i].present = false;
+	}
+
+	check_find(hash);
+	check_iterate(hash);
+
+	hash_free(hash);
+}
+
+int main(void)
+{
+	test_migration();
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/**************************************
+ ecmh - Easy Cast du Multi Hub
+ by Jeroen Massar <jeroen@massar.ch>
+**************************************/
+
+#define main ecmh_main
+#include "../src/ecmh.c"
+#undef main
+
+#include "test.h"
+#include "test_ecmh.h"
+
+/* Is intn in the interface array? */
+static bool has_int(struct intnode **ints, uint64_t count, const struct intnode *intn);
+static bool has_int(struct intnode **ints, uint64_t count, const struct intnode *intn)
+{
+	uint64_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (ints[i] == intn) return true;
+	}
+
+	return false;
+}
+
+/* The source of a group its OIL has, NULL when none */
+static struct oilsrc *find_src(const char *mca, const char *src);
+static struct oilsrc *find_src(const char *mca, const char *src)
+{
+	struct in6_addr		group, source;
+	struct groupnode	*groupn;
+
+	test_addr(&group, mca);
+	test_addr(&source, src);
+
+	groupn = group_find(&group);
+	CHECK(groupn != NULL);
+
+	return group_oil_find(groupn, &source);
+}
+
+/* The channel (S,G) of an SSM group, NULL when none */
+static struct oilsrc *find_channel(const char *mca, const char *src);
+static struct oilsrc *find_channel(const char *mca, const char *src)
+{
+	struct in6_addr sg[2];
+
+	test_addr(&sg[0], src);
+	test_addr(&sg[1], mca);
+
+	return channel_find(sg);
+}
+
+/* Only ff3x::/96 is SSM, bytes 2 till 11 have to be zero */
+static void test_ssm_range(void);
+static void test_ssm_range(void)
+{
+	struct in6_addr addr;
+
+	test_addr(&addr, "ff3e::8000:1");		CHECK(IN6_IS_ADDR_MC_SSM(&addr));
+	test_addr(&addr, "ff35::1:2");			CHECK(IN6_IS_ADDR_MC_SSM(&addr));
+	test_addr(&addr, "ff3e:1::8000:1");		CHECK(!IN6_IS_ADDR_MC_SSM(&addr));
+	test_addr(&addr, "ff3e:0:1::8000:1");		CHECK(!IN6_IS_ADDR_MC_SSM(&addr));
+	test_addr(&addr, "ff3e::1:0:0:8000:1");		CHECK(!IN6_IS_ADDR_MC_SSM(&addr));
+	test_addr(&addr, "ff0e::8000:1");		CHECK(!IN6_IS_ADDR_MC_SSM(&addr));
+	test_addr(&addr, "fe3e::8000:1");		CHECK(!IN6_IS_ADDR_MC_SSM(&addr));
+}
+
+/* Any source goes in the ASM list, the specific sources per source, nothing twice */
+static void test_compile(struct intnode **ints);
+static void test_compile(struct intnode **ints)
+{
+	struct in6_addr		group;
+	struct groupnode	*groupn;
+	struct oilsrc		*oils;
+
+	test_join(ints[0], "ff0e::1234", "::");
+	test_join(ints[1], "ff0e::1234", "2001:db8::1");
+	test_join(ints[2], "ff0e::1234", "2001:db8::1");
+	test_join(ints[2], "ff0e::1234", "2001:db8::2");
+	test_join(ints[3], "ff0e::1234", "2001:db8::1");
+	test_join(ints[3], "ff0e::1234", "::");
+
+	test_addr(&group, "ff0e::1234");
+	groupn = group_find(&group);
+	CHECK(groupn != NULL);
+	CHECK(!groupn->oil_dirty);
+
+	CHECK(groupn->oil_count == 2);
+	CHECK(has_int(groupn->oil, groupn->oil_count, ints[0]));
+	CHECK(has_int(groupn->oil, groupn->oil_count, ints[3]));
+
+	CHECK(groupn->oil_srccount == 2);
+	CHECK(groupn->oil_srchash == NULL);
+
+	oils = find_src("ff0e::1234", "2001:db8::1");
+	CHECK(oils != NULL && oils->count == 2 && oils->groupn == groupn);
+	CHECK(has_int(oils->ints, oils->count, ints[1]));
+	CHECK(has_int(oils->ints, oils->count, ints[2]));
+
+	oils = find_src("ff0e::1234", "2001:db8::2");
+	CHECK(oils != NULL && oils->count == 1 && oils->ints[0] == ints[2]);
+
+	CHECK(find_src("ff0e::1234", "2001:db8::3") == NULL);
+
+	/* Not SSM, thus not in the channel table */
+	CHECK(find_channel("ff0e::1234", "2001:db8::1") == NULL);
+}
+
+/* A report with many sources, they end up in hashes */
+static void test_many(struct intnode *intn);
+static void test_many(struct intnode *intn)
+{
+	struct grpintnode	*grpintn = NULL;
+	struct in6_addr		source;
+	char			text[INET6_ADDRSTRLEN];
+	uint64_t		i, sources = GROUP_OIL_HASHMIN + GRPINT_SUBSCR_HASHMIN;
+	struct oilsrc		*oils;
+
+	for (i = 0; i < sources; i++)
+	{
+		snprintf(text, sizeof(text), "2001:db8::%x", (unsigned int)(0x100 + i));
+		grpintn = test_join(intn, "ff0e::2", text);
+	}
+
+	CHECK(grpintn->subscrhash != NULL);
+	CHECK(grpintn->groupn->oil_srccount == sources);
+	CHECK(grpintn->groupn->oil_srchash != NULL);
+
+	for (i = 0; i < sources; i++)
+	{
+		snprintf(text, sizeof(text), "2001:db8::%x", (unsigned int)(0x100 + i));
+		test_addr(&source, text);
+
+		CHECK(subscr_find(grpintn, &source) != NULL);
+
+		oils = find_src("ff0e::2", text);
+		CHECK(oils != NULL && oils->count == 1 && oils->ints[0] == intn);
+	}
+
+	CHECK(find_src("ff0e::2", "2001:db8::1") == NULL);
+}
+
+/* SSM groups have their sources in the channel table, till they are left */
+static void test_ssm(struct intnode **ints);
+static void test_ssm(struct intnode **ints)
+{
+	struct grpintnode	*grpintn;
+	struct in6_addr		source;
+	struct oilsrc		*oils;
+
+	grpintn = test_join(ints[1], "ff3e::8000:1", "2001:db8::1");
+	test_join(ints[2], "ff3e::8000:1", "2001:db8::1");
+	test_join(ints[2], "ff3e::8000:1", "2001:db8::2");
+
+	oils = find_channel("ff3e::8000:1", "2001:db8::1");
+	CHECK(oils != NULL && oils->count == 2 && oils->groupn == grpintn->groupn);
+	CHECK(find_src("ff3e::8000:1", "2001:db8::1") == oils);
+
+	oils = find_channel("ff3e::8000:1", "2001:db8::2");
+	CHECK(oils != NULL && oils->count == 1 && oils->ints[0] == ints[2]);
+
+	CHECK(find_channel("ff3e::8000:1", "2001:db8::3") == NULL);
+
+	/* Not SSM, the bytes 2 and 3 are not zero */
+	test_join(ints[1], "ff3e:1::8000:1", "2001:db8::1");
+	CHECK(find_src("ff3e:1::8000:1", "2001:db8::1") != NULL);
+	CHECK(find_channel("ff3e:1::8000:1", "2001:db8::1") == NULL);
+
+	/* Leaving takes the channel out of the table */
+	test_addr(&source, "2001:db8::1");
+	CHECK(subscr_unsub(grpintn, &source));
+	group_oil_build(grpintn->groupn);
+
+	oils = find_channel("ff3e::8000:1", "2001:db8::1");
+	CHECK(oils != NULL && oils->count == 1 && oils->ints[0] == ints[2]);
+}
+
+/* Leaving and the group going away */
+static void test_leave(struct intnode **ints);
+static void test_leave(struct intnode **ints)
+{
+	struct in6_addr		group, any, source;
+	struct groupnode	*groupn;
+	struct grpintnode	*grpintn;
+	struct listnode		*ln, *next;
+
+	test_addr(&group, "ff0e::1234");
+	test_addr(&any, "::");
+	test_addr(&source, "2001:db8::2");
+	groupn = group_find(&group);
+	CHECK(groupn != NULL);
+
+	/* The first interface only wanted any source, the fourth also a specific one */
+	grpintn = grpint_find(&groupn->interfaces, ints[0]);
+	CHECK(grpintn != NULL && subscr_unsub(grpintn, &any));
+	grpintn = grpint_find(&groupn->interfaces, ints[3]);
+	CHECK(grpintn != NULL && subscr_unsub(grpintn, &any));
+	grpintn = grpint_find(&groupn->interfaces, ints[2]);
+	CHECK(grpintn != NULL && subscr_unsub(grpintn, &source));
+	group_oil_build(groupn);
+
+	CHECK(groupn->oil_count == 0);
+	CHECK(groupn->oil_srccount == 1);
+	CHECK(find_src("ff0e::1234", "2001:db8::2") == NULL);
+	CHECK(find_src("ff0e::1234", "2001:db8::1")->count == 3);
+
+	LIST_LOOP2(&groupn->interfaces, grpintn, ln, next)
+	{
+		if (!groupint_delete(grpintn)) break;
+	}
+	LIST_LOOP2_END
+
+	CHECK(group_find(&group) == NULL);
+}
+
+int main(void)
+{
+	struct intnode	*ints[5];
+	unsigned int	i;
+
+	test_init();
+
+	for (i = 0; i < 5; i++) ints[i] = test_int(i + 1);
+
+	test_ssm_range();
+	test_compile(ints);
+	test_many(ints[4]);
+	test_ssm(ints);
+	test_leave(ints);
+
+	return 0;
+}